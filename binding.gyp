@@ -4,8 +4,14 @@
       "target_name": "fios",
       "sources": [
         "src/libfios-export.c",
+        "src/libfios-crc32.c",
+        "src/libfios-delta.c",
         "src/libfios-file.c",
+        "src/libfios-lz.c",
+        "src/libfios-mux.c",
+        "src/libfios-pipe.c",
         "src/libfios-serial.c",
+        "src/libfios-task.c",
         "src/libfios_wrap.cxx"
       ],
     }
@@ -0,0 +1,570 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// throughput benchmark, sending files to ourselves over a pair of pseudo terminals
+// a relay thread per direction sits between them, emulating the speed, latency and jitter of a serial link
+
+#define _XOPEN_SOURCE 700
+
+#include "libfios.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! largest amount of data the relay takes from the sending side at once
+ * with an emulated baud rate, this is also how finely the link is paced
+ */
+#define BENCH_RELAY_BLOCK_SIZE 256
+
+/*! number of blocks the relay can hold, going past that leaves data in the pseudo terminal until there is room
+ */
+#define BENCH_RELAY_BLOCKS 0x2000
+
+/*! longest time a single transfer can take before the benchmark gives up on it
+ */
+#define BENCH_TIMEOUT_US 600000000ull
+
+typedef struct {
+    // emulated link, bits per second (0 for no limit), and latency and jitter in microseconds
+    unsigned int baudrate;
+    uint64_t latency, jitter;
+    // seed of the jitter, each run and direction gets its own sequence from it
+    uint32_t seed;
+    fios_file_options_t options;
+} bench_config_t;
+
+typedef struct {
+    int in, out;
+    const bench_config_t* config;
+    uint32_t random;
+    volatile bool stop;
+    pthread_t thread;
+    // blocks in flight, with the time they are due at the other side
+    struct {
+        uint64_t due;
+        unsigned int size;
+        uint8_t data[BENCH_RELAY_BLOCK_SIZE];
+    } blocks[BENCH_RELAY_BLOCKS];
+    unsigned int head, tail;
+} bench_relay_t;
+
+static uint64_t bench_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void bench_sleep_us(const uint64_t us)
+{
+    const struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+// xorshift, so that runs are the same everywhere for the same seed
+static uint32_t bench_random(uint32_t* const state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static bool bench_raw(const int fd)
+{
+    struct termios t;
+
+    if (tcgetattr(fd, &t) != 0)
+        return false;
+
+    t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    t.c_oflag &= ~OPOST;
+    t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    t.c_cflag &= ~(CSIZE | PARENB);
+    t.c_cflag |= CS8;
+    return tcsetattr(fd, TCSANOW, &t) == 0;
+}
+
+// open a pseudo terminal, returning its master side and the path of the other one
+static int bench_openpt(char path[64])
+{
+    const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+        return -1;
+
+    const char* const name = grantpt(fd) == 0 && unlockpt(fd) == 0 ? ptsname(fd) : NULL;
+
+    if (name == NULL || strlen(name) >= 64 || ! bench_raw(fd) || fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    strcpy(path, name);
+    return fd;
+}
+
+static void* bench_relay_thread(void* const arg)
+{
+    bench_relay_t* const r = arg;
+    const bench_config_t* const config = r->config;
+    // when the emulated line is done sending what it has so far
+    uint64_t linefree = 0;
+
+    while (! r->stop)
+    {
+        const uint64_t now = bench_time_us();
+
+        // deliver everything that is due, in order, as a real line never reorders data
+        while (r->tail != r->head && r->blocks[r->tail % BENCH_RELAY_BLOCKS].due <= now)
+        {
+            const unsigned int slot = r->tail % BENCH_RELAY_BLOCKS;
+            const ssize_t w = write(r->out, r->blocks[slot].data, r->blocks[slot].size);
+
+            if (w < 0)
+            {
+                if (errno == EAGAIN || errno == EINTR)
+                    break;
+
+                // nobody on the other side anymore, drop it
+                ++r->tail;
+                continue;
+            }
+
+            if ((unsigned int)w < r->blocks[slot].size)
+            {
+                memmove(r->blocks[slot].data, r->blocks[slot].data + w, r->blocks[slot].size - w);
+                r->blocks[slot].size -= w;
+                break;
+            }
+
+            ++r->tail;
+        }
+
+        // take more data while there is room for it
+        if (r->head - r->tail < BENCH_RELAY_BLOCKS)
+        {
+            const unsigned int slot = r->head % BENCH_RELAY_BLOCKS;
+            const ssize_t n = read(r->in, r->blocks[slot].data, BENCH_RELAY_BLOCK_SIZE);
+
+            if (n > 0)
+            {
+                // the line takes its time to send each block, one after the other
+                const uint64_t start = linefree > now ? linefree : now;
+                linefree = start + (config->baudrate != 0 ? n * 10000000ull / config->baudrate : 0);
+
+                uint64_t due = linefree + config->latency;
+
+                if (config->jitter != 0)
+                    due += bench_random(&r->random) % (config->jitter + 1);
+
+                // jitter can make a block arrive later, never earlier than the one before it
+                if (r->head != r->tail && due < r->blocks[(r->head - 1) % BENCH_RELAY_BLOCKS].due)
+                    due = r->blocks[(r->head - 1) % BENCH_RELAY_BLOCKS].due;
+
+                r->blocks[slot].due = due;
+                r->blocks[slot].size = n;
+                ++r->head;
+                continue;
+            }
+        }
+
+        // wait for more data, or until the next block is due
+        int timeout = 10;
+
+        if (r->tail != r->head)
+        {
+            const uint64_t due = r->blocks[r->tail % BENCH_RELAY_BLOCKS].due;
+            const uint64_t wait = due > now ? (due - now + 999) / 1000 : 0;
+
+            if (wait < (uint64_t)timeout)
+                timeout = wait;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = r->in, .events = r->head - r->tail < BENCH_RELAY_BLOCKS ? POLLIN : 0 },
+            { .fd = r->out, .events = r->tail != r->head && timeout == 0 ? POLLOUT : 0 },
+        };
+
+        if (timeout == 0 && fds[1].events == 0)
+            continue;
+
+        // pseudo terminals report a hangup while the serial port is not yet open, which would make this spin
+        if (poll(fds, 2, timeout) > 0 && (fds[0].revents & POLLHUP) != 0)
+            bench_sleep_us(1000);
+    }
+
+    return NULL;
+}
+
+static bool bench_relay_start(bench_relay_t* const r, const int in, const int out,
+                              const bench_config_t* const config, const uint32_t seed)
+{
+    r->in = in;
+    r->out = out;
+    r->config = config;
+    r->random = seed != 0 ? seed : 1;
+    r->stop = false;
+    r->head = r->tail = 0;
+    return pthread_create(&r->thread, NULL, bench_relay_thread, r) == 0;
+}
+
+static void bench_relay_stop(bench_relay_t* const r)
+{
+    r->stop = true;
+    pthread_join(r->thread, NULL);
+}
+
+// fill @a path with @a size bytes of data that does not compress, the same for every run
+static bool bench_write_input(const char* const path, const int64_t size, uint32_t seed)
+{
+    FILE* const file = fopen(path, "wb");
+
+    if (file == NULL)
+        return false;
+
+    uint32_t buf[1024];
+    seed = seed != 0 ? seed : 1;
+
+    for (int64_t w = 0; w < size;)
+    {
+        for (unsigned int i = 0; i < 1024; ++i)
+            buf[i] = bench_random(&seed);
+
+        const size_t n = size - w < (int64_t)sizeof(buf) ? (size_t)(size - w) : sizeof(buf);
+
+        if (fwrite(buf, 1, n, file) != n)
+        {
+            fclose(file);
+            return false;
+        }
+
+        w += n;
+    }
+
+    return fclose(file) == 0;
+}
+
+static bool bench_compare(const char* const path1, const char* const path2)
+{
+    FILE* const file1 = fopen(path1, "rb");
+    FILE* const file2 = fopen(path2, "rb");
+    bool same = file1 != NULL && file2 != NULL;
+
+    while (same)
+    {
+        uint8_t buf1[0x4000], buf2[0x4000];
+        const size_t r1 = fread(buf1, 1, sizeof(buf1), file1);
+        const size_t r2 = fread(buf2, 1, sizeof(buf2), file2);
+
+        same = r1 == r2 && memcmp(buf1, buf2, r1) == 0;
+
+        if (r1 == 0)
+            break;
+    }
+
+    if (file1 != NULL)
+        fclose(file1);
+    if (file2 != NULL)
+        fclose(file2);
+
+    return same;
+}
+
+// upper bound in milliseconds of the latency histogram bucket holding @a fraction of the chunks, or -1 for the last one
+static long bench_latency_percentile(const fios_file_stats_t* const stats, const double fraction)
+{
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < STATS_LATENCY_BUCKETS; ++i)
+        total += stats->ack_latency[i];
+
+    if (total == 0)
+        return 0;
+
+    uint64_t count = 0;
+
+    for (unsigned int i = 0; i < STATS_LATENCY_BUCKETS - 1; ++i)
+    {
+        count += stats->ack_latency[i];
+
+        if (count >= total * fraction)
+            return 1l << i;
+    }
+
+    return -1;
+}
+
+// transfer the file at @a inpath into @a outpath once, printing a line of results
+static bool bench_run(const bench_config_t* const config,
+                      const char* const inpath,
+                      const char* const outpath,
+                      const int64_t size,
+                      const unsigned int run)
+{
+    char path1[64], path2[64];
+    const int m1 = bench_openpt(path1);
+    const int m2 = m1 >= 0 ? bench_openpt(path2) : -1;
+    bool ok = false;
+
+    if (m2 < 0)
+    {
+        fprintf(stderr, "fios-bench: failed to open pseudo terminals, error %d: %s\n", errno, strerror(errno));
+        if (m1 >= 0)
+            close(m1);
+        return false;
+    }
+
+    // relays are large, keep them off the stack
+    bench_relay_t* const relays = calloc(2, sizeof(bench_relay_t));
+    fios_serial_t* const s1 = fios_serial_open(path1);
+    fios_serial_t* const s2 = s1 != NULL ? fios_serial_open(path2) : NULL;
+
+    if (relays == NULL || s2 == NULL)
+        goto cleanup;
+
+    if (! bench_relay_start(&relays[0], m1, m2, config, config->seed + run * 2))
+        goto cleanup;
+
+    if (! bench_relay_start(&relays[1], m2, m1, config, config->seed + run * 2 + 1))
+    {
+        bench_relay_stop(&relays[0]);
+        goto cleanup;
+    }
+
+    const uint64_t start = bench_time_us();
+    fios_file_t* const receiver = fios_file_receive_ex(s2, outpath, &config->options);
+    fios_file_t* const sender = receiver != NULL ? fios_file_send_ex(s1, inpath, &config->options) : NULL;
+
+    if (sender != NULL)
+    {
+        while (fios_file_wait(sender, 100) == fios_file_status_in_progress
+               && bench_time_us() - start < BENCH_TIMEOUT_US) {}
+
+        while (fios_file_wait(receiver, 100) == fios_file_status_in_progress
+               && bench_time_us() - start < BENCH_TIMEOUT_US) {}
+
+        const uint64_t elapsed = bench_time_us() - start;
+        fios_file_stats_t stats;
+        fios_file_get_stats(sender, &stats);
+
+        ok = fios_file_idle(sender, NULL) == fios_file_status_completed
+          && fios_file_idle(receiver, NULL) == fios_file_status_completed;
+
+        // stop the receiver before checking its output, so that everything was written
+        fios_file_close(sender);
+        fios_file_close(receiver);
+
+        ok = ok && bench_compare(inpath, outpath);
+
+        const unsigned int payload = config->options.adaptive_payload ? config->options.max_payload_size : 0;
+
+        printf("%lld,%u,%u,%u,%.3f,%.3f,%u,%s,%.6f,%.6f,%llu,%.1f,%ld,%ld,%ld,%llu,%.6f,%.6f,%.6f\n",
+               (long long)size,
+               payload,
+               config->options.window,
+               config->baudrate,
+               config->latency / 1000.0,
+               config->jitter / 1000.0,
+               run,
+               ok ? "ok" : "failed",
+               elapsed / 1000000.0,
+               elapsed != 0 ? size / (double)elapsed : 0.0,
+               (unsigned long long)stats.chunks,
+               stats.chunks != 0 ? (double)size / stats.chunks : 0.0,
+               bench_latency_percentile(&stats, 0.5),
+               bench_latency_percentile(&stats, 0.9),
+               bench_latency_percentile(&stats, 0.99),
+               (unsigned long long)stats.retransmits,
+               stats.serial_read_us / 1000000.0,
+               stats.serial_write_us / 1000000.0,
+               stats.stream_us / 1000000.0);
+        fflush(stdout);
+    }
+    else if (receiver != NULL)
+    {
+        fios_file_close(receiver);
+    }
+
+    bench_relay_stop(&relays[0]);
+    bench_relay_stop(&relays[1]);
+
+cleanup:
+    if (s2 != NULL)
+        fios_serial_close(s2);
+    if (s1 != NULL)
+        fios_serial_close(s1);
+
+    free(relays);
+    close(m1);
+    close(m2);
+    return ok;
+}
+
+// parse a size with an optional k, M or G suffix
+static bool bench_parse_size(const char* const str, int64_t* const size)
+{
+    char* end;
+    const long long value = strtoll(str, &end, 10);
+
+    if (end == str || value < 0)
+        return false;
+
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        *size = value << 10;
+        ++end;
+        break;
+    case 'm':
+    case 'M':
+        *size = value << 20;
+        ++end;
+        break;
+    case 'g':
+    case 'G':
+        *size = value << 30;
+        ++end;
+        break;
+    default:
+        *size = value;
+        break;
+    }
+
+    return *end == 0;
+}
+
+// parse a comma-separated list of sizes, returning how many there are
+static unsigned int bench_parse_sizes(char* const str, int64_t* const sizes, const unsigned int max)
+{
+    unsigned int count = 0;
+
+    for (char* tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        if (count == max || ! bench_parse_size(tok, &sizes[count]))
+            return 0;
+
+        ++count;
+    }
+
+    return count;
+}
+
+static int usage(char* argv[])
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --sizes LIST       file sizes to send, e.g. 64k,1M,16M (default 64k,1M,8M)\n"
+            "  --payloads LIST    largest chunk sizes with adaptive chunk sizing, 0 for fixed default chunks (default 0)\n"
+            "  --runs N           runs of each combination (default 3)\n"
+            "  --baud N           emulated baud rate, 0 for no limit (default 0)\n"
+            "  --latency MS       emulated latency of each direction (default 0)\n"
+            "  --jitter MS        random extra latency of up to this much (default 0)\n"
+            "  --seed N           seed of the input data and jitter (default 1)\n"
+            "  --window N         chunks in flight (default 0, the lock-step protocol)\n"
+            "  --binary           use binary framing\n"
+            "  --crc              use per-chunk checksums\n"
+            "  --compression      use per-chunk compression\n"
+            "  --dir PATH         directory for the files being transferred (default /tmp)\n"
+            "Results are printed as CSV, one line per run\n",
+            argv[0]);
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    bench_config_t config = { .seed = 1 };
+    char defsizes[] = "64k,1M,8M";
+    char defpayloads[] = "0";
+    char* sizesarg = defsizes;
+    char* payloadsarg = defpayloads;
+    const char* dir = "/tmp";
+    unsigned int runs = 3;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const arg = argv[i];
+
+        if (! strcmp(arg, "--binary"))
+            config.options.binary_framing = true;
+        else if (! strcmp(arg, "--crc"))
+            config.options.crc = true;
+        else if (! strcmp(arg, "--compression"))
+            config.options.compression = true;
+        else if (i + 1 == argc)
+            return usage(argv);
+        else if (! strcmp(arg, "--sizes"))
+            sizesarg = argv[++i];
+        else if (! strcmp(arg, "--payloads"))
+            payloadsarg = argv[++i];
+        else if (! strcmp(arg, "--runs"))
+            runs = atoi(argv[++i]);
+        else if (! strcmp(arg, "--baud"))
+            config.baudrate = atoi(argv[++i]);
+        else if (! strcmp(arg, "--latency"))
+            config.latency = atof(argv[++i]) * 1000;
+        else if (! strcmp(arg, "--jitter"))
+            config.jitter = atof(argv[++i]) * 1000;
+        else if (! strcmp(arg, "--seed"))
+            config.seed = strtoul(argv[++i], NULL, 10);
+        else if (! strcmp(arg, "--window"))
+            config.options.window = atoi(argv[++i]);
+        else if (! strcmp(arg, "--dir"))
+            dir = argv[++i];
+        else
+            return usage(argv);
+    }
+
+    int64_t sizes[64], payloads[64];
+    const unsigned int numsizes = bench_parse_sizes(sizesarg, sizes, 64);
+    const unsigned int numpayloads = bench_parse_sizes(payloadsarg, payloads, 64);
+
+    if (numsizes == 0 || numpayloads == 0 || runs == 0)
+        return usage(argv);
+
+    char inpath[0x400], outpath[0x400];
+    snprintf(inpath, sizeof(inpath), "%s/fios-bench-%d.in", dir, (int)getpid());
+    snprintf(outpath, sizeof(outpath), "%s/fios-bench-%d.out", dir, (int)getpid());
+
+    printf("size,payload,window,baud,latency_ms,jitter_ms,run,result,seconds,mb_per_s,chunks,avg_chunk,"
+           "ack_p50_ms,ack_p90_ms,ack_p99_ms,retransmits,serial_read_s,serial_write_s,stream_s\n");
+    fflush(stdout);
+
+    unsigned int failed = 0;
+
+    for (unsigned int i = 0; i < numsizes; ++i)
+    {
+        if (! bench_write_input(inpath, sizes[i], config.seed))
+        {
+            fprintf(stderr, "fios-bench: failed to write '%s', error %d: %s\n", inpath, errno, strerror(errno));
+            return 1;
+        }
+
+        for (unsigned int j = 0; j < numpayloads; ++j)
+        {
+            config.options.adaptive_payload = payloads[j] != 0;
+            config.options.max_payload_size = payloads[j];
+
+            for (unsigned int run = 0; run < runs; ++run)
+            {
+                if (! bench_run(&config, inpath, outpath, sizes[i], run))
+                    ++failed;
+            }
+        }
+    }
+
+    remove(inpath);
+    remove(outpath);
+    return failed != 0 ? 1 : 0;
+}
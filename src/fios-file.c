@@ -6,12 +6,6 @@
 #include <stdio.h>
 #include <string.h>
 
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <unistd.h>
-#endif
-
 static int usage(char* argv[])
 {
     fprintf(stderr, "Usage: %s [r|s] [device-path|auto] [file-path]\n", argv[0]);
@@ -64,16 +58,11 @@ int main(int argc, char* argv[])
     fprintf(stdout, "\n");
     fflush(stdout);
 
-    float progress;
-    while (fios_file_idle(f, &progress) == fios_file_status_in_progress)
+    // refresh progress every 100ms, returning as soon as the transfer is done
+    while (fios_file_wait(f, 100) == fios_file_status_in_progress)
     {
-        fprintf(stdout, "\rProgress: %.1f %%", progress * 100);
+        fprintf(stdout, "\rProgress: %.1f %%", fios_file_get_progress(f) * 100);
         fflush(stdout);
-       #ifdef _WIN32
-        Sleep(100);
-       #else
-        usleep(100 * 1000);
-       #endif
     }
 
     fprintf(stdout, "\n");
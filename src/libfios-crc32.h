@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/*! update a CRC-32 (same as zlib and ethernet) with @a size bytes of @a data
+ * use 0 as initial value, the returned value can be passed back in to continue a running checksum
+ * uses ARMv8 CRC32 instructions when available, a slice-by-8 table implementation otherwise
+ */
+uint32_t fios_crc32(uint32_t crc, const void* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,338 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "libfios-delta.h"
+#include "libfios-crc32.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Encoded data is a series of instructions, each being one of:
+//  - 'C', first block index and block count as 4 bytes each, little-endian, copying full blocks of the existing file
+//  - 'L', data length as 4 bytes, little-endian, followed by the data
+// Only full blocks of the existing file have signatures, so its last block is never copied when shorter than the rest.
+// Literal data is split at the window size of the encoder.
+
+#define DELTA_NO_BLOCK UINT32_MAX
+
+// the input is held in a window of at least this size, and 4 blocks
+#define DELTA_MIN_WINDOW 0x100000
+
+struct _fios_delta_encoder_t {
+    const uint8_t* signatures;
+    uint32_t count;
+    size_t blocksize;
+    fios_delta_read_t* read;
+    void* cookie;
+    // hash table of weak checksums, chained in block order so the earliest matching block is tried first
+    unsigned int bits;
+    uint32_t* heads;
+    uint32_t* next;
+    // window of input, with the current position and the start of the literal data before it
+    uint8_t* window;
+    size_t capacity, length, pos, literal;
+    bool eof, rolling, done;
+    uint32_t a, b;
+    // run of copies not written yet
+    uint32_t copyindex, copycount;
+    // instructions not read yet, at most one step worth of them
+    uint8_t* out;
+    size_t outpos, outlen;
+};
+
+static void _delta_put_u32(uint8_t* const data, const uint32_t value)
+{
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t _delta_get_u32(const uint8_t* const data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// weak checksum parts as in rsync, a being the sum of all bytes and b the sum weighted by distance to the block end
+static void _delta_weak_init(const uint8_t* const data, const size_t size, uint32_t* const a, uint32_t* const b)
+{
+    uint32_t sa = 0, sb = 0;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        sa += data[i];
+        sb += (uint32_t)(size - i) * data[i];
+    }
+
+    *a = sa;
+    *b = sb;
+}
+
+static uint32_t _delta_weak(const uint32_t a, const uint32_t b)
+{
+    return (a & 0xffff) | (b << 16);
+}
+
+static uint32_t _delta_hash(const uint32_t weak, const unsigned int bits)
+{
+    return (weak * 2654435761u) >> (32 - bits);
+}
+
+static void _delta_append(fios_delta_encoder_t* const e, const uint8_t* const data, const size_t size)
+{
+    memcpy(e->out + e->outlen, data, size);
+    e->outlen += size;
+}
+
+static void _delta_write_copy(fios_delta_encoder_t* const e)
+{
+    uint8_t header[FIOS_DELTA_COPY_SIZE] = { FIOS_DELTA_COPY };
+    _delta_put_u32(header + 1, e->copyindex);
+    _delta_put_u32(header + 5, e->copycount);
+    _delta_append(e, header, sizeof(header));
+    e->copycount = 0;
+}
+
+// write the pending copies and the literal data up to @a end of the window
+static void _delta_write_literal(fios_delta_encoder_t* const e, const size_t end)
+{
+    if (e->copycount != 0)
+        _delta_write_copy(e);
+
+    if (end == e->literal)
+        return;
+
+    uint8_t header[FIOS_DELTA_LITERAL_SIZE] = { FIOS_DELTA_LITERAL };
+    _delta_put_u32(header + 1, end - e->literal);
+    _delta_append(e, header, sizeof(header));
+    _delta_append(e, e->window + e->literal, end - e->literal);
+    e->literal = end;
+}
+
+// read more input once the current block goes past the window
+// literal data that would not fit anymore is written out first, so that the window only holds what is still needed
+static void _delta_fill(fios_delta_encoder_t* const e)
+{
+    if (e->length == e->capacity)
+    {
+        if (e->literal == 0)
+            _delta_write_literal(e, e->pos);
+
+        memmove(e->window, e->window + e->literal, e->length - e->literal);
+        e->length -= e->literal;
+        e->pos -= e->literal;
+        e->literal = 0;
+    }
+
+    // filling the whole window every time makes the output independent of how the input is split by reads
+    while (e->length != e->capacity)
+    {
+        const size_t r = e->read(e->cookie, e->window + e->length, e->capacity - e->length);
+
+        if (r == 0)
+        {
+            e->eof = true;
+            break;
+        }
+
+        e->length += r;
+    }
+}
+
+// look for a block of the existing file at the current position, and move on either past it or by a single byte
+// writes at most a run of copies and the literal data of a window, so that the output buffer never overflows
+static void _delta_step(fios_delta_encoder_t* const e)
+{
+    const size_t blocksize = e->blocksize;
+
+    if (e->pos + blocksize > e->length && ! e->eof)
+    {
+        _delta_fill(e);
+        return;
+    }
+
+    // the rest of the input is shorter than a block
+    if (e->pos + blocksize > e->length)
+    {
+        _delta_write_literal(e, e->length);
+        e->done = true;
+        return;
+    }
+
+    // without blocks to look for, everything is literal data
+    if (e->count == 0)
+    {
+        e->pos = e->length - blocksize + 1;
+        return;
+    }
+
+    const uint8_t* const input = e->window;
+    const uint8_t* const signatures = e->signatures;
+    const size_t pos = e->pos;
+
+    if (! e->rolling)
+    {
+        _delta_weak_init(input + pos, blocksize, &e->a, &e->b);
+        e->rolling = true;
+    }
+
+    const uint32_t weak = _delta_weak(e->a, e->b);
+    uint32_t match = DELTA_NO_BLOCK;
+    bool crcdone = false;
+    uint32_t crc = 0;
+
+    // the block after the current run of copies is the most likely match, which keeps copies in a single instruction
+    const uint32_t candidate = e->copycount != 0 && pos == e->literal ? e->copyindex + e->copycount : DELTA_NO_BLOCK;
+
+    if (candidate < e->count && _delta_get_u32(signatures + candidate * FIOS_DELTA_SIGNATURE_SIZE) == weak)
+    {
+        crc = fios_crc32(0, input + pos, blocksize);
+        crcdone = true;
+
+        if (_delta_get_u32(signatures + candidate * FIOS_DELTA_SIGNATURE_SIZE + 4) == crc)
+            match = candidate;
+    }
+
+    for (uint32_t i = e->heads[_delta_hash(weak, e->bits)]; match == DELTA_NO_BLOCK && i != DELTA_NO_BLOCK; i = e->next[i])
+    {
+        if (_delta_get_u32(signatures + i * FIOS_DELTA_SIGNATURE_SIZE) != weak)
+            continue;
+
+        if (! crcdone)
+        {
+            crc = fios_crc32(0, input + pos, blocksize);
+            crcdone = true;
+        }
+
+        if (_delta_get_u32(signatures + i * FIOS_DELTA_SIGNATURE_SIZE + 4) == crc)
+            match = i;
+    }
+
+    if (match == DELTA_NO_BLOCK)
+    {
+        // roll the checksum one byte forward, or start over once the next byte is read
+        if (pos + blocksize < e->length)
+        {
+            e->a += input[pos + blocksize] - input[pos];
+            e->b += e->a - (uint32_t)blocksize * input[pos];
+        }
+        else
+        {
+            e->rolling = false;
+        }
+
+        ++e->pos;
+        return;
+    }
+
+    if (pos != e->literal)
+        _delta_write_literal(e, pos);
+
+    if (e->copycount != 0 && match != e->copyindex + e->copycount)
+        _delta_write_copy(e);
+
+    if (e->copycount == 0)
+        e->copyindex = match;
+
+    ++e->copycount;
+    e->pos = e->literal = pos + blocksize;
+    e->rolling = false;
+}
+
+void fios_delta_signature(const uint8_t* const block, const size_t size, uint8_t signature[FIOS_DELTA_SIGNATURE_SIZE])
+{
+    uint32_t a, b;
+    _delta_weak_init(block, size, &a, &b);
+    _delta_put_u32(signature, _delta_weak(a, b));
+    _delta_put_u32(signature + 4, fios_crc32(0, block, size));
+}
+
+fios_delta_encoder_t* fios_delta_encoder_open(const uint8_t* const signatures,
+                                             const uint32_t count,
+                                             const size_t blocksize,
+                                             fios_delta_read_t* const read,
+                                             void* const cookie)
+{
+    fios_delta_encoder_t* const e = calloc(1, sizeof(fios_delta_encoder_t));
+
+    if (e == NULL)
+        return NULL;
+
+    e->signatures = signatures;
+    e->count = count;
+    e->blocksize = blocksize;
+    e->read = read;
+    e->cookie = cookie;
+    e->bits = 4;
+    e->capacity = blocksize * 4 > DELTA_MIN_WINDOW ? blocksize * 4 : DELTA_MIN_WINDOW;
+
+    while (e->bits < 31 && (1u << e->bits) < count * 2u)
+        ++e->bits;
+
+    e->heads = malloc(sizeof(uint32_t) << e->bits);
+    e->next = malloc(sizeof(uint32_t) * (count != 0 ? count : 1));
+    e->window = malloc(e->capacity);
+    // a step writes at most a copy instruction and a window of literal data
+    e->out = malloc(e->capacity + FIOS_DELTA_COPY_SIZE + FIOS_DELTA_LITERAL_SIZE);
+
+    if (e->heads == NULL || e->next == NULL || e->window == NULL || e->out == NULL)
+    {
+        fios_delta_encoder_close(e);
+        return NULL;
+    }
+
+    memset(e->heads, 0xff, sizeof(uint32_t) << e->bits);
+
+    for (uint32_t i = count; i-- != 0;)
+    {
+        const uint32_t h = _delta_hash(_delta_get_u32(signatures + i * FIOS_DELTA_SIGNATURE_SIZE), e->bits);
+        e->next[i] = e->heads[h];
+        e->heads[h] = i;
+    }
+
+    return e;
+}
+
+size_t fios_delta_encoder_read(fios_delta_encoder_t* const e, uint8_t* const buffer, const size_t size)
+{
+    size_t r = 0;
+
+    while (r < size)
+    {
+        if (e->outpos == e->outlen)
+        {
+            if (e->done)
+                break;
+
+            e->outpos = e->outlen = 0;
+
+            while (e->outlen == 0 && ! e->done)
+                _delta_step(e);
+
+            continue;
+        }
+
+        const size_t r2 = e->outlen - e->outpos < size - r ? e->outlen - e->outpos : size - r;
+
+        if (buffer != NULL)
+            memcpy(buffer + r, e->out + e->outpos, r2);
+
+        e->outpos += r2;
+        r += r2;
+    }
+
+    return r;
+}
+
+void fios_delta_encoder_close(fios_delta_encoder_t* const e)
+{
+    if (e == NULL)
+        return;
+
+    free(e->heads);
+    free(e->next);
+    free(e->window);
+    free(e->out);
+    free(e);
+}
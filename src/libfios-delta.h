@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/*! size of the signature of each block, a weak rolling checksum followed by a CRC-32, both little-endian
+ */
+#define FIOS_DELTA_SIGNATURE_SIZE 8
+
+/*! instruction to copy a run of blocks from the existing file, followed by the first block index and block count
+ */
+#define FIOS_DELTA_COPY 'C'
+
+/*! instruction to insert new data, followed by its length and then the data itself
+ */
+#define FIOS_DELTA_LITERAL 'L'
+
+/*! size of the copy and literal instruction headers, including their 32-bit little-endian arguments
+ */
+#define FIOS_DELTA_COPY_SIZE 9
+#define FIOS_DELTA_LITERAL_SIZE 5
+
+/*! write the signature of a block of @a size bytes into @a signature
+ */
+void fios_delta_signature(const uint8_t* block, size_t size, uint8_t signature[FIOS_DELTA_SIGNATURE_SIZE]);
+
+/*! encoder turning an input into instructions to rebuild it from an existing file, see @fios_delta_encoder_open
+ */
+typedef struct _fios_delta_encoder_t fios_delta_encoder_t;
+
+/*! function reading the next part of the input of an encoder into @a buffer, returning 0 once the input is over
+ */
+typedef size_t fios_delta_read_t(void* cookie, uint8_t* buffer, size_t size);
+
+/*! start encoding the input read through @a read as instructions to rebuild it from an existing file,
+ * given the signatures of its @a count full blocks of @a blocksize bytes, in the style of rsync
+ * only a window of the input, of 4 blocks or 1 MiB, is kept in memory, along with at most a window of instructions
+ * @a signatures must stay valid until the encoder is closed
+ * returns null if out of memory
+ */
+fios_delta_encoder_t* fios_delta_encoder_open(const uint8_t* signatures,
+                                             uint32_t count,
+                                             size_t blocksize,
+                                             fios_delta_read_t* read,
+                                             void* cookie);
+
+/*! get up to @a size bytes of the next instructions, reading as much input as needed for them
+ * returns less than @a size only once all instructions were read
+ * @a buffer can be null to only count the instructions, encoding the same input again then gives the same ones
+ */
+size_t fios_delta_encoder_read(fios_delta_encoder_t* e, uint8_t* buffer, size_t size);
+
+/*! free an encoder
+ */
+void fios_delta_encoder_close(fios_delta_encoder_t* e);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,11 +1,21 @@
 // SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
 // SPDX-License-Identifier: ISC
 
+// 64-bit file offsets on 32-bit systems
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "libfios-crc32.h"
+#include "libfios-delta.h"
+#include "libfios-lz.h"
 #include "libfios-serial.h"
 #include "libfios-stream.h"
+#include "libfios-task.h"
 #include "utils.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -15,20 +25,198 @@
 #include <pthread.h>
 #elif defined(_WIN32)
 #include <windows.h>
+#include <direct.h>
+#include <io.h>
 #include <process.h>
 #else
 #include <pthread.h>
 #include <semaphore.h>
 #endif
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #define DEBUG_PRINT(...)
 // #define DEBUG_PRINT(...) printf(__VA_ARGS__)
 
+/*! version sent with the hello command, which starts the extended protocol
+ */
+#define FIOS_PROTOCOL_VERSION 1
+
+/*! number of payload sizes used by adaptive chunk sizing, each double the previous, starting at MIN_PAYLOAD_SIZE
+ */
+#define FIOS_PAYLOAD_LEVELS 8
+
+/*! acknowledgement latency above which adaptive chunk sizing always goes for smaller chunks
+ */
+#define FIOS_TARGET_CHUNK_LATENCY_US 250000
+
+/*! suffix appended to the output path for the journal of resumable transfers
+ */
+#define FIOS_JOURNAL_SUFFIX ".fios-journal"
+
+/*! amount of data written between journal updates
+ */
+#define FIOS_JOURNAL_INTERVAL 0x40000
+
+/*! suffix appended to the output path for the new file when updating it with delta encoding
+ */
+#define FIOS_DELTA_SUFFIX ".fios-delta"
+
+/*! smallest and largest block size for delta encoding, along with the largest number of blocks in a signature
+ */
+#define FIOS_DELTA_MIN_BLOCK_SIZE 0x400
+#define FIOS_DELTA_MAX_BLOCK_SIZE 0x100000
+#define FIOS_DELTA_MAX_BLOCKS 0x100000
+
+/*! smallest and largest stripe size of bonded transfers
+ * stripes are sized so that each serial port gets several of them, which evens out the time they all finish at
+ */
+#define FIOS_BOND_MIN_STRIPE_SIZE 0x10000
+#define FIOS_BOND_MAX_STRIPE_SIZE 0x400000
+
+/*! largest number of stripes in a bonded transfer, which the receiver keeps track of
+ */
+#define FIOS_BOND_MAX_STRIPES 0x1000000
+
+/*! period over which the instant throughput of transfer statistics is measured
+ */
+#define FIOS_STATS_PERIOD_US 1000000
+
+// serial port counters, as of the start and end of a transfer
+typedef struct {
+    uint64_t reads, writes, retries, read_us, write_us;
+} _fios_serial_counters_t;
+
+#if defined(__APPLE__)
+typedef semaphore_t _fios_sem_t;
+#elif defined(_WIN32)
+typedef HANDLE _fios_sem_t;
+#else
+typedef sem_t _fios_sem_t;
+#endif
+
 typedef struct _fios_file_t {
     fios_serial_t* serial;
     libfios_stream_functions funcs;
+    // optional, only used by senders for resuming and delta updates
+    libfios_stream_seek* seek;
     void* cookie;
     const char* error;
+    fios_file_options_t options;
+    bool extended;
+    bool binary;
+    bool compression;
+    bool crc;
+    unsigned int window;
+    // payload buffer, when larger than what fits on the thread stack
+    // with checksums this holds a chunk for each window slot, as they might need to be sent again
+    void* buffer;
+    // compressed payload buffer, also used for discarding damaged or duplicate chunks when receiving
+    uint8_t* zbuffer;
+    // chunk sizes, current and maximum as negotiated with the receiver
+    unsigned int payload_size, max_payload_size;
+    // chunks in flight when sending, indexed by sequence number
+    struct {
+        unsigned int size;
+        uint64_t time;
+        // payload as sent, for retransmissions
+        const void* payload;
+        uint32_t length;
+        uint8_t flags;
+    } inflight[MAX_WINDOW_SIZE];
+    uint32_t sent, acked;
+    // chunks received out of order when receiving with checksums, indexed by sequence number
+    struct {
+        const uint8_t* data;
+        unsigned int size;
+        bool received, nacked;
+    } pending[MAX_WINDOW_SIZE];
+    // probes waiting for a reply when sending
+    unsigned int probes;
+    // damaged frames seen and chunks sent again
+    unsigned int damaged, retransmits;
+    // adaptive chunk sizing, measured throughput for each payload size level
+    struct {
+        unsigned int level, maxlevel;
+        double throughput[FIOS_PAYLOAD_LEVELS];
+        uint64_t start, bytes;
+        unsigned int chunks, periods;
+    } adaptive;
+    // resuming, offset and checksum of what the receiver already has
+    // when receiving, also the journal where these are kept, along with the total size
+    struct {
+        bool negotiated;
+        int64_t offset, size, synced;
+        uint32_t crc;
+        char* path;
+        FILE* journal;
+    } resume;
+    // input file mapping when sending, chunks are sent straight from it instead of being copied into a buffer first
+    // fd is a duplicate of the input file descriptor, used to notice the file being truncated while mapped
+    struct {
+        const uint8_t* data;
+        size_t size, offset;
+        int fd;
+    } map;
+    // writer thread when receiving, with a ring of chunks waiting to be written to the output
+    // the output is only used by the writer thread while it runs, through its own copy of the cookie
+    struct {
+        bool running;
+        unsigned int slots, head, tail;
+        uint8_t* buffer;
+        unsigned int* sizes;
+        void* cookie;
+        _fios_sem_t free, used;
+       #ifdef _WIN32
+        HANDLE thread;
+       #else
+        pthread_t thread;
+       #endif
+    } writer;
+    // delta encoding, block size as negotiated and whether the data sent is instructions instead of the file itself
+    // when receiving, the existing output is the basis, with the new file written next to it until complete
+    // when sending, the instructions are encoded from the signatures of the receiver while being sent in place of the file
+    struct {
+        unsigned int block;
+        bool active;
+        FILE* basis;
+        int64_t basis_size;
+        char* path;
+        char* temp;
+        uint8_t* buffer;
+        // decoding state, partial instruction header and literal bytes still to come
+        uint8_t header[FIOS_DELTA_COPY_SIZE];
+        unsigned int headerlen;
+        uint64_t literal;
+        // size and checksum of the rebuilt file, expected and so far
+        int64_t target, produced;
+        uint32_t target_crc, crc;
+        fios_delta_encoder_t* encoder;
+        uint8_t* signatures;
+        uint64_t input, offset;
+    } delta;
+    // output in memory when receiving with fios_file_receive_memory, owned and grown as needed unless given by the caller
+    struct {
+        bool active, owned;
+        uint8_t* data;
+        size_t size, capacity;
+    } memory;
+    // output storage when receiving into a file, as asked for in the options or what was possible instead of it
+    // with a file descriptor of its own, which stays valid after fios_file_close closes the stream, -1 when not needed
+    struct {
+        fios_file_storage_t mode;
+        fios_file_sync_t sync;
+        int fd;
+        uint8_t* map;
+        size_t mapsize;
+    } storage;
    #if defined(__APPLE__)
     mach_port_t task;
     semaphore_t sem;
@@ -40,10 +228,116 @@ typedef struct _fios_file_t {
     sem_t sem;
     pthread_t thread;
    #endif
-    long current, size;
+    int64_t current, size;
+    // bytes written to the output when receiving, behind current while chunks wait for the writer thread
+    int64_t written;
+    // part of a batch session, running on its thread instead of one of its own
+    bool batched;
+    // running on the caller's thread from fios_file_process instead, with the event_loop option
+    fios_task_t* runner;
+    // running on a thread of the engine option instead
+    fios_task_t* shared;
+    // set to 1 by fios_file_close before stopping the transfer, so that its end is not reported
+    _fios_counter_t closing;
+    // progress last given to the progress callback
+    int64_t reported;
+    // statistics, see fios_file_get_stats, with the end only set once the transfer thread is done
+    struct {
+        _fios_counter_t start, end;
+        _fios_serial_counters_t base, last;
+        _fios_counter_t chunks, stream_us;
+        _fios_counter_t latency[STATS_LATENCY_BUCKETS];
+        // throughput over the last full period, and bytes and time at the start of the current one
+        _fios_counter_t rate, period_bytes, period_start;
+    } stats;
+   #ifndef _WIN32
+    // written to when progress or status changes, see fios_file_get_fd, not created for batched files nor tasks
+    // a single byte stays in the pipe until fios_file_process catches up, so the transfer thread rarely writes to it
+    int notifyfd[2];
+    atomic_bool notified;
+   #endif
     fios_file_status_t status;
 } fios_file_t;
 
+typedef struct _fios_batch_t {
+    fios_serial_t* serial;
+    fios_file_options_t options;
+    bool sending;
+    // set when closing, so no other file is started
+    bool cancelled;
+    // manifest, with names as sent and paths on this side
+    // count is only set once the manifest is complete, allocated is the size of the arrays
+    unsigned int count, allocated;
+    char** names;
+    char** paths;
+    int64_t* sizes;
+    // only with skip_unchanged, checksum of the sender files and which ones the receiver already has
+    uint32_t* crcs;
+    bool* skip;
+    unsigned int skipped;
+    char* destdir;
+    // file being transferred, set up again for each one and run on the batch thread
+    fios_file_t file;
+    unsigned int index;
+    // bytes of the files already done and of all files
+    int64_t done, total;
+    const char* error;
+   #if defined(__APPLE__)
+    mach_port_t task;
+    semaphore_t sem;
+    pthread_t thread;
+   #elif defined(_WIN32)
+    HANDLE sem;
+    HANDLE thread;
+   #else
+    sem_t sem;
+    pthread_t thread;
+   #endif
+    fios_file_status_t status;
+} fios_batch_t;
+
+typedef struct {
+    struct _fios_bond_t* bond;
+    fios_serial_t* serial;
+    // input or output of this serial port, positioned within the stripe in progress
+    FILE* stream;
+    // bytes of the stripe in progress still to be read or written
+    int64_t left;
+    // stripe in progress, run on the thread of this serial port
+    fios_file_t file;
+    // bytes of the stripes done over this serial port
+    int64_t bytes;
+   #ifdef _WIN32
+    HANDLE thread;
+   #else
+    pthread_t thread;
+   #endif
+    bool started;
+} _fios_bond_link_t;
+
+typedef struct _fios_bond_t {
+    bool sending;
+    // set when closing or once any serial port fails, so no other stripe is started
+    bool cancelled;
+    // file size and stripe size, only known on the receiver once the first serial port gets them
+    bool sized;
+    int64_t size, stripe;
+    // offset of the next stripe to send, and bytes of the stripes done over all serial ports
+    int64_t next, done;
+    // only when receiving, stripes already started, so that none is taken twice
+    bool* stripes;
+    fios_file_options_t options;
+    unsigned int count;
+    _fios_bond_link_t links[MAX_BOND_LINKS];
+    // protects everything above shared between serial ports
+    _fios_sem_t lock;
+   #if defined(__APPLE__)
+    mach_port_t task;
+   #endif
+    const char* error;
+    fios_file_status_t status;
+} fios_bond_t;
+
 #ifdef _WIN32
 static unsigned __stdcall _fios_thread_close()
 #else
@@ -58,502 +352,4518 @@ static void* _fios_thread_close()
    #endif
 }
 
-#ifdef _WIN32
-static unsigned __stdcall _fios_thread_error(fios_file_t* const f)
-#else
-static void* _fios_thread_error(fios_file_t* const f)
-#endif
+static bool _fios_serial_error(fios_file_t* const f)
 {
     f->error = "serial port operation failed";
     f->status = fios_file_status_error;
     fprintf(stderr, "serial port operation failed!\n");
-    return _fios_thread_close();
+    return false;
 }
 
-#ifdef _WIN32
-static unsigned __stdcall _fios_receive_thread(void* const arg)
-#else
-static void* _fios_receive_thread(void* const arg)
-#endif
+static void _fios_sem_post(_fios_sem_t* const sem)
 {
-    fios_file_t* const f = arg;
-    fios_serial_t* const s = f->serial;
-
-    char buf[MAX_PAYLOAD_SIZE_RECV];
-    char cmd[CMD_SIZE];
-    bool test;
+   #if defined(__APPLE__)
+    semaphore_signal(*sem);
+   #elif defined(_WIN32)
+    ReleaseSemaphore(*sem, 1, NULL);
+   #else
+    sem_post(sem);
+   #endif
+}
 
+static void _fios_sem_wait(_fios_sem_t* const sem)
+{
    #if defined(__APPLE__)
-    semaphore_signal(f->sem);
+    while (semaphore_wait(*sem) == KERN_ABORTED) {}
    #elif defined(_WIN32)
-    ReleaseSemaphore(f->sem, 1, NULL);
+    WaitForSingleObject(*sem, INFINITE);
    #else
-    sem_post(&f->sem);
+    while (sem_wait(sem) != 0 && errno == EINTR) {}
    #endif
+}
 
-    DEBUG_PRINT("waiting for size\n");
+static void _fios_serial_counters(const fios_serial_t* const s, _fios_serial_counters_t* const counters)
+{
+    counters->reads = _fios_counter_get(&s->reads);
+    counters->writes = _fios_counter_get(&s->writes);
+    counters->retries = _fios_counter_get(&s->read_retries) + _fios_counter_get(&s->write_retries);
+    counters->read_us = _fios_counter_get(&s->read_us);
+    counters->write_us = _fios_counter_get(&s->write_us);
+}
 
-    if (! fios_serial_read_cmd(s, cmd))
-    {
-        if (f->cookie == NULL)
-        {
-            fprintf(stderr, "output file was closed while opening serial port!\n");
-            return _fios_thread_close();
-        }
+static void _fios_stats_start(fios_file_t* const f)
+{
+    const uint64_t now = fios_serial_time_us();
 
-        fprintf(stderr, "size read failed, forcing reopen of serial port now!\n");
+    _fios_serial_counters(f->serial, &f->stats.base);
+    _fios_counter_set(&f->stats.start, now);
+    _fios_counter_set(&f->stats.period_start, now);
+}
 
-        char* const devpath = s->devpath;
-        s->devpath = NULL;
-        fios_serial_close(s);
-        f->serial = fios_serial_open(devpath);
-        free(devpath);
+// the serial port might be used for something else afterwards, so its counters are kept as they were at the end
+static void _fios_stats_end(fios_file_t* const f)
+{
+    _fios_serial_counters(f->serial, &f->stats.last);
+    _fios_counter_set(&f->stats.end, fios_serial_time_us());
+}
 
-        if (f->serial == NULL)
-        {
-            f->error = "serial port reopen failed";
-            f->status = fios_file_status_error;
-            fprintf(stderr, "serial port reopen failed!\n");
-            return _fios_thread_close();
-        }
+// count a chunk acknowledged @a latency microseconds after being sent
+static void _fios_stats_latency(fios_file_t* const f, const uint64_t latency)
+{
+    unsigned int bucket = 0;
 
-        if (! fios_serial_read_cmd(s, cmd))
-        {
-            if (f->cookie == NULL)
-            {
-                fprintf(stderr, "output file was closed while reopening serial port!\n");
-                return _fios_thread_close();
-            }
+    for (uint64_t ms = latency / 1000; ms != 0 && bucket < STATS_LATENCY_BUCKETS - 1; ms >>= 1)
+        ++bucket;
 
-            f->error = "serial port reopen read failed";
-            f->status = fios_file_status_error;
-            fprintf(stderr, "serial port reopen read failed!\n");
-            return _fios_thread_close();
-        }
-    }
+    _fios_counter_add(&f->stats.latency[bucket], 1);
+}
 
-    if (cmd[0] != 's' || cmd[1] != ' ')
-    {
-        f->error = "unexpected data received (invalid first command)";
-        f->status = fios_file_status_error;
-        fprintf(stderr, "error invalid command type %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
-        return _fios_thread_close();
-    }
+// measure throughput once per period, as progress changes
+static void _fios_stats_sample(fios_file_t* const f)
+{
+    const uint64_t now = fios_serial_time_us();
+    const uint64_t start = _fios_counter_get(&f->stats.period_start);
 
-    cmd[CMD_SIZE - 1] = 0;
+    if (now - start < FIOS_STATS_PERIOD_US)
+        return;
 
-    // size comes as 2nd arg
-    const long int size = strtol(cmd + 2, NULL, 16);
+    const uint64_t bytes = f->current;
+    const uint64_t startbytes = _fios_counter_get(&f->stats.period_bytes);
 
-    if (cmd[0] != 's' || cmd[1] != ' ')
+    _fios_counter_set(&f->stats.rate, bytes > startbytes ? (bytes - startbytes) * 1000000 / (now - start) : 0);
+    _fios_counter_set(&f->stats.period_bytes, bytes);
+    _fios_counter_set(&f->stats.period_start, now);
+}
+
+// let the owner know about a change in progress or status, through the progress callback and notification pipe
+static void _fios_file_notify(fios_file_t* const f)
+{
+    _fios_stats_sample(f);
+
+    if (f->options.progress_callback != NULL && ! f->batched)
     {
-        f->error = "unexpected data received (invalid size)";
-        f->status = fios_file_status_error;
-        fprintf(stderr, "invalid file size %ld\n", size);
-        return _fios_thread_close();
+        if (f->current - f->reported >= f->options.progress_interval || f->current < f->reported)
+        {
+            f->reported = f->current;
+            f->options.progress_callback(f->options.callback_cookie, f->current, f->size);
+        }
     }
 
-    DEBUG_PRINT("file size %ld\n", size);
+   #ifndef _WIN32
+    if (f->notifyfd[1] < 0 || atomic_exchange(&f->notified, true))
+        return;
 
-    f->size = size;
+    if (write(f->notifyfd[1], "n", 1) != 1)
+        perror("_fios_file_notify write");
+   #endif
+}
 
-    bool quitReceived = false;
-    while (f->cookie != NULL && f->status != fios_file_status_error && f->current != size)
-    {
-        DEBUG_PRINT("waiting for command\n");
+// report the end of the transfer from its thread, waking up fios_file_wait
+static void _fios_file_finish(fios_file_t* const f)
+{
+    _fios_stats_end(f);
 
-        test = fios_serial_read_cmd(s, cmd);
-        assert_return(test, _fios_thread_error(f));
+    // transfers stopped by fios_file_close are not reported, their failure only comes from being closed
+    if (f->options.status_callback != NULL && f->status != fios_file_status_in_progress && _fios_counter_get(&f->closing) == 0)
+        f->options.status_callback(f->options.callback_cookie, f, f->status);
 
-        if (cmd[0] == 'q' && cmd[1] == 0)
-        {
-            quitReceived = true;
-            break;
-        }
+    _fios_file_notify(f);
+    _fios_sem_post(&f->sem);
+}
 
-        if (cmd[0] != 'w' || cmd[1] != ' ')
-        {
-            f->error = "unexpected data received (invalid command)";
-            f->status = fios_file_status_error;
-            fprintf(stderr, "error invalid command type %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
-            break;
-        }
+static bool _fios_file_error(fios_file_t* const f, const char* const error)
+{
+    f->error = error;
+    f->status = fios_file_status_error;
+    fprintf(stderr, "%s!\n", error);
+    return false;
+}
 
-        cmd[CMD_SIZE - 1] = 0;
+static unsigned long _fios_cmd_value(char cmd[CMD_SIZE])
+{
+    cmd[CMD_SIZE - 1] = 0;
 
-        // size comes as 2nd arg
-        long int size = strtol(cmd + 2, NULL, 16);
+    return strtoul(cmd + 2, NULL, 16);
+}
 
-        DEBUG_PRINT("waiting for payload of size %ld | 0x%08lx\n", size, size);
-        test = fios_serial_read_payload(s, buf, size);
-        assert_return(test, _fios_thread_error(f));
+// write a command with a 64-bit value, the upper 32 bits go first in a separate command when not zero
+// must only be used when large sizes were negotiated, or with values that fit in 32 bits
+static bool _fios_write_cmd64(fios_serial_t* const s, const char type, const uint64_t value)
+{
+    char cmd[CMD_SIZE];
 
-        DEBUG_PRINT("payload received, sending ok back\n");
-        test = fios_serial_write_cmd(s, "ok");
-        assert_return(test, _fios_thread_error(f));
+    if (value >> 32 != 0)
+    {
+        snprintf(cmd, CMD_SIZE, "U 0x%08x", (unsigned int)(value >> 32));
 
-        // write received buffer to file
-        for (unsigned int w = 0, total = 0; total < size; total += w)
-        {
-            w = f->funcs.write(buf + total, 1, size - total, f->cookie);
+        if (! fios_serial_write_cmd(s, cmd))
+            return false;
+    }
 
-            if (w == 0)
-            {
-                f->error = "failed to write to output file";
-                f->status = fios_file_status_error;
-                perror("error partial write");
-                break;
-            }
-        }
+    snprintf(cmd, CMD_SIZE, "%c 0x%08x", type, (unsigned int)(value & 0xffffffff));
+    return fios_serial_write_cmd(s, cmd);
+}
 
-        f->current += size;
-    }
+// read a command that can carry a 64-bit value, as written by _fios_write_cmd64
+static bool _fios_read_cmd64(fios_serial_t* const s, char cmd[CMD_SIZE], uint64_t* const value)
+{
+    uint64_t upper = 0;
 
-    if (f->cookie != NULL && f->status != fios_file_status_error && f->current == size)
-    {
-        f->status = fios_file_status_completed;
+    if (! fios_serial_read_cmd(s, cmd))
+        return false;
 
-        if (! quitReceived)
-        {
-            test = fios_serial_read_cmd(s, cmd);
-            assert_return(test, _fios_thread_error(f));
+    if (cmd[0] == 'U' && cmd[1] == ' ')
+    {
+        upper = _fios_cmd_value(cmd);
 
-            if (cmd[0] != 'q' || cmd[1] != 0)
-            {
-                f->error = "unexpected data received (invalid quit command)";
-                f->status = fios_file_status_error;
-                fprintf(stderr, "error invalid quit command %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
-            }
-        }
+        if (! fios_serial_read_cmd(s, cmd))
+            return false;
     }
 
-    DEBUG_PRINT("_fios_receive_thread done\n");
-    return _fios_thread_close();
+    *value = upper << 32 | (_fios_cmd_value(cmd) & 0xffffffff);
+    return true;
 }
 
-#ifdef _WIN32
-static unsigned __stdcall _fios_send_thread(void* const arg)
-#else
-static void* _fios_send_thread(void* const arg)
-#endif
+static int _fios_fseek(FILE* const file, const int64_t offset, const int whence)
 {
-    fios_file_t* const f = arg;
-    fios_serial_t* const s = f->serial;
-
-    char buf[MAX_PAYLOAD_SIZE_SEND];
-    char cmd[CMD_SIZE];
-    bool test;
+   #ifdef _WIN32
+    return _fseeki64(file, offset, whence);
+   #else
+    return fseeko(file, offset, whence);
+   #endif
+}
 
-   #if defined(__APPLE__)
-    semaphore_signal(f->sem);
-   #elif defined(_WIN32)
-    ReleaseSemaphore(f->sem, 1, NULL);
+static int64_t _fios_ftell(FILE* const file)
+{
+   #ifdef _WIN32
+    return _ftelli64(file);
    #else
-    sem_post(&f->sem);
+    return ftello(file);
    #endif
+}
 
-    DEBUG_PRINT("writing size for %ld | 0x%lx bytes\n", f->size, f->size);
+static FILE* _fios_fopen(const char* const path, const char* const mode)
+{
+   #ifdef _WIN32
+    WCHAR lpath[MAX_PATH];
+    WCHAR lmode[4] = { 0 };
+    for (int i = 0; i < 3 && mode[i] != 0; ++i)
+        lmode[i] = mode[i];
 
-    // encode size command as first byte, followed by size
-    snprintf(cmd, CMD_SIZE, "s 0x%08lx", f->size);
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, lpath, MAX_PATH) != 0)
+        return _wfopen(lpath, lmode);
 
-    test = fios_serial_write_cmd(s, cmd);
-    assert_return(test, _fios_thread_error(f));
+    return NULL;
+   #else
+    return fopen(path, mode);
+   #endif
+}
 
-    while (f->cookie != NULL)
-    {
-        const unsigned int r = f->funcs.read(buf, 1, sizeof(buf), f->cookie);
+static bool _fios_mkdir(const char* const path)
+{
+   #ifdef _WIN32
+    WCHAR lpath[MAX_PATH];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, lpath, MAX_PATH) == 0)
+        return false;
 
-        DEBUG_PRINT("main file read return %d | 0x%x bytes\n", r, r);
+    return _wmkdir(lpath) == 0 || errno == EEXIST;
+   #else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+   #endif
+}
 
-        if (r == 0)
-            break;
+static void _fios_remove(const char* const path)
+{
+   #ifdef _WIN32
+    WCHAR lpath[MAX_PATH];
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, lpath, MAX_PATH) != 0)
+        _wremove(lpath);
+   #else
+    remove(path);
+   #endif
+}
+
+static bool _fios_rename(const char* const from, const char* const to)
+{
+   #ifdef _WIN32
+    WCHAR lfrom[MAX_PATH], lto[MAX_PATH];
+    return MultiByteToWideChar(CP_UTF8, 0, from, -1, lfrom, MAX_PATH) != 0
+        && MultiByteToWideChar(CP_UTF8, 0, to, -1, lto, MAX_PATH) != 0
+        && MoveFileExW(lfrom, lto, MOVEFILE_REPLACE_EXISTING) != 0;
+   #else
+    return rename(from, to) == 0;
+   #endif
+}
 
-        DEBUG_PRINT("writing command for %d | 0x%x bytes\n", r, r);
+// keep the existing file at @a outpath as the basis for delta encoding, if there is one worth using
+static bool _fios_delta_open(fios_file_t* const f, const char* const outpath)
+{
+    FILE* const basis = _fios_fopen(outpath, "rb");
 
-        // encode write command as first byte, followed by expected size, and then the payload
-        snprintf(cmd, CMD_SIZE, "w 0x%08x", r);
+    if (basis == NULL)
+        return true;
 
-        test = fios_serial_write_cmd(s, cmd);
-        assert_return(test, _fios_thread_error(f));
+    _fios_fseek(basis, 0, SEEK_END);
+    const int64_t size = _fios_ftell(basis);
 
-        DEBUG_PRINT("writing payload for %d | 0x%x bytes\n", r, r);
-        test = fios_serial_write_payload(s, buf, r);
-        assert_return(test, _fios_thread_error(f));
+    // blocks grow with the file, so that signatures stay small compared to it
+    unsigned int block = FIOS_DELTA_MIN_BLOCK_SIZE;
 
-        DEBUG_PRINT("waiting for ok signal for %d | 0x%x bytes\n", r, r);
-        test = fios_serial_read_cmd(s, cmd);
-        assert_return(test, _fios_thread_error(f));
+    while (block < FIOS_DELTA_MAX_BLOCK_SIZE && ((int64_t)block * block < size || size / block > FIOS_DELTA_MAX_BLOCKS))
+        block *= 2;
 
-        f->current += r;
+    if (size < FIOS_DELTA_MIN_BLOCK_SIZE || size / block > FIOS_DELTA_MAX_BLOCKS)
+    {
+        fclose(basis);
+        return true;
     }
 
-    f->status = fios_file_status_completed;
+    const size_t len = strlen(outpath);
+    f->delta.path = strdup(outpath);
+    f->delta.temp = malloc(len + sizeof(FIOS_DELTA_SUFFIX));
 
-    DEBUG_PRINT("writing command for close\n");
-    test = fios_serial_write_cmd(s, "q");
-    assert_return(test, _fios_thread_error(f));
+    if (f->delta.path == NULL || f->delta.temp == NULL)
+    {
+        fclose(basis);
+        return false;
+    }
 
-    DEBUG_PRINT("_fios_send_thread done\n");
-    return _fios_thread_close();
+    memcpy(f->delta.temp, outpath, len);
+    memcpy(f->delta.temp + len, FIOS_DELTA_SUFFIX, sizeof(FIOS_DELTA_SUFFIX));
+
+    f->delta.basis = basis;
+    f->delta.basis_size = size;
+    f->delta.block = block;
+    return true;
 }
 
-static bool _fios_thread_sem_wait(fios_file_t* const f)
+// load the journal left by a previous transfer into @a outpath, if there is one
+static bool _fios_journal_load(fios_file_t* const f, const char* const outpath)
 {
-    void* const cookie = f->cookie;
+    const size_t len = strlen(outpath);
+    char* const path = malloc(len + sizeof(FIOS_JOURNAL_SUFFIX));
 
-   #if defined(__APPLE__)
-    struct mach_timespec timeout = { 0 };
-    timeout.tv_sec = 1;
+    if (path == NULL)
+        return false;
 
-    if (semaphore_timedwait(f->sem, timeout) == KERN_SUCCESS)
+    memcpy(path, outpath, len);
+    memcpy(path + len, FIOS_JOURNAL_SUFFIX, sizeof(FIOS_JOURNAL_SUFFIX));
+    f->resume.path = path;
+
+    FILE* const journal = _fios_fopen(path, "rb");
+
+    if (journal == NULL)
         return true;
-   #elif defined(_WIN32)
-    if (WaitForSingleObject(f->sem, 1000) == WAIT_OBJECT_0)
+
+    unsigned long long size, offset;
+    unsigned int crc;
+
+    if (fscanf(journal, "fios-journal 0x%llx 0x%llx 0x%x", &size, &offset, &crc) == 3
+        && offset <= size && size <= MAX_FILE_SIZE_64)
+    {
+        DEBUG_PRINT("journal found, %llu out of %llu bytes already received\n", offset, size);
+        f->resume.size = size;
+        f->resume.offset = offset;
+        f->resume.crc = crc;
+    }
+
+    fclose(journal);
+    return true;
+}
+
+// check that the data in @a file still matches the journal, which is discarded otherwise
+static void _fios_journal_verify(fios_file_t* const f, FILE* const file)
+{
+    uint8_t* const buf = malloc(MAX_PAYLOAD_SIZE_RECV);
+    uint32_t crc = 0;
+    int64_t r = 0;
+
+    if (buf != NULL)
+    {
+        while (r < f->resume.offset)
+        {
+            const int64_t left = f->resume.offset - r;
+            const size_t r2 = fread(buf, 1, left < MAX_PAYLOAD_SIZE_RECV ? left : MAX_PAYLOAD_SIZE_RECV, file);
+
+            if (r2 == 0)
+                break;
+
+            crc = fios_crc32(crc, buf, r2);
+            r += r2;
+        }
+
+        free(buf);
+    }
+
+    if (r != f->resume.offset || crc != f->resume.crc)
+    {
+        DEBUG_PRINT("output file does not match the journal, ignoring it\n");
+        f->resume.offset = 0;
+        f->resume.crc = 0;
+    }
+}
+
+// record how much of the output is written, entries have a fixed size so they can be overwritten in place
+static void _fios_journal_write(fios_file_t* const f)
+{
+    FILE* const journal = f->resume.journal;
+
+    rewind(journal);
+    fprintf(journal, "fios-journal 0x%016llx 0x%016llx 0x%08x\n",
+            (unsigned long long)f->size, (unsigned long long)f->written, f->resume.crc);
+    fflush(journal);
+
+    f->resume.synced = f->written;
+}
+
+// receive the options sent after a hello command, up to and including the size command, and reply with the ones we accept
+// send the block signatures of the existing output, then find out if the sender replies with instructions or plain data
+static bool _fios_receive_delta_start(fios_file_t* const f)
+{
+    fios_serial_t* const s = f->serial;
+    const unsigned int block = f->delta.block;
+    const uint32_t count = f->delta.basis_size / block;
+    const size_t size = (size_t)count * FIOS_DELTA_SIGNATURE_SIZE;
+    uint8_t* const signatures = malloc(size);
+    char cmd[CMD_SIZE];
+    uint64_t value;
+
+    if (signatures == NULL || (f->delta.buffer = malloc(block)) == NULL)
+    {
+        free(signatures);
+        return _fios_file_error(f, "out of memory");
+    }
+
+    _fios_fseek(f->delta.basis, 0, SEEK_SET);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (fread(f->delta.buffer, 1, block, f->delta.basis) != block)
+        {
+            free(signatures);
+            return _fios_file_error(f, "failed to read existing output file");
+        }
+
+        fios_delta_signature(f->delta.buffer, block, signatures + i * FIOS_DELTA_SIGNATURE_SIZE);
+    }
+
+    snprintf(cmd, CMD_SIZE, "b 0x%08x", count);
+    bool ok = fios_serial_write_cmd(s, cmd) && fios_serial_write_payload(s, signatures, size);
+
+    snprintf(cmd, CMD_SIZE, "c 0x%08x", fios_crc32(0, signatures, size));
+    ok = ok && fios_serial_write_cmd(s, cmd);
+
+    free(signatures);
+
+    if (! ok || ! _fios_read_cmd64(s, cmd, &value))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // nothing to gain for this file, the sender goes on with the plain data
+    if (cmd[0] == 'D' && cmd[1] == ' ' && value == 0)
         return true;
+
+    if (cmd[0] != 'd' || cmd[1] != ' ' || value > MAX_FILE_SIZE_64)
+        return _fios_file_error(f, "unexpected data received (invalid delta reply)");
+
+    if (! fios_serial_read_cmd(s, cmd))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (cmd[0] != 'c' || cmd[1] != ' ')
+        return _fios_file_error(f, "unexpected data received (invalid delta reply)");
+
+    DEBUG_PRINT("receiving %llu bytes of delta instructions for %lld bytes\n", (unsigned long long)value, (long long)f->size);
+
+    // from here on the size is the one of the instructions, the file they rebuild is checked once they are all applied
+    f->delta.active = true;
+    f->delta.target = f->size;
+    f->delta.target_crc = _fios_cmd_value(cmd);
+    f->size = value;
+    return true;
+}
+
+static bool _fios_receive_handshake(fios_file_t* const f, char cmd[CMD_SIZE])
+{
+    fios_serial_t* const s = f->serial;
+    const unsigned int maxwindow = f->options.window != 0 && f->options.window < MAX_WINDOW_SIZE
+                                 ? f->options.window
+                                 : MAX_WINDOW_SIZE;
+    const unsigned int maxpayload = f->options.max_payload_size != 0
+                                  ? f->options.max_payload_size < MAX_ADAPTIVE_PAYLOAD_SIZE
+                                    ? f->options.max_payload_size
+                                    : MAX_ADAPTIVE_PAYLOAD_SIZE
+                                  : MAX_ADAPTIVE_PAYLOAD_SIZE;
+    bool adaptive = false;
+    bool resume = false;
+    bool large = false;
+    bool delta = false;
+    uint64_t value;
+
+    DEBUG_PRINT("hello received, protocol version %lu\n", _fios_cmd_value(cmd));
+
+    f->extended = true;
+    f->window = 1;
+
+    for (;;)
+    {
+        if (! _fios_read_cmd64(s, cmd, &value))
+            return _fios_file_error(f, "serial port operation failed");
+
+        if (cmd[1] != ' ')
+        {
+            fprintf(stderr, "error invalid option type %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
+            return _fios_file_error(f, "unexpected data received (invalid option)");
+        }
+
+        // options end with the regular size command
+        if (cmd[0] == 's')
+        {
+            if (value > MAX_FILE_SIZE_64)
+                return _fios_file_error(f, "unexpected data received (invalid size)");
+
+            f->size = value;
+
+            // a journal is only valid for a transfer of the same size
+            if (f->size != f->resume.size)
+                f->resume.offset = 0;
+            break;
+        }
+
+        switch (cmd[0])
+        {
+        case 'W':
+            f->window = value == 0 ? 1 : value < maxwindow ? value : maxwindow;
+            break;
+        case 'F':
+            f->binary = value != 0;
+            break;
+        case 'Z':
+            f->compression = value == 1;
+            break;
+        case 'C':
+            f->crc = value == 1;
+            break;
+        case 'P':
+            // sender wants to adapt chunk sizes, tell it our limit
+            adaptive = true;
+            f->max_payload_size = value < MIN_PAYLOAD_SIZE ? MIN_PAYLOAD_SIZE : value < maxpayload ? value : maxpayload;
+            break;
+        case 'R':
+            resume = value == 1 && f->resume.path != NULL;
+            break;
+        case 'L':
+            large = value == 1;
+            break;
+        case 'D':
+            delta = value == 1 && f->delta.basis != NULL;
+            break;
+        default:
+            // unknown options are not sent back, so the sender knows they are unsupported
+            DEBUG_PRINT("ignoring unknown option '%c'\n", cmd[0]);
+            break;
+        }
+    }
+
+    char reply[CMD_SIZE];
+    snprintf(reply, CMD_SIZE, "h 0x%08x", FIOS_PROTOCOL_VERSION);
+
+    if (! fios_serial_write_cmd(s, reply))
+        return _fios_file_error(f, "serial port operation failed");
+
+    snprintf(reply, CMD_SIZE, "W 0x%08x", f->window);
+
+    if (! fios_serial_write_cmd(s, reply))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (f->binary && ! fios_serial_write_cmd(s, "F 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // compression flags are part of the binary frame header
+    f->compression = f->compression && f->binary;
+
+    if (f->compression && ! fios_serial_write_cmd(s, "Z 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // checksums are a binary frame trailer
+    f->crc = f->crc && f->binary;
+
+    if (f->crc && ! fios_serial_write_cmd(s, "C 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (adaptive)
+    {
+        snprintf(reply, CMD_SIZE, "P 0x%08x", f->max_payload_size);
+
+        if (! fios_serial_write_cmd(s, reply))
+            return _fios_file_error(f, "serial port operation failed");
+    }
+
+    if (large && ! fios_serial_write_cmd(s, "L 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // resuming past 4GiB needs large sizes, which the sender always asks for when it supports them
+    if (! large && f->resume.offset > 0xffffffff)
+        f->resume.offset = 0;
+
+    // tell the sender how much we already have, it replies with where it starts after checking the data matches
+    if (resume)
+    {
+        if (! _fios_write_cmd64(s, 'R', f->resume.offset))
+            return _fios_file_error(f, "serial port operation failed");
+
+        snprintf(reply, CMD_SIZE, "H 0x%08x", f->resume.crc);
+
+        if (! fios_serial_write_cmd(s, reply))
+            return _fios_file_error(f, "serial port operation failed");
+    }
+
+    // tell the sender the block size for the signatures of our existing copy, which follow the handshake
+    if (delta)
+    {
+        snprintf(reply, CMD_SIZE, "D 0x%08x", f->delta.block);
+
+        if (! fios_serial_write_cmd(s, reply))
+            return _fios_file_error(f, "serial port operation failed");
+    }
+
+    if (! fios_serial_write_cmd(s, "ok"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (delta && ! _fios_receive_delta_start(f))
+        return false;
+
+    if (resume)
+    {
+        uint64_t offset;
+
+        if (! _fios_read_cmd64(s, reply, &offset))
+            return _fios_file_error(f, "serial port operation failed");
+
+        if (reply[0] != 'R' || reply[1] != ' ' || (offset != 0 && offset != (uint64_t)f->resume.offset))
+            return _fios_file_error(f, "unexpected data received (invalid resume offset)");
+
+        DEBUG_PRINT("resuming from offset %llu\n", (unsigned long long)offset);
+        f->current = offset;
+        _fios_file_notify(f);
+    }
+
+    return true;
+}
+
+// start writing at the offset agreed with the sender, discarding anything after it, and start a new journal
+static bool _fios_receive_resume_start(fios_file_t* const f)
+{
+    FILE* const file = f->cookie;
+
+    if (file == NULL)
+        return false;
+
+   #ifdef _WIN32
+    if (fflush(file) != 0 || _chsize_s(_fileno(file), f->current) != 0 || _fios_fseek(file, f->current, SEEK_SET) != 0)
    #else
-    struct timespec timeout;
-    clock_gettime(CLOCK_REALTIME, &timeout);
-    ++timeout.tv_sec;
+    if (fflush(file) != 0 || ftruncate(fileno(file), f->current) != 0 || _fios_fseek(file, f->current, SEEK_SET) != 0)
+   #endif
+        return _fios_file_error(f, "failed to resume output file");
 
-    if (sem_timedwait(&f->sem, &timeout) == 0)
+    // the journal checksum only applies to the data it was kept for
+    if (f->current != f->resume.offset)
+        f->resume.crc = 0;
+
+    if ((f->resume.journal = _fios_fopen(f->resume.path, "wb")) == NULL)
+        return _fios_file_error(f, "failed to create journal file");
+
+    f->written = f->current;
+
+    _fios_journal_write(f);
+    return true;
+}
+
+static bool _fios_receive_output(fios_file_t* const f, void* const cookie, const uint8_t* const buf, const size_t size)
+{
+    const uint64_t start = fios_serial_time_us();
+
+   #ifndef _WIN32
+    if (f->storage.map != NULL)
+    {
+        if ((uint64_t)f->written + size > f->storage.mapsize)
+            return _fios_file_error(f, "unexpected data received (more data than announced)");
+
+        // chunks read straight into the mapping are already in place
+        if (buf != f->storage.map + f->written)
+            memcpy(f->storage.map + f->written, buf, size);
+
+        _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
+        return true;
+    }
+
+    if (f->storage.mode != fios_file_storage_stream)
+    {
+        for (size_t total = 0; total < size;)
+        {
+            const ssize_t w = pwrite(f->storage.fd, buf + total, size - total, f->written + total);
+
+            if (w < 0 && errno == EINTR)
+                continue;
+
+            if (w <= 0)
+            {
+                perror("error positioned write");
+                return _fios_file_error(f, "failed to write to output file");
+            }
+
+            total += w;
+        }
+
+        _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
         return true;
+    }
    #endif
 
-    f->error = "serial port thread failed to start";
-    f->status = fios_file_status_error;
-    f->cookie = NULL;
-    f->funcs.close(cookie);
-    return false;
+    for (size_t w = 0, total = 0; total < size; total += w)
+    {
+        w = f->funcs.write(buf + total, 1, size - total, cookie);
+
+        if (w == 0)
+        {
+            f->error = "failed to write to output file";
+            f->status = fios_file_status_error;
+            perror("error partial write");
+            return false;
+        }
+    }
+
+    _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
+    return true;
+}
+
+// preallocate the output once its size is known, and map it if asked to
+static bool _fios_storage_start(fios_file_t* const f, const int64_t size)
+{
+   #ifndef _WIN32
+    if (f->storage.mode == fios_file_storage_stream || size == 0)
+        return true;
+
+   #ifdef __APPLE__
+    fstore_t store = { .fst_flags = F_ALLOCATEALL, .fst_posmode = F_PEOFPOSMODE, .fst_length = size };
+    const int error = fcntl(f->storage.fd, F_PREALLOCATE, &store) == 0 && ftruncate(f->storage.fd, size) == 0 ? 0 : errno;
+   #else
+    const int error = posix_fallocate(f->storage.fd, 0, size);
+   #endif
+
+    if (error == ENOSPC)
+        return _fios_file_error(f, "not enough space for output file");
+
+    // chunks are still written in place without preallocation, but mapping the output would not be safe then,
+    // as running out of space would crash instead of failing a write
+    if (error != 0 || f->storage.mode != fios_file_storage_mmap || (uint64_t)size > SIZE_MAX)
+    {
+        DEBUG_PRINT("output preallocation error %d: %s\n", error, strerror(error));
+        f->storage.mode = fios_file_storage_pwrite;
+        return true;
+    }
+
+    void* const data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->storage.fd, 0);
+
+    if (data == MAP_FAILED)
+    {
+        DEBUG_PRINT("failed to map output file, error %d: %s\n", errno, strerror(errno));
+        f->storage.mode = fios_file_storage_pwrite;
+        return true;
+    }
+
+   #ifdef MADV_SEQUENTIAL
+    madvise(data, size, MADV_SEQUENTIAL);
+   #endif
+
+    f->storage.map = data;
+    f->storage.mapsize = size;
+   #else
+    // unused
+    (void)f;
+    (void)size;
+   #endif
+
+    return true;
+}
+
+// where to read the next chunk of @a size bytes into, straight into the mapped output when it needs no decoding
+// chunks queued for the writer thread still need a copy in its ring, so they keep going through @a buf
+static uint8_t* _fios_storage_direct(fios_file_t* const f, uint8_t* const buf, const uint32_t size)
+{
+    if (f->storage.map != NULL && ! f->writer.running && (uint64_t)f->written + size <= f->storage.mapsize)
+        return f->storage.map + f->written;
+
+    return buf;
+}
+
+// flush @a size bytes of output at @a offset to storage, the whole output when using a stream
+// @a cookie is the output stream, which can only be null once fios_file_close closed it
+static bool _fios_storage_sync(fios_file_t* const f, void* const cookie, const int64_t offset, const int64_t size)
+{
+    const uint64_t start = fios_serial_time_us();
+    bool ok;
+
+   #ifdef _WIN32
+    // unused
+    (void)offset;
+    (void)size;
+
+    ok = cookie != NULL && fflush(cookie) == 0 && _commit(_fileno(cookie)) == 0;
+   #else
+    if (f->storage.map != NULL)
+    {
+        // msync needs a page-aligned address
+        const int64_t page = sysconf(_SC_PAGESIZE);
+        const int64_t first = offset - offset % page;
+
+        ok = size == 0 || msync(f->storage.map + first, offset + size - first, MS_SYNC) == 0;
+    }
+    else if (f->storage.mode == fios_file_storage_stream)
+    {
+        ok = cookie != NULL && fflush(cookie) == 0 && fsync(f->storage.fd) == 0;
+    }
+    else
+    {
+        // the size was set when preallocating, only the data needs to be synced
+       #ifdef __linux__
+        ok = fdatasync(f->storage.fd) == 0;
+       #else
+        ok = fsync(f->storage.fd) == 0;
+       #endif
+    }
+   #endif
+
+    _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
+
+    return ok || _fios_file_error(f, "failed to sync output file");
+}
+
+// make room for @a size bytes of output in memory, which only caller buffers cannot do
+static bool _fios_memory_reserve(fios_file_t* const f, const int64_t size)
+{
+    if ((uint64_t)size <= f->memory.capacity)
+        return true;
+
+    if (! f->memory.owned)
+        return _fios_file_error(f, "output buffer too small");
+
+    if ((uint64_t)size > SIZE_MAX)
+        return _fios_file_error(f, "out of memory");
+
+    uint8_t* const data = realloc(f->memory.data, size);
+
+    if (data == NULL)
+        return _fios_file_error(f, "out of memory");
+
+    f->memory.data = data;
+    f->memory.capacity = size;
+    return true;
+}
+
+// stream functions for receiving into memory, with the transfer itself as cookie
+static size_t _fios_memory_write(const void* const buffer, const size_t size, const size_t n, void* const cookie)
+{
+    fios_file_t* const f = cookie;
+    const size_t total = size * n;
+
+    if (! _fios_memory_reserve(f, f->memory.size + total))
+        return 0;
+
+    memcpy(f->memory.data + f->memory.size, buffer, total);
+    f->memory.size += total;
+    return n;
+}
+
+static int _fios_memory_close(void* const cookie)
+{
+    // unused, the data stays around until fios_file_close
+    (void)cookie;
+    return 0;
+}
+
+// write part of the rebuilt file, keeping track of its size and checksum
+static bool _fios_delta_output(fios_file_t* const f, void* const cookie, const uint8_t* const buf, const size_t size)
+{
+    if (f->delta.produced + (int64_t)size > f->delta.target)
+        return _fios_file_error(f, "unexpected data received (delta instructions past the end of the file)");
+
+    f->delta.crc = fios_crc32(f->delta.crc, buf, size);
+    f->delta.produced += size;
+    return _fios_receive_output(f, cookie, buf, size);
+}
+
+// copy @a count blocks of the existing output, starting at @a index, into the new one
+static bool _fios_delta_copy(fios_file_t* const f, void* const cookie, const uint32_t index, const uint32_t count)
+{
+    const unsigned int block = f->delta.block;
+    const uint32_t blocks = f->delta.basis_size / block;
+
+    if (index >= blocks || count > blocks - index)
+        return _fios_file_error(f, "unexpected data received (invalid delta copy)");
+
+    if (_fios_fseek(f->delta.basis, (int64_t)index * block, SEEK_SET) != 0)
+        return _fios_file_error(f, "failed to read existing output file");
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (fread(f->delta.buffer, 1, block, f->delta.basis) != block)
+            return _fios_file_error(f, "failed to read existing output file");
+
+        if (! _fios_delta_output(f, cookie, f->delta.buffer, block))
+            return false;
+    }
+
+    return true;
+}
+
+// apply received delta instructions, which can be split anywhere between chunks
+static bool _fios_delta_apply(fios_file_t* const f, void* const cookie, const uint8_t* buf, unsigned int size)
+{
+    while (size != 0)
+    {
+        if (f->delta.literal != 0)
+        {
+            const unsigned int r = f->delta.literal < size ? f->delta.literal : size;
+
+            if (! _fios_delta_output(f, cookie, buf, r))
+                return false;
+
+            f->delta.literal -= r;
+            buf += r;
+            size -= r;
+            continue;
+        }
+
+        uint8_t* const header = f->delta.header;
+        header[f->delta.headerlen++] = *buf++;
+        --size;
+
+        switch (header[0])
+        {
+        case FIOS_DELTA_LITERAL:
+            if (f->delta.headerlen != FIOS_DELTA_LITERAL_SIZE)
+                continue;
+            f->delta.literal = header[1] | (header[2] << 8) | (header[3] << 16) | ((uint32_t)header[4] << 24);
+            break;
+        case FIOS_DELTA_COPY:
+            if (f->delta.headerlen != FIOS_DELTA_COPY_SIZE)
+                continue;
+            if (! _fios_delta_copy(f,
+                                   cookie,
+                                   header[1] | (header[2] << 8) | (header[3] << 16) | ((uint32_t)header[4] << 24),
+                                   header[5] | (header[6] << 8) | (header[7] << 16) | ((uint32_t)header[8] << 24)))
+                return false;
+            break;
+        default:
+            return _fios_file_error(f, "unexpected data received (invalid delta instruction)");
+        }
+
+        f->delta.headerlen = 0;
+    }
+
+    return true;
+}
+
+// write a chunk to the output @a cookie, called from the writer thread when there is one
+static bool _fios_receive_store(fios_file_t* const f, void* const cookie, const uint8_t* const buf, const unsigned int size)
+{
+    if (f->delta.active ? ! _fios_delta_apply(f, cookie, buf, size) : ! _fios_receive_output(f, cookie, buf, size))
+        return false;
+
+    if (f->storage.sync == fios_file_sync_chunk && ! _fios_storage_sync(f, cookie, f->written, size))
+        return false;
+
+    f->written += size;
+
+    if (f->resume.journal != NULL)
+    {
+        f->resume.crc = fios_crc32(f->resume.crc, buf, size);
+
+        // the output is a regular file when resuming, flush it so the journal never gets ahead of the data
+        if (f->written - f->resume.synced >= FIOS_JOURNAL_INTERVAL && fflush(cookie) == 0)
+            _fios_journal_write(f);
+    }
+
+    return true;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall _fios_receive_writer_thread(void* const arg)
+#else
+static void* _fios_receive_writer_thread(void* const arg)
+#endif
+{
+    fios_file_t* const f = arg;
+
+    for (;;)
+    {
+        _fios_sem_wait(&f->writer.used);
+
+        const unsigned int slot = f->writer.tail++ % f->writer.slots;
+        const unsigned int size = f->writer.sizes[slot];
+
+        // empty chunk is the end marker
+        if (size == 0)
+            break;
+
+        // after a failed write chunks are still taken from the ring, so the receiving thread never waits forever
+        if (f->status != fios_file_status_error)
+            _fios_receive_store(f, f->writer.cookie, f->writer.buffer + slot * f->max_payload_size, size);
+
+        _fios_sem_post(&f->writer.free);
+    }
+
+    DEBUG_PRINT("_fios_receive_writer_thread done\n");
+    return _fios_thread_close();
+}
+
+// start a writer thread with a ring of @a slots chunks, so the serial port is only held back by slow storage when it fills up
+static bool _fios_receive_writer_start(fios_file_t* const f, const unsigned int slots)
+{
+    if (f->cookie == NULL)
+        return false;
+
+    f->writer.buffer = malloc((size_t)slots * f->max_payload_size);
+    f->writer.sizes = malloc(slots * sizeof(unsigned int));
+
+    if (f->writer.buffer == NULL || f->writer.sizes == NULL)
+        return _fios_file_error(f, "out of memory");
+
+    f->writer.slots = slots;
+    f->writer.head = f->writer.tail = 0;
+    f->writer.cookie = f->cookie;
+
+   #if defined(__APPLE__)
+    semaphore_create(f->task, &f->writer.free, SYNC_POLICY_FIFO, slots);
+    semaphore_create(f->task, &f->writer.used, SYNC_POLICY_FIFO, 0);
+   #elif defined(_WIN32)
+    f->writer.free = CreateSemaphoreA(NULL, slots, slots, NULL);
+    f->writer.used = CreateSemaphoreA(NULL, 0, slots, NULL);
+   #else
+    sem_init(&f->writer.free, 0, slots);
+    sem_init(&f->writer.used, 0, 0);
+   #endif
+
+    f->writer.running = fios_thread_create(&f->writer.thread, _fios_receive_writer_thread, f);
+
+    if (f->writer.running)
+        return true;
+
+   #if defined(__APPLE__)
+    semaphore_destroy(f->task, f->writer.free);
+    semaphore_destroy(f->task, f->writer.used);
+   #elif defined(_WIN32)
+    CloseHandle(f->writer.free);
+    CloseHandle(f->writer.used);
+   #else
+    sem_destroy(&f->writer.free);
+    sem_destroy(&f->writer.used);
+   #endif
+
+    return _fios_file_error(f, "failed to create writer thread");
+}
+
+// wait for the writer thread to write everything queued so far and stop it, returns false if any write failed
+static bool _fios_receive_writer_stop(fios_file_t* const f)
+{
+    if (! f->writer.running)
+        return f->status != fios_file_status_error;
+
+    _fios_sem_wait(&f->writer.free);
+    f->writer.sizes[f->writer.head++ % f->writer.slots] = 0;
+    _fios_sem_post(&f->writer.used);
+
+   #if defined(__APPLE__)
+    pthread_join(f->writer.thread, NULL);
+    semaphore_destroy(f->task, f->writer.free);
+    semaphore_destroy(f->task, f->writer.used);
+   #elif defined(_WIN32)
+    WaitForSingleObject(f->writer.thread, INFINITE);
+    CloseHandle(f->writer.thread);
+    CloseHandle(f->writer.free);
+    CloseHandle(f->writer.used);
+   #else
+    pthread_join(f->writer.thread, NULL);
+    sem_destroy(&f->writer.free);
+    sem_destroy(&f->writer.used);
+   #endif
+
+    f->writer.running = false;
+    return f->status != fios_file_status_error;
+}
+
+// complete the output once everything was received, checking the rebuilt file when using delta encoding
+static bool _fios_receive_finish(fios_file_t* const f)
+{
+    if (! _fios_receive_writer_stop(f))
+        return false;
+
+    if (f->storage.sync != fios_file_sync_never && ! _fios_storage_sync(f, f->cookie, 0, f->written))
+        return false;
+
+    if (f->delta.active
+        && (f->delta.headerlen != 0
+            || f->delta.literal != 0
+            || f->delta.produced != f->delta.target
+            || f->delta.crc != f->delta.target_crc))
+        return _fios_file_error(f, "rebuilt file does not match the input (invalid delta instructions)");
+
+    return true;
+}
+
+// write a received chunk, or queue it for the writer thread, waiting only if its ring is full
+static bool _fios_receive_write(fios_file_t* const f, const uint8_t* const buf, const unsigned int size)
+{
+    if (size != 0)
+        _fios_counter_add(&f->stats.chunks, 1);
+
+    if (! f->writer.running)
+    {
+        if (! _fios_receive_store(f, f->cookie, buf, size))
+            return false;
+
+        f->current += size;
+        _fios_file_notify(f);
+        return true;
+    }
+
+    if (size == 0)
+        return true;
+
+    _fios_sem_wait(&f->writer.free);
+
+    const unsigned int slot = f->writer.head++ % f->writer.slots;
+    memcpy(f->writer.buffer + slot * f->max_payload_size, buf, size);
+    f->writer.sizes[slot] = size;
+
+    _fios_sem_post(&f->writer.used);
+
+    f->current += size;
+    _fios_file_notify(f);
+    return f->status != fios_file_status_error;
+}
+
+static bool _fios_receive_write_frame(fios_file_t* const f, const fios_frame_t* const frame)
+{
+    if (! fios_serial_write_frame(f->serial, frame, NULL, f->crc))
+        return _fios_file_error(f, "serial port operation failed");
+
+    return true;
+}
+
+// reply to a probe from the sender, which has sent chunks up to @a sent
+// everything sent before the probe has arrived by now, so chunks still missing are lost and asked for again,
+// except the ones a nak was just sent for, since the sender had no chance to reply to it yet
+static bool _fios_receive_report(fios_file_t* const f, const uint32_t expected, const uint32_t sent)
+{
+    const unsigned int slots = f->window;
+
+    for (uint32_t seq = expected; seq != sent && seq - expected < slots; ++seq)
+    {
+        if (f->pending[seq % slots].received)
+            continue;
+
+        if (f->pending[seq % slots].nacked)
+        {
+            f->pending[seq % slots].nacked = false;
+            continue;
+        }
+
+        DEBUG_PRINT("chunk %u is missing, sending nak\n", seq);
+
+        const fios_frame_t nak = { .type = 'n', .seq = seq };
+
+        if (! _fios_receive_write_frame(f, &nak))
+            return false;
+    }
+
+    const fios_frame_t ack = { .type = 'a', .flags = FRAME_FLAG_PROBE, .seq = expected };
+    return _fios_receive_write_frame(f, &ack);
+}
+
+// receive chunks as binary frames, until the sender quits
+// with checksums, damaged chunks are asked for again and the ones after it are kept until it arrives
+static bool _fios_receive_frames(fios_file_t* const f, uint8_t* const buf)
+{
+    fios_serial_t* const s = f->serial;
+    const bool crc = f->crc;
+    const unsigned int slots = crc ? f->window : 1;
+    const unsigned int ackevery = f->window > 1 ? f->window / 2 : 1;
+    uint32_t expected = 0, ackseq = 0;
+    fios_frame_t frame;
+    bool valid;
+
+    if (f->current == f->size)
+        f->status = fios_file_status_completed;
+
+    while (_fios_counter_get(&f->closing) == 0 && f->status != fios_file_status_error)
+    {
+        DEBUG_PRINT("waiting for frame\n");
+
+        if (! fios_serial_read_frame(s, &frame, crc, &valid))
+            return _fios_file_error(f, "serial port operation failed");
+
+        if (! valid)
+        {
+            ++f->damaged;
+
+            // nothing about the frame is known, have the sender probe for what is missing while we look for the next one
+            const fios_frame_t nak = { .type = 'n', .flags = FRAME_FLAG_PROBE, .seq = expected };
+            DEBUG_PRINT("damaged frame header, looking for next frame\n");
+
+            if (! _fios_receive_write_frame(f, &nak))
+                return false;
+
+            if (! fios_serial_resync_frame(s, &frame, f->max_payload_size))
+                return _fios_file_error(f, "serial port operation failed");
+        }
+
+        // the header can be trusted from here on, with or without checksums
+        if (frame.length > f->max_payload_size
+            || (frame.type != 'w' && frame.length != 0)
+            || (! crc && ! ((frame.type == 'w' && frame.seq == expected) || frame.type == 'q')))
+        {
+            fprintf(stderr, "error invalid frame type %02x:'%c' seq %u length %u\n",
+                    frame.type, frame.type, frame.seq, frame.length);
+            return _fios_file_error(f, "unexpected data received (invalid frame)");
+        }
+
+        const unsigned int slot = frame.seq % slots;
+        const bool wanted = frame.type == 'w' && frame.seq - expected < slots && ! f->pending[slot].received;
+        // without checksums chunks come in order, one at a time, so they can go straight to the output
+        uint8_t* const chunk = ! crc && ! (frame.flags & FRAME_FLAG_COMPRESSED)
+                             ? _fios_storage_direct(f, buf, frame.length)
+                             : buf + slot * f->max_payload_size;
+        uint8_t* const payload = wanted && ! (frame.flags & FRAME_FLAG_COMPRESSED) ? chunk : f->zbuffer;
+
+        DEBUG_PRINT("waiting for payload of size %u | 0x%08x\n", frame.length, frame.length);
+
+        if (! fios_serial_read_frame_payload(s, &frame, payload, crc, &valid))
+            return _fios_file_error(f, "serial port operation failed");
+
+        // damaged payload, ask for the chunk again unless it is a duplicate
+        if (! valid)
+        {
+            ++f->damaged;
+
+            if (! wanted)
+            {
+                DEBUG_PRINT("ignoring damaged duplicate chunk %u\n", frame.seq);
+                continue;
+            }
+
+            const fios_frame_t nak = { .type = 'n', .seq = frame.seq };
+            f->pending[slot].nacked = true;
+
+            DEBUG_PRINT("damaged chunk %u, sending nak\n", frame.seq);
+
+            if (! _fios_receive_write_frame(f, &nak))
+                return false;
+
+            continue;
+        }
+
+        switch (frame.type)
+        {
+        case 'q':
+            // in batch sessions the next file follows on the same connection, let the sender know nothing else comes
+            if (f->batched)
+            {
+                const fios_frame_t quit = { .type = 'q', .seq = frame.seq };
+                return _fios_receive_write_frame(f, &quit);
+            }
+            return true;
+        case 'p':
+            if (! _fios_receive_report(f, expected, frame.seq))
+                return false;
+            continue;
+        case 'w':
+            break;
+        default:
+            fprintf(stderr, "error invalid frame type %02x:'%c'\n", frame.type, frame.type);
+            return _fios_file_error(f, "unexpected data received (invalid frame)");
+        }
+
+        // already received, the sender got a nak that crossed with the chunk
+        if (! wanted)
+        {
+            DEBUG_PRINT("ignoring duplicate chunk %u\n", frame.seq);
+            continue;
+        }
+
+        if (frame.flags & FRAME_FLAG_COMPRESSED)
+        {
+            size_t zsize = 0;
+
+            if (! f->compression)
+                return _fios_file_error(f, "unexpected data received (compressed frame)");
+
+            if (! fios_lz_decompress(f->zbuffer, frame.length, chunk, f->max_payload_size, &zsize))
+                return _fios_file_error(f, "unexpected data received (invalid compressed data)");
+
+            f->pending[slot].size = zsize;
+        }
+        else
+        {
+            f->pending[slot].size = frame.length;
+        }
+
+        f->pending[slot].data = chunk;
+        f->pending[slot].received = true;
+
+        // find how many chunks are now in order
+        uint32_t ready = expected;
+        int64_t bytes = 0;
+
+        while (ready - expected < slots && f->pending[ready % slots].received)
+            bytes += f->pending[ready++ % slots].size;
+
+        if (ready == expected)
+            continue;
+
+        if (ready - ackseq >= ackevery || f->current + bytes == f->size)
+        {
+            DEBUG_PRINT("payload received, sending ack for sequence %u\n", ready);
+            ackseq = ready;
+
+            const fios_frame_t ack = { .type = 'a', .seq = ready };
+
+            if (! _fios_receive_write_frame(f, &ack))
+                return false;
+        }
+
+        // write received chunks to file
+        for (; expected != ready; ++expected)
+        {
+            const unsigned int i = expected % slots;
+
+            if (! _fios_receive_write(f, f->pending[i].data, f->pending[i].size))
+                return false;
+
+            f->pending[i].received = f->pending[i].nacked = false;
+        }
+
+        if (f->current == f->size && _fios_receive_finish(f))
+            f->status = fios_file_status_completed;
+    }
+
+    return false;
+}
+
+// receive a file, on the calling thread
+static bool _fios_receive_run(fios_file_t* const f)
+{
+    fios_serial_t* const s = f->serial;
+
+    char stackbuf[MAX_PAYLOAD_SIZE_RECV];
+    char* buf = stackbuf;
+    char cmd[CMD_SIZE];
+    bool test;
+
+    DEBUG_PRINT("waiting for size\n");
+
+    if (! fios_serial_read_cmd(s, cmd))
+    {
+        if (_fios_counter_get(&f->closing) != 0)
+        {
+            fprintf(stderr, "transfer was closed while opening serial port!\n");
+            return false;
+        }
+
+        // batch sessions own the serial port, it only fails here when they are closed,
+        // and multiplexed channels have no device to reopen
+        if (f->batched || s->devpath == NULL)
+            return _fios_serial_error(f);
+
+        fprintf(stderr, "size read failed, forcing reopen of serial port now!\n");
+
+        char* const devpath = s->devpath;
+        const fios_serial_options_t options = { .baudrate = s->baudrate };
+        s->devpath = NULL;
+        fios_serial_close(s);
+        f->serial = fios_serial_open_ex(devpath, &options);
+        free(devpath);
+
+        if (f->serial == NULL)
+        {
+            f->error = "serial port reopen failed";
+            f->status = fios_file_status_error;
+            fprintf(stderr, "serial port reopen failed!\n");
+            return false;
+        }
+
+        if (! fios_serial_read_cmd(s, cmd))
+        {
+            if (_fios_counter_get(&f->closing) != 0)
+            {
+                fprintf(stderr, "transfer was closed while reopening serial port!\n");
+                return false;
+            }
+
+            f->error = "serial port reopen read failed";
+            f->status = fios_file_status_error;
+            fprintf(stderr, "serial port reopen read failed!\n");
+            return false;
+        }
+    }
+
+    // a hello command means the sender wants to use the extended protocol
+    if (cmd[0] == 'h' && cmd[1] == ' ' && ! _fios_receive_handshake(f, cmd))
+        return false;
+
+    if (cmd[0] != 's' || cmd[1] != ' ')
+    {
+        f->error = "unexpected data received (invalid first command)";
+        f->status = fios_file_status_error;
+        fprintf(stderr, "error invalid command type %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
+        return false;
+    }
+
+    // size comes as 2nd arg, already decoded with its upper bits if the extended protocol is used
+    const int64_t size = f->extended ? f->size : (int64_t)_fios_cmd_value(cmd);
+
+    if (size < 0)
+    {
+        f->error = "unexpected data received (invalid size)";
+        f->status = fios_file_status_error;
+        fprintf(stderr, "invalid file size %lld\n", (long long)size);
+        return false;
+    }
+
+    DEBUG_PRINT("file size %lld\n", (long long)size);
+
+    f->size = size;
+
+    if (f->resume.path != NULL && ! _fios_receive_resume_start(f))
+        return false;
+
+    // memory outputs are sized up front, so that the data is not moved around while receiving
+    if (f->memory.active && ! _fios_memory_reserve(f, size))
+        return false;
+
+    if (! _fios_storage_start(f, size))
+        return false;
+
+    // larger chunks than the default were negotiated, or a window of them is kept for checksums
+    const unsigned int slots = f->crc ? f->window : 1;
+
+    if (slots * f->max_payload_size > sizeof(stackbuf))
+    {
+        buf = f->buffer = malloc(slots * f->max_payload_size);
+
+        if (buf == NULL)
+        {
+            _fios_file_error(f, "out of memory");
+            return false;
+        }
+    }
+
+    if ((f->compression || f->crc) && (f->zbuffer = malloc(f->max_payload_size)) == NULL)
+    {
+        _fios_file_error(f, "out of memory");
+        return false;
+    }
+
+    if (f->options.write_queue != 0 && ! _fios_receive_writer_start(f, f->options.write_queue))
+        return false;
+
+    if (f->binary)
+    {
+        test = _fios_receive_frames(f, (uint8_t*)buf);
+
+        DEBUG_PRINT("_fios_receive_run done, %u damaged frames\n", f->damaged);
+        return test;
+    }
+
+    // in extended mode chunks are acknowledged with their cumulative sequence number, every half window
+    const unsigned int ackevery = f->window > 1 ? f->window / 2 : 1;
+    uint32_t seq = 0, ackseq = 0;
+
+    bool quitReceived = false;
+    while (_fios_counter_get(&f->closing) == 0 && f->status != fios_file_status_error && f->current != size)
+    {
+        DEBUG_PRINT("waiting for command\n");
+
+        test = fios_serial_read_cmd(s, cmd);
+        assert_return(test, _fios_serial_error(f));
+
+        if (cmd[0] == 'q' && cmd[1] == 0)
+        {
+            quitReceived = true;
+            break;
+        }
+
+        if (cmd[0] != 'w' || cmd[1] != ' ')
+        {
+            f->error = "unexpected data received (invalid command)";
+            f->status = fios_file_status_error;
+            fprintf(stderr, "error invalid command type %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
+            break;
+        }
+
+        cmd[CMD_SIZE - 1] = 0;
+
+        // size comes as 2nd arg
+        const long int size = strtol(cmd + 2, NULL, 16);
+
+        if (size < 0 || size > f->max_payload_size)
+        {
+            f->error = "unexpected data received (invalid payload size)";
+            f->status = fios_file_status_error;
+            fprintf(stderr, "error invalid payload size %ld\n", size);
+            break;
+        }
+
+        DEBUG_PRINT("waiting for payload of size %ld | 0x%08lx\n", size, size);
+        uint8_t* const payload = _fios_storage_direct(f, (uint8_t*)buf, size);
+        test = fios_serial_read_payload(s, payload, size);
+        assert_return(test, _fios_serial_error(f));
+
+        if (f->extended)
+        {
+            ++seq;
+
+            if (seq - ackseq >= ackevery || f->current + size == f->size)
+            {
+                DEBUG_PRINT("payload received, sending ack for sequence %u\n", seq);
+                ackseq = seq;
+
+                snprintf(cmd, CMD_SIZE, "a 0x%08x", seq);
+                test = fios_serial_write_cmd(s, cmd);
+                assert_return(test, _fios_serial_error(f));
+            }
+        }
+        else
+        {
+            DEBUG_PRINT("payload received, sending ok back\n");
+            test = fios_serial_write_cmd(s, "ok");
+            assert_return(test, _fios_serial_error(f));
+        }
+
+        // write received buffer to file
+        if (! _fios_receive_write(f, payload, size))
+            break;
+    }
+
+    if (_fios_counter_get(&f->closing) == 0 && f->status != fios_file_status_error && f->current == size && _fios_receive_finish(f))
+    {
+        f->status = fios_file_status_completed;
+
+        if (! quitReceived)
+        {
+            test = fios_serial_read_cmd(s, cmd);
+            assert_return(test, _fios_serial_error(f));
+
+            if (cmd[0] != 'q' || cmd[1] != 0)
+            {
+                f->error = "unexpected data received (invalid quit command)";
+                f->status = fios_file_status_error;
+                fprintf(stderr, "error invalid quit command %02x:'%c' %02x:'%c'\n", cmd[0], cmd[0], cmd[1], cmd[1]);
+            }
+        }
+    }
+
+    DEBUG_PRINT("_fios_receive_run done\n");
+    return f->status == fios_file_status_completed;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall _fios_receive_thread(void* const arg)
+#else
+static void* _fios_receive_thread(void* const arg)
+#endif
+{
+    fios_file_t* const f = arg;
+
+   #if defined(__APPLE__)
+    semaphore_signal(f->sem);
+   #elif defined(_WIN32)
+    ReleaseSemaphore(f->sem, 1, NULL);
+   #else
+    sem_post(&f->sem);
+   #endif
+
+    _fios_receive_run(f);
+    _fios_file_finish(f);
+    return _fios_thread_close();
+}
+
+// the same as the thread above, for transfers run as tasks with the event_loop or engine option
+static void _fios_receive_task(void* const arg)
+{
+    fios_file_t* const f = arg;
+
+    _fios_receive_run(f);
+    _fios_file_finish(f);
+}
+
+// send hello, options and size, then receive the options accepted by the receiver
+static bool _fios_send_handshake(fios_file_t* const f, char cmd[CMD_SIZE])
+{
+    fios_serial_t* const s = f->serial;
+
+    snprintf(cmd, CMD_SIZE, "h 0x%08x", FIOS_PROTOCOL_VERSION);
+
+    if (! fios_serial_write_cmd(s, cmd))
+        return _fios_file_error(f, "serial port operation failed");
+
+    snprintf(cmd, CMD_SIZE, "W 0x%08x", f->options.window < MAX_WINDOW_SIZE ? f->options.window : MAX_WINDOW_SIZE);
+
+    if (! fios_serial_write_cmd(s, cmd))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // compression and checksums need binary framing for their flags and trailer
+    if ((f->options.binary_framing || f->options.compression || f->options.crc)
+        && ! fios_serial_write_cmd(s, "F 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (f->options.compression && ! fios_serial_write_cmd(s, "Z 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (f->options.crc && ! fios_serial_write_cmd(s, "C 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (f->options.adaptive_payload)
+    {
+        snprintf(cmd, CMD_SIZE, "P 0x%08x", f->max_payload_size);
+
+        if (! fios_serial_write_cmd(s, cmd))
+            return _fios_file_error(f, "serial port operation failed");
+
+        // receivers that do not reply to this keep the default size
+        f->max_payload_size = MAX_PAYLOAD_SIZE_SEND;
+    }
+
+    if (f->options.resume && ! fios_serial_write_cmd(s, "R 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // instructions are built from the whole input, which needs to be seekable
+    if (f->options.delta && f->size != 0 && (f->map.data != NULL || f->seek != NULL)
+        && ! fios_serial_write_cmd(s, "D 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // always ask for large sizes, so that resume offsets can go past 4GiB too
+    if (! fios_serial_write_cmd(s, "L 0x00000001"))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // receivers without support for large sizes only see the lower 32 bits, checked against their reply below
+    if (! _fios_write_cmd64(s, 's', f->size))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (! fios_serial_read_cmd(s, cmd))
+        return _fios_file_error(f, "serial port operation failed");
+
+    if (cmd[0] != 'h' || cmd[1] != ' ')
+        return _fios_file_error(f, "unexpected data received (invalid hello reply)");
+
+    DEBUG_PRINT("hello reply received, protocol version %lu\n", _fios_cmd_value(cmd));
+
+    f->extended = true;
+    f->window = 1;
+
+    bool large = false;
+    uint64_t value;
+
+    for (;;)
+    {
+        if (! _fios_read_cmd64(s, cmd, &value))
+            return _fios_file_error(f, "serial port operation failed");
+
+        if (cmd[0] == 'o' && cmd[1] == 'k')
+            break;
+
+        if (cmd[1] != ' ')
+            return _fios_file_error(f, "unexpected data received (invalid option reply)");
+
+        switch (cmd[0])
+        {
+        case 'W':
+            if (value == 0 || value > MAX_WINDOW_SIZE)
+                return _fios_file_error(f, "unexpected data received (invalid window size)");
+            f->window = value;
+            break;
+        case 'F':
+            f->binary = value != 0;
+            break;
+        case 'Z':
+            f->compression = value == 1;
+            break;
+        case 'C':
+            f->crc = value == 1;
+            break;
+        case 'P':
+            if (value < MIN_PAYLOAD_SIZE || value > MAX_ADAPTIVE_PAYLOAD_SIZE)
+                return _fios_file_error(f, "unexpected data received (invalid payload size)");
+            f->max_payload_size = value;
+            break;
+        case 'R':
+            f->resume.negotiated = true;
+            f->resume.offset = value;
+            break;
+        case 'H':
+            f->resume.crc = value;
+            break;
+        case 'L':
+            large = value == 1;
+            break;
+        case 'D':
+            if (value < FIOS_DELTA_MIN_BLOCK_SIZE || value > FIOS_DELTA_MAX_BLOCK_SIZE)
+                return _fios_file_error(f, "unexpected data received (invalid delta block size)");
+            f->delta.block = value;
+            break;
+        default:
+            DEBUG_PRINT("ignoring unknown option reply '%c'\n", cmd[0]);
+            break;
+        }
+    }
+
+    f->compression = f->compression && f->binary;
+    f->crc = f->crc && f->binary;
+
+    if (! large && f->size > MAX_FILE_SIZE)
+    {
+        fios_serial_write_cmd(s, "q");
+        return _fios_file_error(f, "receiver does not support files larger than 2GiB");
+    }
+
+    DEBUG_PRINT("using window of %u chunks, binary framing %d, compression %d, checksums %d\n",
+                f->window, f->binary, f->compression, f->crc);
+    return true;
+}
+
+// make sure the input file still has data up to @a end before touching the mapping there
+// reading a mapped page past the end of a truncated file raises SIGBUS, so such a file fails the transfer instead
+// this only narrows down the window in which another process can truncate it, files being sent must not be truncated
+static bool _fios_send_map_check(fios_file_t* const f, const uint64_t end)
+{
+   #ifndef _WIN32
+    struct stat st;
+
+    if (fstat(f->map.fd, &st) == 0 && (uint64_t)st.st_size < end)
+        return _fios_file_error(f, "input file was truncated while being sent");
+   #endif
+
+    return true;
+}
+
+// skip the data the receiver already has if it matches the start of the input, and tell the receiver where we start
+static bool _fios_send_resume(fios_file_t* const f, char* const buf)
+{
+    int64_t offset = f->resume.offset <= f->size && f->seek != NULL ? f->resume.offset : 0;
+
+    if (offset != 0 && f->map.data != NULL)
+    {
+        if (! _fios_send_map_check(f, offset))
+            return false;
+
+        if (fios_crc32(0, f->map.data, offset) == f->resume.crc)
+            f->map.offset = offset;
+        else
+            offset = 0;
+    }
+    else if (offset != 0)
+    {
+        const uint64_t start = fios_serial_time_us();
+        uint32_t crc = 0;
+        int64_t r = 0;
+
+        while (r < offset)
+        {
+            const int64_t left = offset - r;
+            const unsigned int r2 = f->funcs.read(buf, 1, left < f->max_payload_size ? left : f->max_payload_size, f->cookie);
+
+            if (r2 == 0)
+                break;
+
+            crc = fios_crc32(crc, buf, r2);
+            r += r2;
+        }
+
+        _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
+
+        if (r != offset || crc != f->resume.crc)
+        {
+            DEBUG_PRINT("receiver data does not match, starting from the beginning\n");
+
+            if (f->seek(f->cookie, 0, SEEK_SET) != 0)
+                return _fios_file_error(f, "failed to seek input file");
+
+            offset = 0;
+        }
+    }
+
+    DEBUG_PRINT("resuming from offset %lld\n", (long long)offset);
+
+    if (! _fios_write_cmd64(f->serial, 'R', offset))
+        return _fios_file_error(f, "serial port operation failed");
+
+    f->current = offset;
+    _fios_file_notify(f);
+    return true;
+}
+
+// input of the delta encoder, from the mapping or the stream
+// its checksum is taken while the instructions are counted, before the encoding that is actually sent
+static size_t _fios_send_delta_input(void* const cookie, uint8_t* const buffer, const size_t size)
+{
+    fios_file_t* const f = cookie;
+    size_t r;
+
+    if (f->map.data != NULL)
+    {
+        const size_t left = f->map.size - f->delta.input;
+        r = left < size ? left : size;
+
+        if (! _fios_send_map_check(f, f->delta.input + r))
+            return 0;
+
+        memcpy(buffer, f->map.data + f->delta.input, r);
+    }
+    else
+    {
+        const uint64_t start = fios_serial_time_us();
+        r = f->funcs.read(buffer, 1, size, f->cookie);
+        _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
+    }
+
+    if (! f->delta.active)
+        f->delta.target_crc = fios_crc32(f->delta.target_crc, buffer, r);
+
+    f->delta.input += r;
+    return r;
+}
+
+// read the signatures of the receiver copy, and reply with instructions to rebuild the input from it
+// plain data is sent instead when that is not smaller, or the signatures were damaged on the way
+// the input is encoded twice, first to learn the size of the instructions and then while sending them,
+// so that only a window of it is in memory at a time
+static bool _fios_send_delta(fios_file_t* const f)
+{
+    fios_serial_t* const s = f->serial;
+    const unsigned int block = f->delta.block;
+    fios_delta_encoder_t* encoder = NULL;
+    uint8_t* signatures = NULL;
+    uint64_t encsize = 0;
+    char cmd[CMD_SIZE];
+
+    if (! fios_serial_read_cmd(s, cmd))
+        return _fios_file_error(f, "serial port operation failed");
+
+    const unsigned long count = _fios_cmd_value(cmd);
+
+    if (cmd[0] != 'b' || cmd[1] != ' ' || count > FIOS_DELTA_MAX_BLOCKS)
+        return _fios_file_error(f, "unexpected data received (invalid delta signatures)");
+
+    const size_t size = count * FIOS_DELTA_SIGNATURE_SIZE;
+
+    if ((signatures = malloc(size)) == NULL)
+        return _fios_file_error(f, "out of memory");
+
+    if (! fios_serial_read_payload(s, signatures, size) || ! fios_serial_read_cmd(s, cmd))
+    {
+        free(signatures);
+        return _fios_file_error(f, "serial port operation failed");
+    }
+
+    if (cmd[0] == 'c' && cmd[1] == ' ' && _fios_cmd_value(cmd) == fios_crc32(0, signatures, size))
+    {
+        if ((encoder = fios_delta_encoder_open(signatures, count, block, _fios_send_delta_input, f)) != NULL)
+        {
+            size_t r;
+
+            do {
+                r = fios_delta_encoder_read(encoder, NULL, MAX_ADAPTIVE_PAYLOAD_SIZE);
+                encsize += r;
+            } while (r == MAX_ADAPTIVE_PAYLOAD_SIZE);
+
+            fios_delta_encoder_close(encoder);
+            encoder = NULL;
+
+            // the input file was truncated while mapped
+            if (f->status == fios_file_status_error)
+            {
+                free(signatures);
+                return false;
+            }
+
+            // either the instructions or the plain data are read from the start again
+            if (f->map.data == NULL && f->seek(f->cookie, 0, SEEK_SET) != 0)
+            {
+                free(signatures);
+                return _fios_file_error(f, "failed to seek input file");
+            }
+
+            // the input must not change until the instructions are encoded again
+            if (f->delta.input == (uint64_t)f->size && encsize < (uint64_t)f->size)
+            {
+                f->delta.input = 0;
+                encoder = fios_delta_encoder_open(signatures, count, block, _fios_send_delta_input, f);
+            }
+        }
+    }
+    else
+    {
+        DEBUG_PRINT("damaged delta signatures, sending plain data\n");
+    }
+
+    if (encoder == NULL)
+    {
+        DEBUG_PRINT("delta encoding not used\n");
+        free(signatures);
+
+        if (! fios_serial_write_cmd(s, "D 0x00000000"))
+            return _fios_file_error(f, "serial port operation failed");
+
+        return true;
+    }
+
+    DEBUG_PRINT("sending %llu bytes of delta instructions for %lld bytes\n", (unsigned long long)encsize, (long long)f->size);
+
+    // the encoder uses the signatures until the end of the transfer
+    f->delta.encoder = encoder;
+    f->delta.signatures = signatures;
+
+    snprintf(cmd, CMD_SIZE, "c 0x%08x", f->delta.target_crc);
+
+    if (! _fios_write_cmd64(s, 'd', encsize) || ! fios_serial_write_cmd(s, cmd))
+        return _fios_file_error(f, "serial port operation failed");
+
+    // progress is reported for the instructions from here on
+    f->delta.active = true;
+    f->size = encsize;
+    return true;
+}
+
+// get the next chunk of input, either read into @a buf or pointing directly into the input file mapping
+// returns 0 once the input is over, or if it was truncated while mapped, in which case the error is set
+static unsigned int _fios_send_read(fios_file_t* const f, uint8_t* const buf, const uint8_t** const chunk)
+{
+    if (f->delta.active)
+    {
+        const uint64_t left = f->size - f->delta.offset;
+        const unsigned int size = left < f->payload_size ? left : f->payload_size;
+        const unsigned int r = fios_delta_encoder_read(f->delta.encoder, buf, size);
+
+        // fewer instructions than counted means the input changed in the meantime, or was truncated while mapped
+        if (r != size)
+        {
+            if (f->status != fios_file_status_error)
+                _fios_file_error(f, "input file changed while being sent");
+            return 0;
+        }
+
+        *chunk = buf;
+        f->delta.offset += r;
+        return r;
+    }
+
+    if (f->map.data != NULL)
+    {
+        const size_t left = f->map.size - f->map.offset;
+        const unsigned int r = left < f->payload_size ? left : f->payload_size;
+
+        if (r != 0 && ! _fios_send_map_check(f, f->map.offset + r))
+            return 0;
+
+        *chunk = f->map.data + f->map.offset;
+        f->map.offset += r;
+        return r;
+    }
+
+    const uint64_t start = fios_serial_time_us();
+    const unsigned int r = f->funcs.read(buf, 1, f->payload_size, f->cookie);
+    _fios_counter_add(&f->stats.stream_us, fios_serial_time_us() - start);
+
+    *chunk = buf;
+    return r;
+}
+
+static unsigned int _fios_payload_level_size(const unsigned int level)
+{
+    return (unsigned int)MIN_PAYLOAD_SIZE << level;
+}
+
+// adjust chunk size based on measured acknowledgement latency and throughput, called for every acknowledgement
+static void _fios_send_adapt_payload(fios_file_t* const f, const uint64_t now, const uint64_t latency, const uint64_t bytes)
+{
+    f->adaptive.bytes += bytes;
+
+    // measure for a few chunks before deciding anything, unless the latency is already too high
+    if (++f->adaptive.chunks < (f->window > 4 ? f->window : 4) && latency < FIOS_TARGET_CHUNK_LATENCY_US)
+        return;
+
+    const unsigned int level = f->adaptive.level;
+    const double throughput = now > f->adaptive.start ? (double)f->adaptive.bytes / (now - f->adaptive.start) : 0.0;
+    double* const throughputs = f->adaptive.throughput;
+
+    throughputs[level] = throughputs[level] != 0.0 ? (throughputs[level] * 3 + throughput) / 4 : throughput;
+
+    if (level != 0 && latency >= FIOS_TARGET_CHUNK_LATENCY_US)
+    {
+        // slow or congested link, smaller chunks keep things responsive
+        f->adaptive.level = level - 1;
+    }
+    else if (level < f->adaptive.maxlevel
+             && (throughputs[level + 1] == 0.0 || throughputs[level + 1] > throughputs[level]))
+    {
+        // bigger chunks were better or not tried yet
+        f->adaptive.level = level + 1;
+    }
+    else if (level != 0 && throughputs[level - 1] > throughputs[level])
+    {
+        f->adaptive.level = level - 1;
+    }
+    else if (++f->adaptive.periods % 32 == 0)
+    {
+        // link conditions can change, forget about the neighbours so they get tried again
+        if (level < f->adaptive.maxlevel)
+            throughputs[level + 1] = 0.0;
+        if (level != 0)
+            throughputs[level - 1] = 0.0;
+    }
+
+    if (f->adaptive.level != level)
+    {
+        const unsigned int size = _fios_payload_level_size(f->adaptive.level);
+        f->payload_size = size < f->max_payload_size ? size : f->max_payload_size;
+        DEBUG_PRINT("adaptive payload size %u -> %u, %f bytes/us, %lu us latency\n",
+                    _fios_payload_level_size(level), f->payload_size, throughput, (unsigned long)latency);
+    }
+
+    f->adaptive.start = now;
+    f->adaptive.bytes = 0;
+    f->adaptive.chunks = 0;
+}
+
+static void _fios_send_adapt_init(fios_file_t* const f)
+{
+    unsigned int level = 0;
+
+    while (level + 1 < FIOS_PAYLOAD_LEVELS && _fios_payload_level_size(level) < f->max_payload_size)
+        ++level;
+
+    f->adaptive.maxlevel = level;
+
+    // start with the regular payload size
+    while (level != 0 && _fios_payload_level_size(level) > MAX_PAYLOAD_SIZE_SEND)
+        --level;
+
+    f->adaptive.level = level;
+    f->adaptive.start = fios_serial_time_us();
+
+    const unsigned int size = _fios_payload_level_size(level);
+    f->payload_size = size < f->max_payload_size ? size : f->max_payload_size;
+}
+
+// ask the receiver for the chunks it is missing, followed by an acknowledgement
+static bool _fios_send_probe(fios_file_t* const f)
+{
+    const fios_frame_t frame = { .type = 'p', .seq = f->sent };
+    DEBUG_PRINT("sending probe for %u chunks\n", f->sent);
+
+    if (! fios_serial_write_frame(f->serial, &frame, NULL, f->crc))
+        return _fios_file_error(f, "serial port operation failed");
+
+    ++f->probes;
+    return true;
+}
+
+// send a chunk again after the receiver reported it as damaged or missing
+static bool _fios_send_retransmit(fios_file_t* const f, const uint32_t seq)
+{
+    // already acknowledged, nak was sent before a later chunk filled the gap
+    if (seq - f->acked >= f->sent - f->acked)
+        return true;
+
+    const fios_frame_t frame = {
+        .type = 'w',
+        .flags = f->inflight[seq % MAX_WINDOW_SIZE].flags,
+        .seq = seq,
+        .length = f->inflight[seq % MAX_WINDOW_SIZE].length,
+    };
+    DEBUG_PRINT("sending chunk %u again\n", seq);
+    ++f->retransmits;
+
+    if (! fios_serial_write_frame(f->serial, &frame, f->inflight[seq % MAX_WINDOW_SIZE].payload, f->crc))
+        return _fios_file_error(f, "serial port operation failed");
+
+    return true;
+}
+
+// wait for the receiver to acknowledge at least 1 chunk
+// with checksums this can also return after handling a nak, without anything being acknowledged
+static bool _fios_send_wait_ack(fios_file_t* const f)
+{
+    char cmd[CMD_SIZE];
+    uint32_t seq;
+
+    if (f->binary)
+    {
+        fios_frame_t frame;
+        bool valid;
+
+        if (! fios_serial_read_frame(f->serial, &frame, f->crc, &valid))
+            return _fios_file_error(f, "serial port operation failed");
+
+        // the damaged frame might have been a probe reply, so start over with a new probe,
+        // its reply is then used to find the next frame
+        if (! valid)
+        {
+            ++f->damaged;
+            f->probes = 0;
+
+            if (! _fios_send_probe(f))
+                return false;
+
+            if (! fios_serial_resync_frame(f->serial, &frame, 0))
+                return _fios_file_error(f, "serial port operation failed");
+        }
+
+        // nothing sent to us has a payload
+        if (frame.length != 0)
+        {
+            fprintf(stderr, "error invalid acknowledgement type %02x:'%c' seq %u length %u\n",
+                    frame.type, frame.type, frame.seq, frame.length);
+            return _fios_file_error(f, "unexpected data received (invalid acknowledgement)");
+        }
+
+        // the receiver could not identify a damaged frame, which might have been a probe
+        if (f->crc && frame.type == 'n' && (frame.flags & FRAME_FLAG_PROBE))
+        {
+            f->probes = 0;
+            return _fios_send_probe(f);
+        }
+
+        if (f->crc && frame.type == 'n')
+            return _fios_send_retransmit(f, frame.seq);
+
+        if (frame.type != 'a')
+            return _fios_file_error(f, "unexpected data received (invalid acknowledgement)");
+
+        seq = frame.seq;
+
+        if (frame.flags & FRAME_FLAG_PROBE)
+        {
+            if (f->probes != 0)
+                --f->probes;
+
+            // nothing new was received since the last acknowledgement
+            if (seq == f->acked)
+                return true;
+        }
+    }
+    else
+    {
+        if (! fios_serial_read_cmd(f->serial, cmd))
+            return _fios_file_error(f, "serial port operation failed");
+
+        // legacy protocol acknowledges a single chunk with "ok"
+        if (! f->extended)
+        {
+            _fios_stats_latency(f, fios_serial_time_us() - f->inflight[f->acked % MAX_WINDOW_SIZE].time);
+            f->current += f->inflight[f->acked++ % MAX_WINDOW_SIZE].size;
+            _fios_file_notify(f);
+            return true;
+        }
+
+        if (cmd[0] != 'a' || cmd[1] != ' ')
+            return _fios_file_error(f, "unexpected data received (invalid acknowledgement)");
+
+        seq = _fios_cmd_value(cmd);
+    }
+
+    if (seq - f->acked == 0 || seq - f->acked > f->sent - f->acked)
+        return _fios_file_error(f, "unexpected data received (invalid acknowledgement sequence)");
+
+    const uint64_t now = fios_serial_time_us();
+    const uint64_t sendtime = f->inflight[(seq - 1) % MAX_WINDOW_SIZE].time;
+    uint64_t bytes = 0;
+
+    while (f->acked != seq)
+    {
+        _fios_stats_latency(f, now - f->inflight[f->acked % MAX_WINDOW_SIZE].time);
+        bytes += f->inflight[f->acked++ % MAX_WINDOW_SIZE].size;
+    }
+
+    f->current += bytes;
+    _fios_file_notify(f);
+
+    if (f->options.adaptive_payload)
+        _fios_send_adapt_payload(f, now, now - sendtime, bytes);
+
+    return true;
+}
+
+// wait until at most @a inflight chunks are not yet acknowledged
+static bool _fios_send_wait(fios_file_t* const f, const uint32_t inflight)
+{
+    while (f->sent - f->acked > inflight)
+    {
+        // with checksums, keep a probe going while waiting, damaged chunks might go unnoticed otherwise
+        if (f->crc && f->probes == 0 && ! _fios_send_probe(f))
+            return false;
+
+        if (! _fios_send_wait_ack(f))
+            return false;
+    }
+
+    return true;
+}
+
+// discard replies to probes still in flight until the receiver answers the quit frame,
+// so that they are not mistaken for the handshake of the next file in a batch session
+static bool _fios_send_drain(fios_file_t* const f)
+{
+    fios_frame_t frame;
+    bool valid;
+
+    for (;;)
+    {
+        if (! fios_serial_read_frame(f->serial, &frame, f->crc, &valid))
+            return _fios_file_error(f, "serial port operation failed");
+
+        if (! valid && ! fios_serial_resync_frame(f->serial, &frame, 0))
+            return _fios_file_error(f, "serial port operation failed");
+
+        if (frame.length != 0)
+            return _fios_file_error(f, "unexpected data received (invalid acknowledgement)");
+
+        if (frame.type == 'q')
+            return true;
+
+        // the receiver could not identify a damaged frame, which might have been the quit one
+        if (frame.type == 'n' && (frame.flags & FRAME_FLAG_PROBE))
+        {
+            const fios_frame_t quit = { .type = 'q', .seq = f->sent };
+
+            if (! fios_serial_write_frame(f->serial, &quit, NULL, f->crc))
+                return _fios_file_error(f, "serial port operation failed");
+        }
+    }
+}
+
+// send a file, on the calling thread
+static bool _fios_send_run(fios_file_t* const f)
+{
+    fios_serial_t* const s = f->serial;
+
+    char stackbuf[MAX_PAYLOAD_SIZE_SEND];
+    char* buf = stackbuf;
+    char cmd[CMD_SIZE];
+    bool test;
+
+    DEBUG_PRINT("writing size for %lld | 0x%llx bytes\n", (long long)f->size, (unsigned long long)f->size);
+
+    // sizes past MAX_FILE_SIZE are only possible with the extended protocol
+    if (f->options.window > 1
+        || f->options.binary_framing
+        || f->options.adaptive_payload
+        || f->options.compression
+        || f->options.crc
+        || f->options.resume
+        || f->options.delta
+        || f->size > MAX_FILE_SIZE)
+    {
+        if (! _fios_send_handshake(f, cmd))
+            return false;
+    }
+    else
+    {
+        // encode size command as first byte, followed by size
+        snprintf(cmd, CMD_SIZE, "s 0x%08x", (unsigned int)f->size);
+
+        test = fios_serial_write_cmd(s, cmd);
+        assert_return(test, _fios_serial_error(f));
+
+        f->window = 1;
+        f->max_payload_size = MAX_PAYLOAD_SIZE_SEND;
+    }
+
+    // larger chunks than the default were negotiated, or a window of them is kept for checksums
+    // chunks from a file mapping stay valid until the transfer is done, so these are only needed without one,
+    // or for delta instructions which are encoded as they are sent
+    const unsigned int slots = f->crc ? f->window : 1;
+
+    if ((f->map.data == NULL || f->delta.block != 0) && slots * f->max_payload_size > sizeof(stackbuf))
+    {
+        buf = f->buffer = malloc(slots * f->max_payload_size);
+
+        if (buf == NULL)
+        {
+            _fios_file_error(f, "out of memory");
+            return false;
+        }
+    }
+
+    if (f->compression && (f->zbuffer = malloc(slots * f->max_payload_size)) == NULL)
+    {
+        _fios_file_error(f, "out of memory");
+        return false;
+    }
+
+    if (f->resume.negotiated && ! _fios_send_resume(f, buf))
+        return false;
+
+    if (f->delta.block != 0 && ! _fios_send_delta(f))
+        return false;
+
+    if (f->options.adaptive_payload)
+        _fios_send_adapt_init(f);
+    else
+        f->payload_size = f->max_payload_size;
+
+    while (_fios_counter_get(&f->closing) == 0)
+    {
+        // wait for acknowledgements while the window is full, this is every chunk in lock-step mode
+        if (! _fios_send_wait(f, f->window - 1))
+            return false;
+
+        const unsigned int slot = f->sent % slots;
+        const uint8_t* chunk;
+        const unsigned int r = _fios_send_read(f, (uint8_t*)buf + slot * f->max_payload_size, &chunk);
+
+        DEBUG_PRINT("main file read return %d | 0x%x bytes\n", r, r);
+
+        if (r == 0)
+        {
+            if (f->status == fios_file_status_error)
+                return false;
+            break;
+        }
+
+        if (f->binary)
+        {
+            DEBUG_PRINT("writing frame for %d | 0x%x bytes\n", r, r);
+
+            fios_frame_t frame = { .type = 'w', .seq = f->sent, .length = r };
+            const void* payload = chunk;
+
+            // chunks that do not shrink are sent as-is
+            if (f->compression)
+            {
+                uint8_t* const zchunk = f->zbuffer + slot * f->max_payload_size;
+                const size_t zsize = fios_lz_compress(chunk, r, zchunk, r - 1);
+
+                if (zsize != 0)
+                {
+                    DEBUG_PRINT("compressed %d bytes into %u\n", r, (unsigned)zsize);
+                    frame.flags = FRAME_FLAG_COMPRESSED;
+                    frame.length = zsize;
+                    payload = zchunk;
+                }
+            }
+
+            // header and payload go out together
+            test = fios_serial_write_frame(s, &frame, payload, f->crc);
+            assert_return(test, _fios_serial_error(f));
+
+            f->inflight[f->sent % MAX_WINDOW_SIZE].payload = payload;
+            f->inflight[f->sent % MAX_WINDOW_SIZE].length = frame.length;
+            f->inflight[f->sent % MAX_WINDOW_SIZE].flags = frame.flags;
+        }
+        else
+        {
+            DEBUG_PRINT("writing command for %d | 0x%x bytes\n", r, r);
+
+            // encode write command as first byte, followed by expected size, and then the payload
+            snprintf(cmd, CMD_SIZE, "w 0x%08x", r);
+
+            test = fios_serial_write_cmd(s, cmd);
+            assert_return(test, _fios_serial_error(f));
+
+            DEBUG_PRINT("writing payload for %d | 0x%x bytes\n", r, r);
+            test = fios_serial_write_payload(s, chunk, r);
+            assert_return(test, _fios_serial_error(f));
+        }
+
+        f->inflight[f->sent % MAX_WINDOW_SIZE].size = r;
+        f->inflight[f->sent % MAX_WINDOW_SIZE].time = fios_serial_time_us();
+        ++f->sent;
+        _fios_counter_add(&f->stats.chunks, 1);
+    }
+
+    DEBUG_PRINT("waiting for remaining %u acknowledgements\n", f->sent - f->acked);
+
+    if (_fios_counter_get(&f->closing) == 0 && ! _fios_send_wait(f, 0))
+        return false;
+
+    f->status = fios_file_status_completed;
+
+    DEBUG_PRINT("writing command for close\n");
+
+    if (f->binary)
+    {
+        const fios_frame_t frame = { .type = 'q', .seq = f->sent };
+        test = fios_serial_write_frame(s, &frame, NULL, f->crc);
+        assert_return(test, _fios_serial_error(f));
+
+        if (f->batched && ! _fios_send_drain(f))
+            return false;
+    }
+    else
+    {
+        test = fios_serial_write_cmd(s, "q");
+        assert_return(test, _fios_serial_error(f));
+    }
+
+    DEBUG_PRINT("_fios_send_run done, %u chunks sent again\n", f->retransmits);
+    return true;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall _fios_send_thread(void* const arg)
+#else
+static void* _fios_send_thread(void* const arg)
+#endif
+{
+    fios_file_t* const f = arg;
+
+   #if defined(__APPLE__)
+    semaphore_signal(f->sem);
+   #elif defined(_WIN32)
+    ReleaseSemaphore(f->sem, 1, NULL);
+   #else
+    sem_post(&f->sem);
+   #endif
+
+    _fios_send_run(f);
+    _fios_file_finish(f);
+    return _fios_thread_close();
+}
+
+// the same as the thread above, for transfers run as tasks with the event_loop or engine option
+static void _fios_send_task(void* const arg)
+{
+    fios_file_t* const f = arg;
+
+    _fios_send_run(f);
+    _fios_file_finish(f);
+}
+
+static bool _fios_thread_sem_wait(fios_file_t* const f)
+{
+    void* const cookie = f->cookie;
+
+   #if defined(__APPLE__)
+    struct mach_timespec timeout = { 0 };
+    timeout.tv_sec = 1;
+
+    if (semaphore_timedwait(f->sem, timeout) == KERN_SUCCESS)
+        return true;
+   #elif defined(_WIN32)
+    if (WaitForSingleObject(f->sem, 1000) == WAIT_OBJECT_0)
+        return true;
+   #else
+    struct timespec timeout;
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    ++timeout.tv_sec;
+
+    if (sem_timedwait(&f->sem, &timeout) == 0)
+        return true;
+   #endif
+
+    f->error = "serial port thread failed to start";
+    f->status = fios_file_status_error;
+    f->cookie = NULL;
+    f->funcs.close(cookie);
+    return false;
+}
+
+// set up @a f for receiving into a stream, without starting a thread for it
+static void _fios_file_receive_stream_init(fios_file_t* const f,
+                                           fios_serial_t* const s,
+                                           const libfios_stream_functions funcs,
+                                           void* const cookie,
+                                           const fios_file_options_t* const options)
+{
+    f->serial = s;
+    f->funcs = funcs;
+    f->cookie = cookie;
+    f->error = NULL;
+    f->current = f->size = 0;
+    f->status = fios_file_status_in_progress;
+    f->map.fd = -1;
+    f->storage.fd = -1;
+   #ifndef _WIN32
+    f->notifyfd[0] = f->notifyfd[1] = -1;
+   #endif
+
+    if (options != NULL)
+        f->options = *options;
+
+    f->max_payload_size = MAX_PAYLOAD_SIZE_RECV;
+    _fios_stats_start(f);
+}
+
+// set up @a f for receiving into @a outpath, without starting a thread for it
+static bool _fios_file_receive_init(fios_file_t* const f,
+                                    fios_serial_t* const s,
+                                    const char* const outpath,
+                                    const fios_file_options_t* const options)
+{
+    if (options != NULL && options->resume && ! _fios_journal_load(f, outpath))
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        goto error_free;
+    }
+
+    // the existing output is the basis for delta encoding, resuming takes precedence since it also needs it
+    if (options != NULL && options->delta && ! options->resume && ! _fios_delta_open(f, outpath))
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        goto error_free;
+    }
+
+    // keep existing data when there is something to resume from
+    FILE* file = f->resume.offset != 0 ? _fios_fopen(outpath, "r+b") : NULL;
+
+    if (file != NULL)
+        _fios_journal_verify(f, file);
+    else
+        f->resume.offset = 0;
+
+    if (file == NULL)
+        file = _fios_fopen(f->delta.temp != NULL ? f->delta.temp : outpath, "wb");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "fios: failed to open file '%s' for writing, error %d: %s\n", outpath, errno, strerror(errno));
+        goto error_free;
+    }
+
+    fseek(file, 0, SEEK_SET);
+
+    const libfios_stream_functions funcs = {
+        .read = NULL,
+        .write = (libfios_stream_write*)fwrite,
+        .close = (libfios_stream_close*)fclose,
+    };
+
+    _fios_file_receive_stream_init(f, s, funcs, file, options);
+
+    // resuming and delta updates keep going through the stream, which they flush and replace on their own
+    f->storage.sync = f->options.sync;
+   #ifndef _WIN32
+    if (f->options.storage != fios_file_storage_stream && ! f->options.resume && ! f->options.delta)
+        f->storage.mode = f->options.storage;
+
+    if ((f->storage.mode != fios_file_storage_stream || f->storage.sync != fios_file_sync_never)
+        && (f->storage.fd = dup(fileno(file))) < 0)
+    {
+        fprintf(stderr, "fios: failed to duplicate output file descriptor, error %d: %s\n", errno, strerror(errno));
+        fclose(file);
+        goto error_free;
+    }
+   #endif
+
+    return true;
+
+error_free:
+    if (f->delta.basis != NULL)
+        fclose(f->delta.basis);
+
+    free(f->resume.path);
+    free(f->delta.path);
+    free(f->delta.temp);
+    f->resume.path = f->delta.path = f->delta.temp = NULL;
+    f->delta.basis = NULL;
+    return false;
+}
+
+// set up @a f for sending from a stream, without starting a thread for it
+static void _fios_file_send_init(fios_file_t* const f,
+                                 fios_serial_t* const s,
+                                 const int64_t size,
+                                 const libfios_stream_functions funcs,
+                                 libfios_stream_seek* const seek,
+                                 void* const cookie,
+                                 const fios_file_options_t* const options,
+                                 const uint8_t* const map)
+{
+    f->serial = s;
+    f->funcs = funcs;
+    f->seek = seek;
+    f->cookie = cookie;
+    f->map.data = map;
+    f->map.size = map != NULL ? size : 0;
+    f->map.fd = -1;
+    f->error = NULL;
+    f->current = 0;
+    f->size = size > 0 ? size : 0;
+    f->status = fios_file_status_in_progress;
+    f->storage.fd = -1;
+   #ifndef _WIN32
+    f->notifyfd[0] = f->notifyfd[1] = -1;
+   #endif
+    _fios_stats_start(f);
+
+    if (options != NULL)
+        f->options = *options;
+
+    if (f->options.adaptive_payload)
+        f->max_payload_size = f->options.max_payload_size != 0
+                            ? f->options.max_payload_size < MAX_ADAPTIVE_PAYLOAD_SIZE
+                              ? f->options.max_payload_size
+                              : MAX_ADAPTIVE_PAYLOAD_SIZE
+                            : MAX_ADAPTIVE_PAYLOAD_SIZE;
+    else
+        f->max_payload_size = MAX_PAYLOAD_SIZE_SEND;
+}
+
+// set up @a f for sending the file at @a inpath, without starting a thread for it
+static bool _fios_file_send_open(fios_file_t* const f,
+                                 fios_serial_t* const s,
+                                 const char* const inpath,
+                                 const fios_file_options_t* const options)
+{
+    FILE* const file = _fios_fopen(inpath, "rb");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "fios: failed to open file '%s' for reading, error %d: %s\n", inpath, errno, strerror(errno));
+        return false;
+    }
+
+    _fios_fseek(file, 0, SEEK_END);
+    const int64_t size = _fios_ftell(file);
+
+    if (size < 0)
+    {
+        fprintf(stderr, "fios: failed to get size of file '%s', error %d: %s\n", inpath, errno, strerror(errno));
+        fclose(file);
+        return false;
+    }
+
+    _fios_fseek(file, 0, SEEK_SET);
+
+    const libfios_stream_functions funcs = {
+        .read = (libfios_stream_read*)fread,
+        .write = NULL,
+        .close = (libfios_stream_close*)fclose,
+    };
+
+    // map the whole file when possible, so chunks go to the serial port without intermediate copies
+    // the regular stream path is used for empty files, or when the file does not fit in the address space
+    const uint8_t* map = NULL;
+   #ifndef _WIN32
+    if (size != 0 && (uint64_t)size <= SIZE_MAX)
+    {
+        void* const data = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+
+        if (data != MAP_FAILED)
+        {
+           #ifdef MADV_SEQUENTIAL
+            madvise(data, size, MADV_SEQUENTIAL);
+           #endif
+            map = data;
+        }
+        else
+        {
+            DEBUG_PRINT("failed to map input file, error %d: %s\n", errno, strerror(errno));
+        }
+    }
+   #endif
+
+    _fios_file_send_init(f, s, size, funcs, (libfios_stream_seek*)_fios_fseek, file, options, map);
+
+   #ifndef _WIN32
+    // without a descriptor to check the size against, the input is read instead
+    if (map != NULL && (f->map.fd = fcntl(fileno(file), F_DUPFD_CLOEXEC, 0)) < 0)
+    {
+        munmap((void*)map, size);
+        f->map.data = NULL;
+        f->map.size = 0;
+    }
+   #endif
+    return true;
+}
+
+// release what is left of a transfer once nothing runs on it anymore, except the memory of @a f itself
+// @a cookie is the output or input to close, if still open
+static void _fios_file_cleanup(fios_file_t* const f, void* const cookie)
+{
+    _fios_receive_writer_stop(f);
+
+    if (cookie != NULL)
+        f->funcs.close(cookie);
+
+    // the existing output is only replaced once the new file is complete
+    if (f->delta.basis != NULL)
+        fclose(f->delta.basis);
+
+    if (f->delta.temp != NULL)
+    {
+        if (f->status != fios_file_status_completed)
+            _fios_remove(f->delta.temp);
+        else if (! _fios_rename(f->delta.temp, f->delta.path))
+            fprintf(stderr, "fios: failed to replace '%s' with the new file, error %d: %s\n",
+                    f->delta.path, errno, strerror(errno));
+    }
+
+    // the journal is kept for a later session unless the transfer completed,
+    // written only now since closing the output file above flushed everything counted in it
+    if (f->resume.journal != NULL)
+    {
+        if (f->status == fios_file_status_completed)
+        {
+            fclose(f->resume.journal);
+            _fios_remove(f->resume.path);
+        }
+        else
+        {
+            _fios_journal_write(f);
+            fclose(f->resume.journal);
+        }
+    }
+
+   #ifndef _WIN32
+    if (f->map.data != NULL)
+        munmap((void*)f->map.data, f->map.size);
+
+    if (f->map.fd >= 0)
+        close(f->map.fd);
+
+    if (f->storage.map != NULL)
+        munmap(f->storage.map, f->storage.mapsize);
+
+    if (f->storage.fd >= 0)
+    {
+        // an incomplete transfer does not leave the rest of the preallocated output behind
+        if (f->status != fios_file_status_completed
+            && f->storage.mode != fios_file_storage_stream
+            && ftruncate(f->storage.fd, f->written) != 0)
+            fprintf(stderr, "fios: failed to truncate incomplete output file, error %d: %s\n", errno, strerror(errno));
+
+        close(f->storage.fd);
+    }
+
+    if (f->notifyfd[0] >= 0)
+    {
+        close(f->notifyfd[0]);
+        close(f->notifyfd[1]);
+    }
+   #endif
+
+    free(f->resume.path);
+    free(f->delta.path);
+    free(f->delta.temp);
+    free(f->delta.buffer);
+    fios_delta_encoder_close(f->delta.encoder);
+    free(f->delta.signatures);
+    if (f->memory.owned)
+        free(f->memory.data);
+    free(f->buffer);
+    free(f->zbuffer);
+    free(f->writer.buffer);
+    free(f->writer.sizes);
+    fios_task_destroy(f->runner);
+    fios_task_destroy(f->shared);
+}
+
+// create the semaphore posted once the transfer is done, see fios_file_wait
+static void _fios_file_sem_init(fios_file_t* const f)
+{
+   #if defined(__APPLE__)
+    f->task = mach_task_self();
+    semaphore_create(f->task, &f->sem, SYNC_POLICY_FIFO, 0);
+   #elif defined(_WIN32)
+    f->sem = CreateSemaphoreA(NULL, 0, 1, NULL);
+   #else
+    sem_init(&f->sem, 0, 0);
+   #endif
+}
+
+static void _fios_file_sem_destroy(fios_file_t* const f)
+{
+   #if defined(__APPLE__)
+    semaphore_destroy(f->task, f->sem);
+   #elif defined(_WIN32)
+    CloseHandle(f->sem);
+   #else
+    sem_destroy(&f->sem);
+   #endif
+}
+
+#ifndef _WIN32
+// create the pipe written to on every change, see fios_file_get_fd
+static bool _fios_file_notify_init(fios_file_t* const f)
+{
+    // neither side ever waits on the pipe, only the owner through poll
+    if (fios_serial_pipe(f->notifyfd, O_NONBLOCK))
+        return true;
+
+    fprintf(stderr, "fios: failed to create notification pipe, error %d: %s\n", errno, strerror(errno));
+    f->notifyfd[0] = f->notifyfd[1] = -1;
+    return false;
+}
+#endif
+
+// set up a file to be run as a task instead of a thread of its own
+// with the event_loop option it is run from fios_file_process until it first waits, otherwise by the engine option
+static fios_file_t* _fios_file_start_task(fios_file_t* const f, const bool sending)
+{
+    // only serial ports and sockets can be polled, other transports block in their own way
+    if (f->serial->transport != NULL)
+    {
+        fprintf(stderr, "fios: transfers driven by an event loop need a serial port or socket\n");
+        goto error_free;
+    }
+
+    // the writer thread is what tasks replace, chunks are written as they arrive instead
+    f->options.write_queue = 0;
+
+    fios_task_t* const t = fios_task_create(sending ? _fios_send_task : _fios_receive_task, f);
+
+    if (t == NULL)
+        goto error_free;
+
+    if (f->options.event_loop)
+    {
+        f->runner = t;
+        _fios_file_sem_init(f);
+        fios_task_resume(t);
+        return f;
+    }
+
+   #ifndef _WIN32
+    if (! _fios_file_notify_init(f))
+    {
+        fios_task_destroy(t);
+        goto error_free;
+    }
+   #endif
+
+    _fios_file_sem_init(f);
+    f->shared = t;
+
+    if (! fios_engine_add(f->options.engine, t))
+    {
+        _fios_file_sem_destroy(f);
+        goto error_free;
+    }
+
+    return f;
+
+error_free:
+    _fios_file_cleanup(f, f->cookie);
+    free(f);
+    return NULL;
+}
+
+// start the sending or receiving thread of a file set up with one of the functions above, freeing it on failure
+static fios_file_t* _fios_file_start(fios_file_t* const f, const bool sending)
+{
+    if (f->options.event_loop || f->options.engine != NULL)
+        return _fios_file_start_task(f, sending);
+
+   #ifndef _WIN32
+    if (! _fios_file_notify_init(f))
+        goto error_free;
+   #endif
+
+    _fios_file_sem_init(f);
+
+   #ifdef _WIN32
+    if (! fios_thread_create(&f->thread, sending ? _fios_send_thread : _fios_receive_thread, f))
+    {
+        fprintf(stderr, "fios: failed to create %s thread, error %d: %s\n", sending ? "sender" : "receiver",
+                GetLastError(), GetLastErrorString(GetLastError()));
+        goto error_free;
+    }
+   #else
+    if (! fios_thread_create(&f->thread, sending ? _fios_send_thread : _fios_receive_thread, f))
+    {
+        fprintf(stderr, "fios: failed to create %s thread, error %d: %s\n", sending ? "sender" : "receiver",
+                errno, strerror(errno));
+        goto error_free;
+    }
+   #endif
+
+    if (! _fios_thread_sem_wait(f))
+        goto error_free;
+
+    return f;
+
+error_free:
+    _fios_file_cleanup(f, f->cookie);
+    free(f);
+    return NULL;
+}
+
+fios_file_t* fios_file_receive(fios_serial_t* const s, const char* const outpath)
+{
+    return fios_file_receive_ex(s, outpath, NULL);
+}
+
+fios_file_t* fios_file_receive_ex(fios_serial_t* const s,
+                                  const char* const outpath,
+                                  const fios_file_options_t* const options)
+{
+    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    if (! _fios_file_receive_init(f, s, outpath, options))
+    {
+        free(f);
+        return NULL;
+    }
+
+    return _fios_file_start(f, false);
+}
+
+fios_file_t* fios_file_receive_stream(fios_serial_t* const s, const libfios_stream_functions funcs, void* const cookie)
+{
+    return fios_file_receive_stream_ex(s, funcs, cookie, NULL);
+}
+
+fios_file_t* fios_file_receive_stream_ex(fios_serial_t* const s,
+                                         const libfios_stream_functions funcs,
+                                         void* const cookie,
+                                         const fios_file_options_t* const options)
+{
+    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    _fios_file_receive_stream_init(f, s, funcs, cookie, options);
+
+    // both need an output file
+    f->options.resume = false;
+    f->options.delta = false;
+
+    return _fios_file_start(f, false);
+}
+
+fios_file_t* fios_file_receive_memory(fios_serial_t* const s,
+                                      void* const buffer,
+                                      const size_t capacity,
+                                      const fios_file_options_t* const options)
+{
+    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    const libfios_stream_functions funcs = {
+        .read = NULL,
+        .write = _fios_memory_write,
+        .close = _fios_memory_close,
+    };
+
+    _fios_file_receive_stream_init(f, s, funcs, f, options);
+
+    f->options.resume = false;
+    f->options.delta = false;
+    f->memory.active = true;
+    f->memory.owned = buffer == NULL;
+    f->memory.data = buffer;
+    f->memory.capacity = buffer != NULL ? capacity : 0;
+
+    return _fios_file_start(f, false);
+}
+
+const void* fios_file_get_memory(fios_file_t* const f, size_t* const size)
+{
+    assert_return(f != NULL, NULL);
+
+    if (size != NULL)
+        *size = f->memory.size;
+
+    return f->memory.data;
+}
+
+fios_file_t* fios_file_send(fios_serial_t* const s, const char* const inpath)
+{
+    return fios_file_send_ex(s, inpath, NULL);
+}
+
+fios_file_t* fios_file_send_ex(fios_serial_t* const s,
+                               const char* const inpath,
+                               const fios_file_options_t* const options)
+{
+    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    if (! _fios_file_send_open(f, s, inpath, options))
+    {
+        free(f);
+        return NULL;
+    }
+
+    return _fios_file_start(f, true);
+}
+
+fios_file_t* fios_file_send_stream(fios_serial_t* const s,
+                                   const long size,
+                                   const libfios_stream_functions funcs,
+                                   void* const cookie)
+{
+    return fios_file_send_stream_ex(s, size, funcs, NULL, cookie, NULL);
+}
+
+fios_file_t* fios_file_send_stream_ex(fios_serial_t* const s,
+                                      const int64_t size,
+                                      const libfios_stream_functions funcs,
+                                      libfios_stream_seek* const seek,
+                                      void* const cookie,
+                                      const fios_file_options_t* const options)
+{
+    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    _fios_file_send_init(f, s, size, funcs, seek, cookie, options, NULL);
+    return _fios_file_start(f, true);
+}
+
+fios_file_status_t fios_file_idle(fios_file_t* const f, float* const progress)
+{
+    assert_return(f != NULL, fios_file_status_error);
+
+    if (progress != NULL)
+        *progress = f->size != 0 ? (double)f->current / f->size : 0.f;
+
+    return f->status;
+}
+
+int fios_file_get_fd(fios_file_t* const f)
+{
+    assert_return(f != NULL, -1);
+
+   #ifndef _WIN32
+    return f->runner != NULL ? f->serial->fd : f->notifyfd[0];
+   #else
+    return -1;
+   #endif
+}
+
+short fios_file_get_events(fios_file_t* const f, int* const timeout_ms)
+{
+    assert_return(f != NULL, 0);
+    assert_return(timeout_ms != NULL, 0);
+
+   #ifndef _WIN32
+    if (f->runner == NULL)
+    {
+        *timeout_ms = -1;
+        return POLLIN;
+    }
+
+    short events;
+
+    if (fios_task_get_wait(f->runner, NULL, &events, timeout_ms))
+        return events;
+
+    // done, which fios_file_process reports right away
+    *timeout_ms = 0;
+    return 0;
+   #else
+    *timeout_ms = -1;
+    return 0;
+   #endif
+}
+
+fios_file_status_t fios_file_process(fios_file_t* const f, float* const progress)
+{
+    assert_return(f != NULL, fios_file_status_error);
+
+    // the task polls the serial port again itself, so being called early only costs a system call
+    // its status can change before it returns, like a receiver that completed still reading the quit command
+    if (f->runner != NULL)
+    {
+        const bool done = fios_task_resume(f->runner);
+        const fios_file_status_t status = fios_file_idle(f, progress);
+        return done ? status : fios_file_status_in_progress;
+    }
+
+   #ifndef _WIN32
+    // drain before clearing the flag, so that a change racing with this leaves the pipe readable again
+    if (f->notifyfd[0] >= 0)
+    {
+        char buf[16];
+        while (read(f->notifyfd[0], buf, sizeof(buf)) > 0) {}
+
+        atomic_store(&f->notified, false);
+    }
+   #endif
+
+    return fios_file_idle(f, progress);
+}
+
+#ifndef _WIN32
+// run a task from fios_file_wait until it is done, or for up to @a timeout_ms when not negative
+static fios_file_status_t _fios_file_run_task(fios_file_t* const f, const int timeout_ms)
+{
+    const uint64_t deadline = timeout_ms >= 0 ? fios_serial_time_us() + (uint64_t)timeout_ms * 1000 : UINT64_MAX;
+    struct pollfd pfd = { .fd = f->serial->fd };
+    int wait_ms;
+
+    while (! fios_task_resume(f->runner))
+    {
+        // not waiting when called from its own callbacks, it cannot go on from here
+        if (! fios_task_get_wait(f->runner, NULL, &pfd.events, &wait_ms))
+            return fios_file_status_in_progress;
+
+        if (deadline != UINT64_MAX)
+        {
+            const uint64_t now = fios_serial_time_us();
+
+            if (now >= deadline)
+                return fios_file_status_in_progress;
+
+            const int left_ms = (int)((deadline - now + 999) / 1000);
+
+            if (wait_ms < 0 || wait_ms > left_ms)
+                wait_ms = left_ms;
+        }
+
+        while (poll(&pfd, 1, wait_ms) < 0 && errno == EINTR) {}
+    }
+
+    return f->status;
+}
+#endif
+
+fios_file_status_t fios_file_wait(fios_file_t* const f, const int timeout_ms)
+{
+    assert_return(f != NULL, fios_file_status_error);
+
+   #ifndef _WIN32
+    if (f->runner != NULL)
+        return _fios_file_run_task(f, timeout_ms);
+   #endif
+
+    // the transfer thread posts the semaphore once it is done, posted again here so that any later wait returns too
+   #if defined(__APPLE__)
+    if (timeout_ms >= 0)
+    {
+        struct mach_timespec timeout = { 0 };
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+        if (semaphore_timedwait(f->sem, timeout) != KERN_SUCCESS)
+            return fios_file_status_in_progress;
+    }
+    else
+    {
+        while (semaphore_wait(f->sem) == KERN_ABORTED) {}
+    }
+   #elif defined(_WIN32)
+    if (WaitForSingleObject(f->sem, timeout_ms >= 0 ? (DWORD)timeout_ms : INFINITE) != WAIT_OBJECT_0)
+        return fios_file_status_in_progress;
+   #else
+    if (timeout_ms >= 0)
+    {
+        struct timespec timeout;
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_sec += timeout_ms / 1000;
+        timeout.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+
+        if (timeout.tv_nsec >= 1000000000)
+        {
+            ++timeout.tv_sec;
+            timeout.tv_nsec -= 1000000000;
+        }
+
+        int ret;
+        while ((ret = sem_timedwait(&f->sem, &timeout)) != 0 && errno == EINTR) {}
+
+        if (ret != 0)
+            return fios_file_status_in_progress;
+    }
+    else
+    {
+        while (sem_wait(&f->sem) != 0 && errno == EINTR) {}
+    }
+   #endif
+
+    _fios_sem_post(&f->sem);
+    return f->status;
+}
+
+float fios_file_get_progress(fios_file_t* const f)
+{
+    assert_return(f != NULL, 0.f);
+
+    return f->size != 0 ? (double)f->current / f->size : 0.f;
+}
+
+void fios_file_get_bytes(fios_file_t* const f, int64_t* const current, int64_t* const size)
+{
+    assert_return(f != NULL,);
+
+    if (current != NULL)
+        *current = f->current;
+    if (size != NULL)
+        *size = f->size;
+}
+
+void fios_file_get_stats(fios_file_t* const f, fios_file_stats_t* const stats)
+{
+    assert_return(f != NULL,);
+    assert_return(stats != NULL,);
+
+    const uint64_t end = _fios_counter_get(&f->stats.end);
+    const uint64_t now = end != 0 ? end : fios_serial_time_us();
+    const uint64_t elapsed = now - _fios_counter_get(&f->stats.start);
+    _fios_serial_counters_t counters;
+
+    if (end != 0)
+        counters = f->stats.last;
+    else
+        _fios_serial_counters(f->serial, &counters);
+
+    memset(stats, 0, sizeof(fios_file_stats_t));
+    stats->current = f->current;
+    stats->size = f->size;
+    stats->elapsed_us = elapsed;
+    stats->average_rate = elapsed != 0 ? stats->current * 1000000.0 / elapsed : 0.0;
+
+    // once progress stops for longer than a period, the last full one no longer tells how things are going
+    const uint64_t period = now - _fios_counter_get(&f->stats.period_start);
+    const uint64_t rate = _fios_counter_get(&f->stats.rate);
+    const int64_t bytes = stats->current - (int64_t)_fios_counter_get(&f->stats.period_bytes);
+
+    if ((period >= FIOS_STATS_PERIOD_US || rate == 0) && period != 0)
+        stats->instant_rate = bytes > 0 ? bytes * 1000000.0 / period : 0.0;
+    else
+        stats->instant_rate = rate;
+
+    stats->chunks = _fios_counter_get(&f->stats.chunks);
+
+    for (unsigned int i = 0; i < STATS_LATENCY_BUCKETS; ++i)
+        stats->ack_latency[i] = _fios_counter_get(&f->stats.latency[i]);
+
+    stats->serial_read_us = counters.read_us - f->stats.base.read_us;
+    stats->serial_write_us = counters.write_us - f->stats.base.write_us;
+    stats->stream_us = _fios_counter_get(&f->stats.stream_us);
+    stats->reads = counters.reads - f->stats.base.reads;
+    stats->writes = counters.writes - f->stats.base.writes;
+    stats->retries = counters.retries - f->stats.base.retries;
+    stats->retransmits = f->retransmits;
+    stats->damaged = f->damaged;
+}
+
+void fios_file_close(fios_file_t* const f)
+{
+    assert_return(f != NULL,);
+
+    // the transfer fails on the cancelled serial port, and uses the output until it stopped
+    _fios_counter_set(&f->closing, 1);
+    fios_serial_cancel(f->serial);
+
+    if (f->runner != NULL)
+    {
+        // what is left of a task only needs to run until it returns
+        while (! fios_task_resume(f->runner) && fios_task_get_wait(f->runner, NULL, NULL, NULL)) {}
+    }
+    else if (f->shared != NULL)
+    {
+        // the task is freed with the file once the engine is done with it
+        fios_engine_join(f->options.engine, f->shared);
+    }
+    else
+    {
+       #ifdef _WIN32
+        WaitForSingleObject(f->thread, INFINITE);
+        CloseHandle(f->thread);
+       #else
+        pthread_join(f->thread, NULL);
+       #endif
+    }
+
+    _fios_file_sem_destroy(f);
+
+    void* const cookie = f->cookie;
+    f->cookie = NULL;
+
+    _fios_file_cleanup(f, cookie);
+    free(f);
+}
+
+const char* fios_file_get_last_error(fios_file_t* const f)
+{
+    assert_return(f != NULL, "null pointer");
+
+    return f->error != NULL ? f->error : "no error";
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool _fios_batch_error(fios_batch_t* const b, const char* const error)
+{
+    b->error = error;
+    b->status = fios_file_status_error;
+    fprintf(stderr, "%s!\n", error);
+    return false;
+}
+
+// names are relative paths with '/' as separator, which must stay inside the destination directory
+static bool _fios_batch_name_valid(const char* const name)
+{
+    const size_t len = strlen(name);
+
+    if (len == 0 || len >= MAX_BATCH_NAME_SIZE)
+        return false;
+
+    for (const char* component = name;; ++component)
+    {
+        const char* const end = strchr(component, '/');
+        const size_t size = end != NULL ? (size_t)(end - component) : strlen(component);
+
+        if (size == 0 || (size == 1 && component[0] == '.') || (size == 2 && component[0] == '.' && component[1] == '.'))
+            return false;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            // no control characters, drive letters or windows separators
+            if ((uint8_t)component[i] < 0x20 || component[i] == ':' || component[i] == '\\')
+                return false;
+        }
+
+        if (end == NULL)
+            return true;
+
+        component = end;
+    }
+}
+
+// order names so that every name is directly followed by the ones inside it, by sorting '/' before any other character
+// this is only used on valid names, which have no control characters to confuse with it
+static int _fios_batch_name_compare(const void* const a, const void* const b)
+{
+    const uint8_t* x = *(const uint8_t* const*)a;
+    const uint8_t* y = *(const uint8_t* const*)b;
+
+    for (;; ++x, ++y)
+    {
+        const int cx = *x == '/' ? 1 : *x;
+        const int cy = *y == '/' ? 1 : *y;
+
+        if (cx != cy || cx == 0)
+            return cx - cy;
+    }
+}
+
+// check that valid names do not repeat, and that no name is used both for a file and for a directory of another one
+static bool _fios_batch_names_unique(char* const* const names, const unsigned int count)
+{
+    if (count < 2)
+        return true;
+
+    const char** const sorted = malloc(count * sizeof(char*));
+
+    if (sorted == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return false;
+    }
+
+    memcpy(sorted, names, count * sizeof(char*));
+    qsort(sorted, count, sizeof(char*), _fios_batch_name_compare);
+
+    bool unique = true;
+
+    for (unsigned int i = 1; i < count && unique; ++i)
+    {
+        const size_t len = strlen(sorted[i - 1]);
+
+        if (strncmp(sorted[i - 1], sorted[i], len) == 0 && (sorted[i][len] == 0 || sorted[i][len] == '/'))
+        {
+            fprintf(stderr, "fios: duplicate batch file name '%s'\n", sorted[i]);
+            unique = false;
+        }
+    }
+
+    free(sorted);
+    return unique;
+}
+
+// join the destination directory and a file name, creating the subdirectories in the name
+// must only be called once the whole manifest is known to be valid, so that a rejected one leaves nothing behind
+static char* _fios_batch_path(fios_batch_t* const b, const char* const name)
+{
+    const size_t dirlen = strlen(b->destdir);
+    const size_t namelen = strlen(name);
+    char* const path = malloc(dirlen + namelen + 2);
+
+    if (path == NULL)
+        return NULL;
+
+    memcpy(path, b->destdir, dirlen);
+    path[dirlen] = '/';
+    memcpy(path + dirlen + 1, name, namelen + 1);
+
+    for (char* sep = strchr(path + dirlen + 1, '/'); sep != NULL; sep = strchr(sep + 1, '/'))
+    {
+        *sep = 0;
+        const bool ok = _fios_mkdir(path);
+        *sep = '/';
+
+        if (! ok)
+        {
+            fprintf(stderr, "fios: failed to create directory for '%s', error %d: %s\n", path, errno, strerror(errno));
+            free(path);
+            return NULL;
+        }
+    }
+
+    return path;
+}
+
+// allocate the manifest arrays for @a count files
+static bool _fios_batch_alloc(fios_batch_t* const b, const unsigned int count)
+{
+    b->names = calloc(count, sizeof(char*));
+    b->paths = calloc(count, sizeof(char*));
+    b->sizes = calloc(count, sizeof(int64_t));
+    b->crcs = calloc(count, sizeof(uint32_t));
+    b->skip = calloc(count, sizeof(bool));
+    b->allocated = count;
+
+    return b->names != NULL && b->paths != NULL && b->sizes != NULL && b->crcs != NULL && b->skip != NULL;
+}
+
+// get the size and checksum of the file at @a path, returns false if it cannot be read
+static bool _fios_batch_checksum(const char* const path, int64_t* const size, uint32_t* const crc)
+{
+    FILE* const file = _fios_fopen(path, "rb");
+
+    if (file == NULL)
+        return false;
+
+    uint8_t* const buf = malloc(MAX_ADAPTIVE_PAYLOAD_SIZE);
+    size_t r;
+
+    *size = 0;
+    *crc = 0;
+
+    if (buf != NULL)
+    {
+        while ((r = fread(buf, 1, MAX_ADAPTIVE_PAYLOAD_SIZE, file)) != 0)
+        {
+            *crc = fios_crc32(*crc, buf, r);
+            *size += r;
+        }
+    }
+
+    const bool ok = buf != NULL && ferror(file) == 0;
+    free(buf);
+    fclose(file);
+    return ok;
+}
+
+// run each file of the batch through the regular single file transfer, one after the other
+static bool _fios_batch_run_files(fios_batch_t* const b)
+{
+    fios_file_t* const f = &b->file;
+
+    for (unsigned int i = 0; i < b->count; ++i)
+    {
+        if (b->cancelled)
+            return _fios_batch_error(b, "batch session was closed");
+
+        b->index = i;
+
+        if (b->skip[i])
+        {
+            DEBUG_PRINT("batch file %u of %u: %s is unchanged\n", i + 1, b->count, b->names[i]);
+            b->done += b->sizes[i];
+            continue;
+        }
+
+        memset(f, 0, sizeof(fios_file_t));
+
+        if (b->sending)
+        {
+            if (! _fios_file_send_open(f, b->serial, b->paths[i], &b->options))
+                return _fios_batch_error(b, "failed to open input file");
+        }
+        else
+        {
+            if (! _fios_file_receive_init(f, b->serial, b->paths[i], &b->options))
+                return _fios_batch_error(b, "failed to open output file");
+        }
+
+        DEBUG_PRINT("batch file %u of %u: %s\n", i + 1, b->count, b->names[i]);
+
+        f->batched = true;
+
+        void* const cookie = f->cookie;
+        const bool ok = b->sending ? _fios_send_run(f) : _fios_receive_run(f);
+        const int64_t size = f->size;
+
+        f->cookie = NULL;
+        _fios_file_cleanup(f, cookie);
+
+        if (! ok)
+            return _fios_batch_error(b, f->error != NULL ? f->error : "batch file transfer failed");
+
+        f->current = 0;
+        b->done += size;
+    }
+
+    return true;
+}
+
+// files the receiver already has come as a bitmap, one bit per file in manifest order
+static bool _fios_batch_read_skip(fios_batch_t* const b)
+{
+    const unsigned int size = (b->count + 7) / 8;
+    uint8_t* const bits = malloc(size);
+
+    if (bits == NULL)
+        return _fios_batch_error(b, "out of memory");
+
+    if (! fios_serial_read_payload(b->serial, bits, size))
+    {
+        free(bits);
+        return _fios_batch_error(b, "serial port operation failed");
+    }
+
+    for (unsigned int i = 0; i < b->count; ++i)
+    {
+        if ((b->skip[i] = bits[i / 8] & (1 << (i % 8))) != 0)
+            ++b->skipped;
+    }
+
+    free(bits);
+    return true;
+}
+
+static bool _fios_batch_write_skip(fios_batch_t* const b)
+{
+    const unsigned int size = (b->count + 7) / 8;
+    uint8_t* const bits = calloc(1, size);
+
+    if (bits == NULL)
+        return _fios_batch_error(b, "out of memory");
+
+    for (unsigned int i = 0; i < b->count; ++i)
+    {
+        int64_t existing;
+        uint32_t crc;
+
+        if (b->cancelled)
+            break;
+
+        if (_fios_batch_checksum(b->paths[i], &existing, &crc) && existing == b->sizes[i] && crc == b->crcs[i])
+        {
+            bits[i / 8] |= 1 << (i % 8);
+            b->skip[i] = true;
+            ++b->skipped;
+        }
+    }
+
+    const bool ok = fios_serial_write_payload(b->serial, bits, size);
+    free(bits);
+    return ok || _fios_batch_error(b, "serial port operation failed");
+}
+
+// send the manifest, then every file
+static bool _fios_batch_send_run(fios_batch_t* const b)
+{
+    fios_serial_t* const s = b->serial;
+    const bool sync = b->options.skip_unchanged;
+    char cmd[CMD_SIZE];
+
+    // the files are read once more here, which is cheap compared to sending the ones that did not change
+    for (unsigned int i = 0; sync && i < b->count; ++i)
+    {
+        if (b->cancelled)
+            return _fios_batch_error(b, "batch session was closed");
+
+        b->total -= b->sizes[i];
+
+        if (! _fios_batch_checksum(b->paths[i], &b->sizes[i], &b->crcs[i]))
+            return _fios_batch_error(b, "failed to read input file");
+
+        b->total += b->sizes[i];
+    }
+
+    // a different manifest command tells the receiver checksums are included and a reply is expected for them
+    snprintf(cmd, CMD_SIZE, "%c 0x%08x", sync ? 'M' : 'm', b->count);
+
+    if (! fios_serial_write_cmd(s, cmd))
+        return _fios_batch_error(b, "serial port operation failed");
+
+    for (unsigned int i = 0; i < b->count; ++i)
+    {
+        const unsigned int len = strlen(b->names[i]);
+
+        if (! _fios_write_cmd64(s, 'n', b->sizes[i]))
+            return _fios_batch_error(b, "serial port operation failed");
+
+        if (sync)
+        {
+            snprintf(cmd, CMD_SIZE, "c 0x%08x", b->crcs[i]);
+
+            if (! fios_serial_write_cmd(s, cmd))
+                return _fios_batch_error(b, "serial port operation failed");
+        }
+
+        snprintf(cmd, CMD_SIZE, "l 0x%08x", len);
+
+        if (! fios_serial_write_cmd(s, cmd) || ! fios_serial_write_payload(s, b->names[i], len))
+            return _fios_batch_error(b, "serial port operation failed");
+    }
+
+    if (! fios_serial_read_cmd(s, cmd))
+        return _fios_batch_error(b, "serial port operation failed");
+
+    if (strcmp(cmd, "ok") != 0)
+        return _fios_batch_error(b, "receiver rejected the batch manifest");
+
+    if (sync && ! _fios_batch_read_skip(b))
+        return false;
+
+    return _fios_batch_run_files(b);
+}
+
+// receive and check the manifest, then every file
+static bool _fios_batch_receive_run(fios_batch_t* const b)
+{
+    fios_serial_t* const s = b->serial;
+    char cmd[CMD_SIZE];
+    bool valid = true;
+
+    DEBUG_PRINT("waiting for batch manifest\n");
+
+    if (! fios_serial_read_cmd(s, cmd))
+        return _fios_batch_error(b, "serial port operation failed");
+
+    if ((cmd[0] != 'm' && cmd[0] != 'M') || cmd[1] != ' ')
+        return _fios_batch_error(b, "unexpected data received (invalid first command)");
+
+    const bool sync = cmd[0] == 'M';
+
+    const unsigned long count = _fios_cmd_value(cmd);
+
+    if (count > MAX_BATCH_FILES)
+        return _fios_batch_error(b, "unexpected data received (invalid batch size)");
+
+    if (! _fios_batch_alloc(b, count))
+        return _fios_batch_error(b, "out of memory");
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        uint64_t size;
+
+        if (! _fios_read_cmd64(s, cmd, &size))
+            return _fios_batch_error(b, "serial port operation failed");
+
+        if (cmd[0] != 'n' || cmd[1] != ' ' || size > MAX_FILE_SIZE_64)
+            return _fios_batch_error(b, "unexpected data received (invalid batch manifest)");
+
+        if (sync)
+        {
+            if (! fios_serial_read_cmd(s, cmd))
+                return _fios_batch_error(b, "serial port operation failed");
+
+            if (cmd[0] != 'c' || cmd[1] != ' ')
+                return _fios_batch_error(b, "unexpected data received (invalid batch manifest)");
+
+            b->crcs[i] = _fios_cmd_value(cmd);
+        }
+
+        if (! fios_serial_read_cmd(s, cmd))
+            return _fios_batch_error(b, "serial port operation failed");
+
+        const unsigned long len = _fios_cmd_value(cmd);
+
+        if (cmd[0] != 'l' || cmd[1] != ' ' || len == 0 || len >= MAX_BATCH_NAME_SIZE)
+            return _fios_batch_error(b, "unexpected data received (invalid batch manifest)");
+
+        if ((b->names[i] = malloc(len + 1)) == NULL)
+            return _fios_batch_error(b, "out of memory");
+
+        if (! fios_serial_read_payload(s, b->names[i], len))
+            return _fios_batch_error(b, "serial port operation failed");
+
+        b->names[i][len] = 0;
+        b->sizes[i] = size;
+        b->total += size;
+
+        // keep reading the rest of the manifest, so that the sender gets a proper reply
+        if (valid && ! _fios_batch_name_valid(b->names[i]))
+        {
+            fprintf(stderr, "fios: invalid batch file name '%s'\n", b->names[i]);
+            valid = false;
+        }
+    }
+
+    // two files with the same name would overwrite each other
+    if (valid)
+        valid = _fios_batch_names_unique(b->names, count);
+
+    // nothing is created before the whole manifest was checked
+    for (unsigned int i = 0; i < count && valid; ++i)
+        valid = (b->paths[i] = _fios_batch_path(b, b->names[i])) != NULL;
+
+    if (! fios_serial_write_cmd(s, valid ? "ok" : "x"))
+        return _fios_batch_error(b, "serial port operation failed");
+
+    if (! valid)
+        return _fios_batch_error(b, "unexpected data received (invalid batch file name)");
+
+    b->count = count;
+
+    if (sync && ! _fios_batch_write_skip(b))
+        return false;
+
+    return _fios_batch_run_files(b);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall _fios_batch_thread(void* const arg)
+#else
+static void* _fios_batch_thread(void* const arg)
+#endif
+{
+    fios_batch_t* const b = arg;
+
+   #if defined(__APPLE__)
+    semaphore_signal(b->sem);
+   #elif defined(_WIN32)
+    ReleaseSemaphore(b->sem, 1, NULL);
+   #else
+    sem_post(&b->sem);
+   #endif
+
+    if (b->sending ? _fios_batch_send_run(b) : _fios_batch_receive_run(b))
+        b->status = fios_file_status_completed;
+
+    DEBUG_PRINT("_fios_batch_thread done\n");
+    return _fios_thread_close();
+}
+
+static void _fios_batch_free(fios_batch_t* const b)
+{
+    for (unsigned int i = 0; i < b->allocated; ++i)
+    {
+        if (b->names != NULL)
+            free(b->names[i]);
+        if (b->paths != NULL)
+            free(b->paths[i]);
+    }
+
+    free(b->names);
+    free(b->paths);
+    free(b->sizes);
+    free(b->crcs);
+    free(b->skip);
+    free(b->destdir);
+    free(b);
+}
+
+// start the thread of a batch session, freeing it on failure
+static fios_batch_t* _fios_batch_start(fios_batch_t* const b)
+{
+    b->status = fios_file_status_in_progress;
+
+   #if defined(__APPLE__)
+    b->task = mach_task_self();
+    semaphore_create(b->task, &b->sem, SYNC_POLICY_FIFO, 0);
+   #elif defined(_WIN32)
+    b->sem = CreateSemaphoreA(NULL, 0, 1, NULL);
+   #else
+    sem_init(&b->sem, 0, 0);
+   #endif
+
+   #ifdef _WIN32
+    if (! fios_thread_create(&b->thread, _fios_batch_thread, b))
+    {
+        fprintf(stderr, "fios: failed to create batch thread, error %d: %s\n",
+                GetLastError(), GetLastErrorString(GetLastError()));
+        goto error_free;
+    }
+
+    if (WaitForSingleObject(b->sem, INFINITE) != WAIT_OBJECT_0)
+        goto error_free;
+   #else
+    if (! fios_thread_create(&b->thread, _fios_batch_thread, b))
+    {
+        fprintf(stderr, "fios: failed to create batch thread, error %d: %s\n", errno, strerror(errno));
+        goto error_free;
+    }
+
+   #if defined(__APPLE__)
+    semaphore_wait(b->sem);
+   #else
+    while (sem_wait(&b->sem) != 0 && errno == EINTR) {}
+   #endif
+   #endif
+
+    return b;
+
+error_free:
+    _fios_batch_free(b);
+    return NULL;
+}
+
+// set up a batch session sending @a count files, named after the last component of each path without @a basedir,
+// or after the path itself relative to @a basedir
+static fios_batch_t* _fios_batch_send_open(fios_serial_t* const s,
+                                           const char* const basedir,
+                                           const char* const* const paths,
+                                           const unsigned int count,
+                                           const fios_file_options_t* const options)
+{
+    fios_batch_t* const b = calloc(1, sizeof(fios_batch_t));
+
+    if (b == NULL || ! _fios_batch_alloc(b, count))
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        goto error_free;
+    }
+
+    b->serial = s;
+    b->sending = true;
+    b->count = count;
+
+    if (options != NULL)
+        b->options = *options;
+
+    // sizes are taken now for the manifest, the transfer of each file still sends its own
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const char* name = paths[i];
+
+        if (basedir != NULL)
+        {
+            const size_t dirlen = strlen(basedir);
+            const size_t namelen = strlen(name);
+
+            if ((b->paths[i] = malloc(dirlen + namelen + 2)) != NULL)
+            {
+                memcpy(b->paths[i], basedir, dirlen);
+                b->paths[i][dirlen] = '/';
+                memcpy(b->paths[i] + dirlen + 1, name, namelen + 1);
+            }
+        }
+        else
+        {
+            for (const char* c = paths[i]; *c != 0; ++c)
+            {
+               #ifdef _WIN32
+                if (*c == '/' || *c == '\\')
+               #else
+                if (*c == '/')
+               #endif
+                    name = c + 1;
+            }
+
+            b->paths[i] = strdup(paths[i]);
+        }
+
+        if (! _fios_batch_name_valid(name))
+        {
+            fprintf(stderr, "fios: invalid batch file name '%s'\n", paths[i]);
+            goto error_free;
+        }
+
+        if (b->paths[i] == NULL || (b->names[i] = strdup(name)) == NULL)
+        {
+            fprintf(stderr, "fios: out of memory\n");
+            goto error_free;
+        }
+
+        FILE* const file = _fios_fopen(b->paths[i], "rb");
+
+        if (file == NULL)
+        {
+            fprintf(stderr, "fios: failed to open file '%s' for reading, error %d: %s\n", b->paths[i], errno, strerror(errno));
+            goto error_free;
+        }
+
+        _fios_fseek(file, 0, SEEK_END);
+        b->sizes[i] = _fios_ftell(file);
+        fclose(file);
+
+        if (b->sizes[i] < 0)
+        {
+            fprintf(stderr, "fios: failed to get size of file '%s'\n", b->paths[i]);
+            goto error_free;
+        }
+
+        b->total += b->sizes[i];
+    }
+
+    // the receiver rejects these anyway, but only after the manifest was sent
+    if (! _fios_batch_names_unique(b->names, count))
+        goto error_free;
+
+    return _fios_batch_start(b);
+
+error_free:
+    if (b != NULL)
+        _fios_batch_free(b);
+
+    return NULL;
+}
+
+fios_batch_t* fios_batch_send(fios_serial_t* const s,
+                              const char* const* const paths,
+                              const unsigned int count,
+                              const fios_file_options_t* const options)
+{
+    assert_return(s != NULL, NULL);
+    assert_return(paths != NULL || count == 0, NULL);
+    assert_return(count <= MAX_BATCH_FILES, NULL);
+
+    return _fios_batch_send_open(s, NULL, paths, count, options);
+}
+
+fios_batch_t* fios_batch_send_dir(fios_serial_t* const s,
+                                  const char* const basedir,
+                                  const char* const* const names,
+                                  const unsigned int count,
+                                  const fios_file_options_t* const options)
+{
+    assert_return(s != NULL, NULL);
+    assert_return(basedir != NULL, NULL);
+    assert_return(names != NULL || count == 0, NULL);
+    assert_return(count <= MAX_BATCH_FILES, NULL);
+
+    return _fios_batch_send_open(s, basedir, names, count, options);
+}
+
+fios_batch_t* fios_batch_receive(fios_serial_t* const s, const char* const destdir, const fios_file_options_t* const options)
+{
+    assert_return(s != NULL, NULL);
+    assert_return(destdir != NULL, NULL);
+
+    fios_batch_t* const b = calloc(1, sizeof(fios_batch_t));
+
+    if (b == NULL || (b->destdir = strdup(destdir)) == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        free(b);
+        return NULL;
+    }
+
+    b->serial = s;
+    b->sending = false;
+
+    if (options != NULL)
+        b->options = *options;
+
+    return _fios_batch_start(b);
+}
+
+fios_file_status_t fios_batch_idle(fios_batch_t* const b, float* const progress)
+{
+    assert_return(b != NULL, fios_file_status_error);
+
+    if (progress != NULL)
+    {
+        const int64_t current = b->done + b->file.current;
+        *progress = b->total != 0 ? (double)(current < b->total ? current : b->total) / b->total
+                  : b->status == fios_file_status_completed ? 1.f : 0.f;
+    }
+
+    return b->status;
+}
+
+float fios_batch_get_file_progress(fios_batch_t* const b, unsigned int* const index, unsigned int* const count)
+{
+    assert_return(b != NULL, 0.f);
+
+    if (index != NULL)
+        *index = b->index;
+    if (count != NULL)
+        *count = b->count;
+
+    return b->file.size != 0 ? (double)b->file.current / b->file.size : 0.f;
+}
+
+const char* fios_batch_get_file_name(fios_batch_t* const b, const unsigned int index)
+{
+    assert_return(b != NULL, NULL);
+
+    return index < b->count ? b->names[index] : NULL;
+}
+
+unsigned int fios_batch_get_skipped(fios_batch_t* const b)
+{
+    assert_return(b != NULL, 0);
+
+    return b->skipped;
+}
+
+void fios_batch_get_bytes(fios_batch_t* const b, int64_t* const current, int64_t* const size)
+{
+    assert_return(b != NULL,);
+
+    if (current != NULL)
+        *current = b->done + b->file.current;
+    if (size != NULL)
+        *size = b->total;
+}
+
+void fios_batch_close(fios_batch_t* const b)
+{
+    assert_return(b != NULL,);
+
+    // the file in progress fails once the serial port is cancelled, no other file starts after it
+    b->cancelled = true;
+    fios_serial_cancel(b->serial);
+
+   #if defined(__APPLE__)
+    pthread_join(b->thread, NULL);
+    semaphore_destroy(b->task, b->sem);
+   #elif defined(_WIN32)
+    WaitForSingleObject(b->thread, INFINITE);
+    CloseHandle(b->thread);
+    CloseHandle(b->sem);
+   #else
+    pthread_join(b->thread, NULL);
+    sem_destroy(&b->sem);
+   #endif
+
+    _fios_batch_free(b);
 }
 
-fios_file_t* fios_file_receive(fios_serial_t* const s, const char* const outpath)
+const char* fios_batch_get_last_error(fios_batch_t* const b)
 {
-    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+    assert_return(b != NULL, "null pointer");
 
-    if (f == NULL)
+    return b->error != NULL ? b->error : "no error";
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// Bonded transfers run a session of their own on every serial port, made of:
+//  - "B" with the file size and "b" with the stripe size, answered with "ok" or "x"
+//  - "o" with the offset of a stripe, followed by a regular transfer of it, for as long as there are stripes left
+//  - "e" once the sender has no other stripe for this serial port
+// Each serial port takes the next stripe as soon as it is done with the previous one,
+// so that faster serial ports end up carrying more of the file.
+
+static bool _fios_bond_error(fios_bond_t* const b, const char* const error)
+{
+    _fios_sem_wait(&b->lock);
+
+    // the first failure stops every serial port, the others then only fail because of it
+    const bool first = ! b->cancelled;
+
+    if (first)
     {
-        fprintf(stderr, "fios: out of memory\n");
-        return NULL;
+        b->error = error;
+        b->status = fios_file_status_error;
+        b->cancelled = true;
     }
 
-    FILE* file;
-   #ifdef _WIN32
-    WCHAR loutpath[MAX_PATH];
-    if (MultiByteToWideChar(CP_UTF8, 0, outpath, -1, loutpath, MAX_PATH) != 0)
-        file = _wfopen(loutpath, L"wb");
-    else
-        file = NULL;
-   #else
-    file = fopen(outpath, "wb");
-   #endif
+    _fios_sem_post(&b->lock);
 
-    if (file == NULL)
+    if (first)
     {
-        fprintf(stderr, "fios: failed to open file '%s' for writing, error %d: %s\n", outpath, errno, strerror(errno));
-        goto error_free;
+        fprintf(stderr, "%s!\n", error);
+
+        for (unsigned int i = 0; i < b->count; ++i)
+            fios_serial_cancel(b->links[i].serial);
     }
 
-    fseek(file, 0, SEEK_SET);
+    return false;
+}
 
-    f->serial = s;
-    f->cookie = file;
-    f->funcs.read = NULL;
-    f->funcs.write = (libfios_stream_write*)fwrite;
-    f->funcs.close = (libfios_stream_close*)fclose;
-    f->error = NULL;
-    f->current = f->size = 0;
-    f->status = fios_file_status_in_progress;
+// stripe data is read and written directly from the stream of each serial port, which is never past the stripe end
+static size_t _fios_bond_read(void* const buffer, const size_t size, const size_t n, void* const cookie)
+{
+    _fios_bond_link_t* const link = cookie;
+    const size_t len = (int64_t)(size * n) < link->left ? size * n : (size_t)link->left;
+    const size_t r = fread(buffer, 1, len, link->stream);
 
-   #if defined(__APPLE__)
-    f->task = mach_task_self();
-    semaphore_create(f->task, &f->sem, SYNC_POLICY_FIFO, 0);
-   #elif defined(_WIN32)
-    f->sem = CreateSemaphoreA(NULL, 0, 1, NULL);
-   #else
-    sem_init(&f->sem, 0, 0);
-   #endif
+    link->left -= r;
+    return r / size;
+}
 
-   #ifdef _WIN32
-    f->thread = (HANDLE)_beginthreadex(NULL, 0, _fios_receive_thread, f, 0, NULL);
-    if (f->thread == NULL)
-    {
-        fprintf(stderr, "fios: failed to create sender thread, error %d: %s\n",
-                GetLastError(), GetLastErrorString(GetLastError()));
-        goto error_close;
-    }
+static size_t _fios_bond_write(const void* const buffer, const size_t size, const size_t n, void* const cookie)
+{
+    _fios_bond_link_t* const link = cookie;
 
-   #else
-    if (pthread_create(&f->thread, NULL, _fios_receive_thread, f) != 0)
-    {
-        fprintf(stderr, "fios: failed to create sender thread, error %d: %s\n", errno, strerror(errno));
-        goto error_close;
-    }
-   #endif
+    if ((int64_t)(size * n) > link->left)
+        return 0;
 
-    if (! _fios_thread_sem_wait(f))
-        goto error_free;
+    const size_t w = fwrite(buffer, size, n, link->stream);
 
-    return f;
+    link->left -= w * size;
+    return w;
+}
 
-error_close:
-    fclose(file);
+// streams stay open for the next stripe, they are closed along with the bonded transfer
+static int _fios_bond_close(void* const cookie)
+{
+    // unused
+    (void)cookie;
+    return 0;
+}
 
-error_free:
-    free(f);
-    return NULL;
+// count a stripe as done, completing the bonded transfer once all of them are
+static void _fios_bond_stripe_done(_fios_bond_link_t* const link, const int64_t size)
+{
+    fios_bond_t* const b = link->bond;
+
+    _fios_sem_wait(&b->lock);
+
+    link->file.current = 0;
+    link->bytes += size;
+    b->done += size;
+
+    if (b->done == b->size && b->status == fios_file_status_in_progress)
+        b->status = fios_file_status_completed;
+
+    _fios_sem_post(&b->lock);
 }
 
-fios_file_t* fios_file_send(fios_serial_t* const s, const char* const inpath)
+static bool _fios_bond_send_run(_fios_bond_link_t* const link)
 {
-    FILE* file;
-   #ifdef _WIN32
-    WCHAR linpath[MAX_PATH];
-    if (MultiByteToWideChar(CP_UTF8, 0, inpath, -1, linpath, MAX_PATH) != 0)
-        file = _wfopen(linpath, L"rb");
-    else
-        file = NULL;
-   #else
-    file = fopen(inpath, "rb");
-   #endif
+    fios_bond_t* const b = link->bond;
+    fios_serial_t* const s = link->serial;
+    fios_file_t* const f = &link->file;
+    char cmd[CMD_SIZE];
 
-    if (file == NULL)
+    if (! _fios_write_cmd64(s, 'B', b->size) || ! _fios_write_cmd64(s, 'b', b->stripe) || ! fios_serial_read_cmd(s, cmd))
+        return _fios_bond_error(b, "serial port operation failed");
+
+    if (strcmp(cmd, "ok") != 0)
+        return _fios_bond_error(b, "bonded transfer was rejected by the receiver");
+
+    const libfios_stream_functions funcs = {
+        .read = _fios_bond_read,
+        .write = NULL,
+        .close = _fios_bond_close,
+    };
+
+    for (;;)
     {
-        fprintf(stderr, "fios: failed to open file '%s' for reading, error %d: %s\n", inpath, errno, strerror(errno));
-        return NULL;
+        _fios_sem_wait(&b->lock);
+
+        const bool cancelled = b->cancelled;
+        const int64_t offset = b->next;
+
+        if (! cancelled && offset < b->size)
+            b->next += b->stripe;
+
+        _fios_sem_post(&b->lock);
+
+        if (cancelled)
+            return false;
+
+        if (offset >= b->size)
+            break;
+
+        const int64_t size = b->size - offset < b->stripe ? b->size - offset : b->stripe;
+
+        if (_fios_fseek(link->stream, offset, SEEK_SET) != 0)
+            return _fios_bond_error(b, "failed to read input file");
+
+        DEBUG_PRINT("bonded stripe at %lld over serial port %u\n", (long long)offset, (unsigned)(link - b->links));
+
+        if (! _fios_write_cmd64(s, 'o', offset))
+            return _fios_bond_error(b, "serial port operation failed");
+
+        memset(f, 0, sizeof(fios_file_t));
+        _fios_file_send_init(f, s, size, funcs, NULL, link, &b->options, NULL);
+        f->batched = true;
+        link->left = size;
+
+        const bool ok = _fios_send_run(f);
+        _fios_file_cleanup(f, NULL);
+
+        if (! ok)
+            return _fios_bond_error(b, f->error != NULL ? f->error : "bonded stripe transfer failed");
+
+        _fios_bond_stripe_done(link, size);
     }
 
-    fseek(file, 0, SEEK_END);
-    const long size = ftell(file);
+    if (! fios_serial_write_cmd(s, "e"))
+        return _fios_bond_error(b, "serial port operation failed");
+
+    // only needed for empty files, where there are no stripes to complete the transfer
+    _fios_bond_stripe_done(link, 0);
+    return true;
+}
+
+static bool _fios_bond_receive_run(_fios_bond_link_t* const link)
+{
+    fios_bond_t* const b = link->bond;
+    fios_serial_t* const s = link->serial;
+    fios_file_t* const f = &link->file;
+    char cmd[CMD_SIZE];
+    uint64_t size, stripe;
+
+    if (! _fios_read_cmd64(s, cmd, &size))
+        return _fios_bond_error(b, "serial port operation failed");
+
+    bool valid = cmd[0] == 'B' && cmd[1] == ' ' && size <= MAX_FILE_SIZE_64;
+
+    if (! _fios_read_cmd64(s, cmd, &stripe))
+        return _fios_bond_error(b, "serial port operation failed");
+
+    valid = valid && cmd[0] == 'b' && cmd[1] == ' '
+         && stripe >= FIOS_BOND_MIN_STRIPE_SIZE && stripe <= FIOS_BOND_MAX_STRIPE_SIZE;
 
-    if (size > MAX_FILE_SIZE)
+    _fios_sem_wait(&b->lock);
+
+    // every serial port gets the same sizes, the first one sets up the stripes
+    if (valid && b->sized)
     {
-        fprintf(stderr, "fios: file is too big! must be < 2GiB\n");
-        goto error_close;
+        valid = b->size == (int64_t)size && b->stripe == (int64_t)stripe;
     }
+    else if (valid)
+    {
+        const uint64_t count = (size + stripe - 1) / stripe;
 
-    fseek(file, 0, SEEK_SET);
+        valid = count <= FIOS_BOND_MAX_STRIPES && (b->stripes = calloc(count != 0 ? count : 1, sizeof(bool))) != NULL;
+
+        if (valid)
+        {
+            b->size = size;
+            b->stripe = stripe;
+            b->sized = true;
+        }
+    }
+
+    _fios_sem_post(&b->lock);
+
+    if (! fios_serial_write_cmd(s, valid ? "ok" : "x"))
+        return _fios_bond_error(b, "serial port operation failed");
+
+    if (! valid)
+        return _fios_bond_error(b, "unexpected data received (invalid bonded transfer)");
 
     const libfios_stream_functions funcs = {
-        .read = (libfios_stream_read*)fread,
-        .write = NULL,
-        .close = (libfios_stream_close*)fclose,
+        .read = NULL,
+        .write = _fios_bond_write,
+        .close = _fios_bond_close,
     };
-    return fios_file_send_stream(s, size, funcs, file);
 
-error_close:
-    fclose(file);
-    return NULL;
+    for (;;)
+    {
+        uint64_t offset;
+
+        if (! _fios_read_cmd64(s, cmd, &offset))
+            return _fios_bond_error(b, "serial port operation failed");
+
+        if (cmd[0] == 'e' && cmd[1] == 0)
+            break;
+
+        if (cmd[0] != 'o' || cmd[1] != ' ' || offset >= size || offset % stripe != 0)
+            return _fios_bond_error(b, "unexpected data received (invalid bonded stripe)");
+
+        // each stripe only comes once, otherwise the transfer would look complete while missing another one
+        _fios_sem_wait(&b->lock);
+        const bool duplicate = b->stripes[offset / stripe];
+        b->stripes[offset / stripe] = true;
+        _fios_sem_post(&b->lock);
+
+        if (duplicate)
+            return _fios_bond_error(b, "unexpected data received (duplicate bonded stripe)");
+
+        const int64_t length = size - offset < stripe ? size - offset : stripe;
+
+        if (_fios_fseek(link->stream, offset, SEEK_SET) != 0)
+            return _fios_bond_error(b, "failed to write output file");
+
+        memset(f, 0, sizeof(fios_file_t));
+        _fios_file_receive_stream_init(f, s, funcs, link, &b->options);
+        f->batched = true;
+        link->left = length;
+
+        const bool ok = _fios_receive_run(f);
+        const int64_t received = f->size;
+        _fios_file_cleanup(f, NULL);
+
+        if (! ok)
+            return _fios_bond_error(b, f->error != NULL ? f->error : "bonded stripe transfer failed");
+
+        if (received != length)
+            return _fios_bond_error(b, "unexpected data received (invalid bonded stripe size)");
+
+        _fios_bond_stripe_done(link, length);
+    }
+
+    _fios_bond_stripe_done(link, 0);
+    return true;
 }
 
-fios_file_t* fios_file_send_stream(fios_serial_t* const s,
-                                   const long size,
-                                   const libfios_stream_functions funcs,
-                                   void* const cookie)
+#ifdef _WIN32
+static unsigned __stdcall _fios_bond_thread(void* const arg)
+#else
+static void* _fios_bond_thread(void* const arg)
+#endif
 {
-    fios_file_t* const f = calloc(1, sizeof(fios_file_t));
+    _fios_bond_link_t* const link = arg;
 
-    if (f == NULL)
+    if (link->bond->sending)
+        _fios_bond_send_run(link);
+    else
+        _fios_bond_receive_run(link);
+
+    DEBUG_PRINT("_fios_bond_thread done\n");
+    return _fios_thread_close();
+}
+
+// allocate a bonded transfer over @a count serial ports, opening @a path on each of them with @a mode
+static fios_bond_t* _fios_bond_alloc(fios_serial_t* const* const serials,
+                                     const unsigned int count,
+                                     const char* const path,
+                                     const char* const mode,
+                                     const fios_file_options_t* const options)
+{
+    fios_bond_t* const b = calloc(1, sizeof(fios_bond_t));
+
+    if (b == NULL)
     {
         fprintf(stderr, "fios: out of memory\n");
         return NULL;
     }
 
-    f->serial = s;
-    f->funcs = funcs;
-    f->cookie = cookie;
-    f->error = NULL;
-    f->current = 0;
-    f->size = size > 0 ? size : 0;
-    f->status = fios_file_status_in_progress;
-
    #if defined(__APPLE__)
-    f->task = mach_task_self();
-    semaphore_create(f->task, &f->sem, SYNC_POLICY_FIFO, 0);
+    b->task = mach_task_self();
+    semaphore_create(b->task, &b->lock, SYNC_POLICY_FIFO, 1);
    #elif defined(_WIN32)
-    f->sem = CreateSemaphoreA(NULL, 0, 1, NULL);
+    b->lock = CreateSemaphoreA(NULL, 1, 1, NULL);
    #else
-    sem_init(&f->sem, 0, 0);
+    sem_init(&b->lock, 0, 1);
    #endif
 
-   #ifdef _WIN32
-    f->thread = (HANDLE)_beginthreadex(NULL, 0, _fios_send_thread, f, 0, NULL);
-    if (f->thread == NULL)
+    b->count = count;
+    b->status = fios_file_status_in_progress;
+
+    if (options != NULL)
+        b->options = *options;
+
+    // stripes are regular transfers of their own, which cannot be resumed or delta encoded
+    b->options.resume = false;
+    b->options.delta = false;
+    b->options.skip_unchanged = false;
+
+    for (unsigned int i = 0; i < count; ++i)
     {
-        fprintf(stderr, "fios: failed to create sender thread, error %d: %s\n",
-                GetLastError(), GetLastErrorString(GetLastError()));
-        goto error_close;
+        _fios_bond_link_t* const link = &b->links[i];
+
+        link->bond = b;
+        link->serial = serials[i];
+        link->stream = _fios_fopen(path, mode);
+
+        if (link->stream == NULL)
+        {
+            fprintf(stderr, "fios: failed to open file '%s', error %d: %s\n", path, errno, strerror(errno));
+            fios_bond_close(b);
+            return NULL;
+        }
     }
-   #else
-    if (pthread_create(&f->thread, NULL, _fios_send_thread, f) != 0)
+
+    return b;
+}
+
+// start the thread of every serial port of a bonded transfer, closing it on failure
+static fios_bond_t* _fios_bond_start(fios_bond_t* const b)
+{
+    for (unsigned int i = 0; i < b->count; ++i)
     {
-        fprintf(stderr, "fios: failed to create sender thread, error %d: %s\n", errno, strerror(errno));
-        goto error_close;
+        _fios_bond_link_t* const link = &b->links[i];
+
+        if (! fios_thread_create(&link->thread, _fios_bond_thread, link))
+        {
+           #ifdef _WIN32
+            fprintf(stderr, "fios: failed to create bond thread, error %d: %s\n",
+                    GetLastError(), GetLastErrorString(GetLastError()));
+           #else
+            fprintf(stderr, "fios: failed to create bond thread, error %d: %s\n", errno, strerror(errno));
+           #endif
+            fios_bond_close(b);
+            return NULL;
+        }
+
+        link->started = true;
     }
-   #endif
 
-    if (! _fios_thread_sem_wait(f))
-        goto error_free;
+    return b;
+}
 
-    return f;
+fios_bond_t* fios_bond_send(fios_serial_t* const* const serials,
+                            const unsigned int count,
+                            const char* const inpath,
+                            const fios_file_options_t* const options)
+{
+    assert_return(serials != NULL, NULL);
+    assert_return(count != 0 && count <= MAX_BOND_LINKS, NULL);
+    assert_return(inpath != NULL, NULL);
 
-error_close:
-    funcs.close(cookie);
+    fios_bond_t* const b = _fios_bond_alloc(serials, count, inpath, "rb", options);
 
-error_free:
-    free(f);
-    return NULL;
+    if (b == NULL)
+        return NULL;
+
+    b->sending = true;
+
+    _fios_fseek(b->links[0].stream, 0, SEEK_END);
+    b->size = _fios_ftell(b->links[0].stream);
+
+    if (b->size < 0)
+    {
+        fprintf(stderr, "fios: failed to get size of file '%s', error %d: %s\n", inpath, errno, strerror(errno));
+        fios_bond_close(b);
+        return NULL;
+    }
+
+    // several stripes per serial port, so that they all finish around the same time
+    int64_t stripe = b->size / (count * 8);
+    stripe = (stripe + 0xfff) & ~(int64_t)0xfff;
+    stripe = stripe < FIOS_BOND_MIN_STRIPE_SIZE ? FIOS_BOND_MIN_STRIPE_SIZE : stripe;
+    stripe = stripe > FIOS_BOND_MAX_STRIPE_SIZE ? FIOS_BOND_MAX_STRIPE_SIZE : stripe;
+
+    if ((b->size + stripe - 1) / stripe > FIOS_BOND_MAX_STRIPES)
+    {
+        fprintf(stderr, "fios: file '%s' is too large for a bonded transfer\n", inpath);
+        fios_bond_close(b);
+        return NULL;
+    }
+
+    b->stripe = stripe;
+    b->sized = true;
+
+    return _fios_bond_start(b);
 }
 
-fios_file_status_t fios_file_idle(fios_file_t* const f, float* const progress)
+fios_bond_t* fios_bond_receive(fios_serial_t* const* const serials,
+                               const unsigned int count,
+                               const char* const outpath,
+                               const fios_file_options_t* const options)
 {
-    assert_return(f != NULL, fios_file_status_error);
+    assert_return(serials != NULL, NULL);
+    assert_return(count != 0 && count <= MAX_BOND_LINKS, NULL);
+    assert_return(outpath != NULL, NULL);
+
+    // stripes arrive in any order, so the output is created first and then written at their offsets
+    FILE* const file = _fios_fopen(outpath, "wb");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "fios: failed to open file '%s' for writing, error %d: %s\n", outpath, errno, strerror(errno));
+        return NULL;
+    }
+
+    fclose(file);
+
+    fios_bond_t* const b = _fios_bond_alloc(serials, count, outpath, "r+b", options);
+
+    if (b == NULL)
+        return NULL;
+
+    b->sending = false;
+
+    return _fios_bond_start(b);
+}
+
+fios_file_status_t fios_bond_idle(fios_bond_t* const b, float* const progress)
+{
+    assert_return(b != NULL, fios_file_status_error);
 
     if (progress != NULL)
-        *progress = f->size != 0 ? (double)f->current / f->size : 0.f;
+    {
+        int64_t current, size;
+        fios_bond_get_bytes(b, &current, &size);
 
-    return f->status;
+        *progress = size != 0 ? (double)current / size : b->status == fios_file_status_completed ? 1.f : 0.f;
+    }
+
+    return b->status;
 }
 
-float fios_file_get_progress(fios_file_t* const f)
+void fios_bond_get_bytes(fios_bond_t* const b, int64_t* const current, int64_t* const size)
 {
-    assert_return(f != NULL, 0.f);
+    assert_return(b != NULL,);
 
-    return f->size != 0 ? (double)f->current / f->size : 0.f;
+    if (current != NULL)
+    {
+        int64_t bytes = b->done;
+
+        for (unsigned int i = 0; i < b->count; ++i)
+            bytes += b->links[i].file.current;
+
+        *current = bytes < b->size ? bytes : b->size;
+    }
+
+    if (size != NULL)
+        *size = b->size;
 }
 
-void fios_file_close(fios_file_t* const f)
+int64_t fios_bond_get_link_bytes(fios_bond_t* const b, const unsigned int index)
 {
-    assert_return(f != NULL,);
+    assert_return(b != NULL, 0);
 
-    void* const cookie = f->cookie;
+    return index < b->count ? b->links[index].bytes + b->links[index].file.current : 0;
+}
 
-    if (cookie != NULL)
+void fios_bond_close(fios_bond_t* const b)
+{
+    assert_return(b != NULL,);
+
+    _fios_sem_wait(&b->lock);
+    b->cancelled = true;
+    _fios_sem_post(&b->lock);
+
+    // the stripe in progress on each serial port fails once it is cancelled, no other stripe starts after it
+    for (unsigned int i = 0; i < b->count; ++i)
+        fios_serial_cancel(b->links[i].serial);
+
+    for (unsigned int i = 0; i < b->count; ++i)
     {
-        f->cookie = NULL;
-        f->funcs.close(cookie);
-    }
+        _fios_bond_link_t* const link = &b->links[i];
 
-    fios_serial_cancel(f->serial);
+        if (link->started)
+        {
+           #ifdef _WIN32
+            WaitForSingleObject(link->thread, INFINITE);
+            CloseHandle(link->thread);
+           #else
+            pthread_join(link->thread, NULL);
+           #endif
+        }
+
+        if (link->stream != NULL)
+            fclose(link->stream);
+    }
 
    #if defined(__APPLE__)
-    pthread_join(f->thread, NULL);
-    semaphore_destroy(f->task, f->sem);
+    semaphore_destroy(b->task, b->lock);
    #elif defined(_WIN32)
-    WaitForSingleObject(f->thread, INFINITE);
-    CloseHandle(f->thread);
-    CloseHandle(f->sem);
+    CloseHandle(b->lock);
    #else
-    pthread_join(f->thread, NULL);
-    sem_destroy(&f->sem);
+    sem_destroy(&b->lock);
    #endif
 
-    free(f);
+    free(b->stripes);
+    free(b);
 }
 
-const char* fios_file_get_last_error(fios_file_t* const f)
+const char* fios_bond_get_last_error(fios_bond_t* const b)
 {
-    assert_return(f != NULL, "null pointer");
+    assert_return(b != NULL, "null pointer");
 
-    return f->error != NULL ? f->error : "no error";
+    return b->error != NULL ? b->error : "no error";
 }
@@ -0,0 +1,220 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "libfios-lz.h"
+
+#include <string.h>
+
+// Compressed data is a series of sequences, each being:
+//  - a token byte, high nibble is literal length and low nibble is match length minus 4
+//  - extra literal length bytes if the nibble is 15, each adding up to 255 and ending on a byte < 255
+//  - literal bytes
+//  - match offset as 2 bytes, little-endian (not present in the last sequence, which only has literals)
+//  - extra match length bytes if the nibble is 15, same as for literals
+
+#define LZ_HASH_LOG 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+
+// keep some literals at the end, so matches never need to be checked against the end of input
+#define LZ_LAST_LITERALS 5
+#define LZ_MIN_INPUT 13
+
+static uint32_t _lz_read32(const uint8_t* const p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t _lz_hash(const uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+static uint8_t* _lz_write_length(uint8_t* op, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// write a sequence of literals followed by a match, or only literals when @a matchlength is 0
+static uint8_t* _lz_write_sequence(uint8_t* op,
+                                   uint8_t* const oend,
+                                   const uint8_t* const literals,
+                                   const size_t literallength,
+                                   const size_t offset,
+                                   const size_t matchlength)
+{
+    // worst case size for this sequence
+    const size_t needed = 1 + literallength / 255 + 1 + literallength + 2 + matchlength / 255 + 1;
+
+    if (needed > (size_t)(oend - op))
+        return NULL;
+
+    uint8_t* const token = op++;
+
+    if (literallength >= 15)
+    {
+        *token = 15 << 4;
+        op = _lz_write_length(op, literallength - 15);
+    }
+    else
+    {
+        *token = (uint8_t)(literallength << 4);
+    }
+
+    memcpy(op, literals, literallength);
+    op += literallength;
+
+    if (matchlength == 0)
+        return op;
+
+    *op++ = offset & 0xff;
+    *op++ = (offset >> 8) & 0xff;
+
+    if (matchlength - LZ_MIN_MATCH >= 15)
+    {
+        *token |= 15;
+        op = _lz_write_length(op, matchlength - LZ_MIN_MATCH - 15);
+    }
+    else
+    {
+        *token |= (uint8_t)(matchlength - LZ_MIN_MATCH);
+    }
+
+    return op;
+}
+
+size_t fios_lz_compress(const uint8_t* const src, const size_t srcsize, uint8_t* const dst, const size_t dstcapacity)
+{
+    uint32_t table[1 << LZ_HASH_LOG];
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const iend = src + srcsize;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dstcapacity;
+
+    if (srcsize >= LZ_MIN_INPUT)
+    {
+        const uint8_t* const matchlimit = iend - LZ_LAST_LITERALS;
+        const uint8_t* const mflimit = iend - (LZ_MIN_INPUT - 1);
+
+        memset(table, 0, sizeof(table));
+
+        while (ip < mflimit)
+        {
+            const uint32_t sequence = _lz_read32(ip);
+            const uint32_t h = _lz_hash(sequence);
+            const uint8_t* const ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || _lz_read32(ref) != sequence)
+            {
+                ++ip;
+                continue;
+            }
+
+            size_t matchlength = LZ_MIN_MATCH;
+            while (ip + matchlength < matchlimit && ref[matchlength] == ip[matchlength])
+                ++matchlength;
+
+            op = _lz_write_sequence(op, oend, anchor, ip - anchor, ip - ref, matchlength);
+
+            if (op == NULL)
+                return 0;
+
+            ip += matchlength;
+            anchor = ip;
+        }
+    }
+
+    op = _lz_write_sequence(op, oend, anchor, iend - anchor, 0, 0);
+
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+static bool _lz_read_length(const uint8_t** const ip, const uint8_t* const iend, size_t* const length)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= iend)
+            return false;
+
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+
+    return true;
+}
+
+bool fios_lz_decompress(const uint8_t* const src,
+                        const size_t srcsize,
+                        uint8_t* const dst,
+                        const size_t dstcapacity,
+                        size_t* const dstsize)
+{
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + srcsize;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dstcapacity;
+
+    while (ip < iend)
+    {
+        const uint8_t token = *ip++;
+
+        size_t literallength = token >> 4;
+        if (literallength == 15 && ! _lz_read_length(&ip, iend, &literallength))
+            return false;
+
+        if (literallength > (size_t)(iend - ip) || literallength > (size_t)(oend - op))
+            return false;
+
+        memcpy(op, ip, literallength);
+        op += literallength;
+        ip += literallength;
+
+        // last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return false;
+
+        size_t matchlength = token & 15;
+        if (matchlength == 15 && ! _lz_read_length(&ip, iend, &matchlength))
+            return false;
+
+        matchlength += LZ_MIN_MATCH;
+
+        if (matchlength > (size_t)(oend - op))
+            return false;
+
+        const uint8_t* match = op - offset;
+
+        // matches can overlap with their own output, which repeats the pattern
+        if (offset >= matchlength)
+        {
+            memcpy(op, match, matchlength);
+            op += matchlength;
+        }
+        else
+        {
+            for (size_t i = 0; i < matchlength; ++i)
+                *op++ = *match++;
+        }
+    }
+
+    *dstsize = op - dst;
+    return true;
+}
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+/*! compress @a srcsize bytes from @a src into @a dst, using a small LZ77 codec in the style of LZ4 blocks
+ * each call is independent, there is no state shared between blocks
+ * returns the compressed size, or 0 if the result does not fit in @a dstcapacity bytes
+ */
+size_t fios_lz_compress(const uint8_t* src, size_t srcsize, uint8_t* dst, size_t dstcapacity);
+
+/*! decompress @a srcsize bytes from @a src into @a dst, which has space for @a dstcapacity bytes
+ * input is fully validated, so corrupt or malicious data never reads or writes out of bounds
+ * returns false if the data is invalid or does not fit, otherwise the decompressed size is stored in @a dstsize
+ */
+bool fios_lz_decompress(const uint8_t* src, size_t srcsize, uint8_t* dst, size_t dstcapacity, size_t* dstsize);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,540 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "libfios-mux.h"
+#include "libfios-task.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define DEBUG_PRINT(...)
+// #define DEBUG_PRINT(...) printf(__VA_ARGS__)
+
+// Once multiplexing starts, everything on the serial port is a binary frame with checksums, using the channel field:
+//  - 'x' carries channel data as its payload
+//  - 'k' gives back credit to the peer, with the amount of channel data read since the last one as sequence number
+// Each side starts with FIOS_MUX_BUFFER_SIZE bytes of credit per channel, so data never needs to wait for
+// a channel to be opened on the other side, and a slow channel never holds back the others.
+
+typedef struct {
+    // virtual serial port handed out for the channel, null when not open
+    fios_serial_t* serial;
+    bool cancelled;
+    // received data, allocated once the first frame for the channel arrives
+    uint8_t* rxbuf;
+    uint32_t rxpos, rxlen;
+    // data read by the channel but not yet given back as credit
+    uint32_t consumed;
+    // data that can still be sent to the peer
+    uint32_t credit;
+} _fios_mux_channel_t;
+
+struct _fios_mux_t {
+    fios_serial_t* serial;
+    _fios_mux_channel_t channels[MAX_MUX_CHANNELS];
+    // set when the serial port fails, or when receiving something that is not valid multiplexed data
+    bool failed;
+    // set by fios_mux_close, so that the serial port stopping is not reported as a failure
+    bool closing;
+    // writers take a ticket and wait for their turn, so that channels get the serial port in the order they asked for it
+    uint32_t ticket, serving;
+   #ifdef _WIN32
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+    HANDLE reader;
+   #else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t reader;
+   #endif
+};
+
+static void _fios_mux_lock(fios_mux_t* const m)
+{
+   #ifdef _WIN32
+    AcquireSRWLockExclusive(&m->lock);
+   #else
+    pthread_mutex_lock(&m->lock);
+   #endif
+}
+
+static void _fios_mux_unlock(fios_mux_t* const m)
+{
+   #ifdef _WIN32
+    ReleaseSRWLockExclusive(&m->lock);
+   #else
+    pthread_mutex_unlock(&m->lock);
+   #endif
+}
+
+static void _fios_mux_broadcast(fios_mux_t* const m)
+{
+   #ifdef _WIN32
+    WakeAllConditionVariable(&m->cond);
+   #else
+    pthread_cond_broadcast(&m->cond);
+   #endif
+}
+
+// wait for a change of state, with the lock held, returns false once @a timeout_ms is over when not negative
+static bool _fios_mux_wait(fios_mux_t* const m, const int timeout_ms)
+{
+   #ifdef _WIN32
+    return SleepConditionVariableSRW(&m->cond, &m->lock, timeout_ms >= 0 ? (DWORD)timeout_ms : INFINITE, 0) != FALSE;
+   #else
+    if (timeout_ms < 0)
+        return pthread_cond_wait(&m->cond, &m->lock) == 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait(&m->cond, &m->lock, &ts) == 0;
+   #endif
+}
+
+static void _fios_mux_fail(fios_mux_t* const m, const char* const error)
+{
+    _fios_mux_lock(m);
+
+    const bool failed = m->failed;
+
+    if (! failed)
+    {
+        if (! m->closing)
+            fprintf(stderr, "fios: %s, multiplexing stopped\n", error);
+
+        m->failed = true;
+    }
+
+    _fios_mux_broadcast(m);
+    _fios_mux_unlock(m);
+
+    // wake up any channel blocked writing into the serial port, nothing else can be sent on it anyway
+    if (! failed)
+        fios_serial_cancel(m->serial);
+}
+
+// write a frame once it is our turn, frames from other channels written in between are what interleaves them
+static bool _fios_mux_write_frame(fios_mux_t* const m, const fios_frame_t* const frame, const void* const payload)
+{
+    _fios_mux_lock(m);
+
+    const uint32_t ticket = m->ticket++;
+
+    while (m->serving != ticket)
+        _fios_mux_wait(m, -1);
+
+    const bool failed = m->failed;
+    _fios_mux_unlock(m);
+
+    const bool ok = ! failed && fios_serial_write_frame(m->serial, frame, payload, true);
+
+    _fios_mux_lock(m);
+    ++m->serving;
+    _fios_mux_broadcast(m);
+    _fios_mux_unlock(m);
+
+    if (! ok && ! failed)
+        _fios_mux_fail(m, "serial port operation failed");
+
+    return ok;
+}
+
+// receive frames from the serial port, storing channel data and credit as they arrive
+static bool _fios_mux_receive(fios_mux_t* const m)
+{
+    uint8_t payload[FIOS_MUX_FRAME_SIZE];
+    fios_frame_t frame;
+    bool valid;
+
+    if (! fios_serial_read_frame(m->serial, &frame, true, &valid))
+        return false;
+
+    if (! valid || frame.channel >= MAX_MUX_CHANNELS || frame.length > FIOS_MUX_FRAME_SIZE)
+    {
+        _fios_mux_fail(m, "unexpected data received (invalid multiplexed frame)");
+        return false;
+    }
+
+    if (! fios_serial_read_frame_payload(m->serial, &frame, payload, true, &valid))
+        return false;
+
+    if (! valid)
+    {
+        _fios_mux_fail(m, "unexpected data received (damaged multiplexed frame)");
+        return false;
+    }
+
+    _fios_mux_channel_t* const ch = &m->channels[frame.channel];
+    const char* error = NULL;
+
+    _fios_mux_lock(m);
+
+    switch (frame.type)
+    {
+    case 'x':
+        if (ch->rxbuf == NULL && (ch->rxbuf = malloc(FIOS_MUX_BUFFER_SIZE)) == NULL)
+        {
+            error = "out of memory";
+            break;
+        }
+
+        // the peer never sends more than the credit it was given
+        if (frame.length > FIOS_MUX_BUFFER_SIZE - ch->rxlen)
+        {
+            error = "unexpected data received (multiplexed channel overflow)";
+            break;
+        }
+
+        for (uint32_t i = 0, pos = (ch->rxpos + ch->rxlen) % FIOS_MUX_BUFFER_SIZE; i < frame.length; ++i)
+        {
+            ch->rxbuf[pos] = payload[i];
+            pos = (pos + 1) % FIOS_MUX_BUFFER_SIZE;
+        }
+
+        ch->rxlen += frame.length;
+        break;
+
+    case 'k':
+        ch->credit += frame.seq;
+        break;
+
+    default:
+        error = "unexpected data received (invalid multiplexed frame)";
+        break;
+    }
+
+    _fios_mux_broadcast(m);
+    _fios_mux_unlock(m);
+
+    if (error != NULL)
+    {
+        _fios_mux_fail(m, error);
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall _fios_mux_reader(void* const arg)
+#else
+static void* _fios_mux_reader(void* const arg)
+#endif
+{
+    fios_mux_t* const m = arg;
+
+    while (_fios_mux_receive(m)) {}
+
+    // the serial port was cancelled or failed, nothing else arrives from here on
+    _fios_mux_fail(m, "serial port closed");
+
+   #ifdef _WIN32
+    _endthreadex(0);
+    return 0;
+   #else
+    return NULL;
+   #endif
+}
+
+static bool _fios_mux_channel_read(fios_serial_t* const s, uint8_t* const buffer, const uint32_t size, const int timeout_ms)
+{
+    fios_mux_t* const m = s->mux;
+    _fios_mux_channel_t* const ch = &m->channels[s->channel];
+    uint32_t credit = 0;
+    bool ok = true;
+
+    _fios_mux_lock(m);
+
+    for (uint32_t r = 0; r < size;)
+    {
+        if (ch->cancelled)
+        {
+            ok = false;
+            break;
+        }
+
+        if (ch->rxlen == 0)
+        {
+            // data that already arrived is still delivered after a failure
+            if (m->failed || ! _fios_mux_wait(m, timeout_ms))
+            {
+                ok = false;
+                break;
+            }
+
+            continue;
+        }
+
+        const uint32_t contiguous = FIOS_MUX_BUFFER_SIZE - ch->rxpos;
+        uint32_t r2 = size - r < ch->rxlen ? size - r : ch->rxlen;
+
+        if (r2 > contiguous)
+            r2 = contiguous;
+
+        memcpy(buffer + r, ch->rxbuf + ch->rxpos, r2);
+        ch->rxpos = (ch->rxpos + r2) % FIOS_MUX_BUFFER_SIZE;
+        ch->rxlen -= r2;
+        ch->consumed += r2;
+        r += r2;
+    }
+
+    // give credit back in batches, or right away once the peer would otherwise run out of it
+    if (ch->consumed >= FIOS_MUX_BUFFER_SIZE / 4)
+    {
+        credit = ch->consumed;
+        ch->consumed = 0;
+    }
+
+    _fios_mux_unlock(m);
+
+    if (credit != 0)
+    {
+        DEBUG_PRINT("_fios_mux_channel_read channel %u giving back %u bytes of credit\n", s->channel, credit);
+
+        const fios_frame_t frame = { .type = 'k', .channel = s->channel, .seq = credit };
+        _fios_mux_write_frame(m, &frame, NULL);
+    }
+
+    return ok;
+}
+
+static bool _fios_mux_channel_write(fios_serial_t* const s, const uint8_t* const buffers[], const uint32_t sizes[], const int count)
+{
+    fios_mux_t* const m = s->mux;
+    _fios_mux_channel_t* const ch = &m->channels[s->channel];
+    uint8_t payload[FIOS_MUX_FRAME_SIZE];
+    uint32_t total = 0;
+
+    for (int i = 0; i < count; ++i)
+        total += sizes[i];
+
+    // position in the buffers, carried over between frames
+    int index = 0;
+    uint32_t offset = 0;
+
+    for (uint32_t w = 0; w < total;)
+    {
+        _fios_mux_lock(m);
+
+        while (ch->credit == 0 && ! ch->cancelled && ! m->failed)
+            _fios_mux_wait(m, -1);
+
+        if (ch->cancelled || m->failed)
+        {
+            _fios_mux_unlock(m);
+            return false;
+        }
+
+        uint32_t length = total - w;
+
+        if (length > FIOS_MUX_FRAME_SIZE)
+            length = FIOS_MUX_FRAME_SIZE;
+        if (length > ch->credit)
+            length = ch->credit;
+
+        ch->credit -= length;
+        _fios_mux_unlock(m);
+
+        // gather the next frame worth of data, which can span several buffers
+        for (uint32_t p = 0; p < length;)
+        {
+            const uint32_t r = sizes[index] - offset < length - p ? sizes[index] - offset : length - p;
+
+            memcpy(payload + p, buffers[index] + offset, r);
+            p += r;
+            offset += r;
+
+            if (offset == sizes[index])
+            {
+                ++index;
+                offset = 0;
+            }
+        }
+
+        const fios_frame_t frame = { .type = 'x', .channel = s->channel, .length = length };
+
+        if (! _fios_mux_write_frame(m, &frame, payload))
+            return false;
+
+        w += length;
+    }
+
+    return true;
+}
+
+static void _fios_mux_channel_cancel(fios_serial_t* const s)
+{
+    fios_mux_t* const m = s->mux;
+
+    _fios_mux_lock(m);
+    m->channels[s->channel].cancelled = true;
+    _fios_mux_broadcast(m);
+    _fios_mux_unlock(m);
+}
+
+static void _fios_mux_channel_close(fios_serial_t* const s)
+{
+    fios_mux_t* const m = s->mux;
+    _fios_mux_channel_t* const ch = &m->channels[s->channel];
+
+    _fios_mux_lock(m);
+
+    // data nobody read is dropped, so that a channel opened again later does not start with leftovers,
+    // and given back as credit along with what was read, otherwise the peer could stall on the channel
+    const uint32_t credit = ch->consumed + ch->rxlen;
+    const bool failed = m->failed;
+
+    ch->cancelled = true;
+    ch->serial = NULL;
+    ch->rxpos = ch->rxlen = ch->consumed = 0;
+    _fios_mux_broadcast(m);
+    _fios_mux_unlock(m);
+
+    if (credit != 0 && ! failed)
+    {
+        DEBUG_PRINT("_fios_mux_channel_close channel %u giving back %u bytes of credit\n", s->channel, credit);
+
+        const fios_frame_t frame = { .type = 'k', .channel = s->channel, .seq = credit };
+        _fios_mux_write_frame(m, &frame, NULL);
+    }
+}
+
+const fios_transport_t fios_mux_transport = {
+    .read = _fios_mux_channel_read,
+    .write = _fios_mux_channel_write,
+    .cancel = _fios_mux_channel_cancel,
+    .close = _fios_mux_channel_close,
+};
+
+fios_mux_t* fios_mux_open(fios_serial_t* const s)
+{
+    assert_return(s != NULL, NULL);
+    assert_return(s->mux == NULL, NULL);
+
+    fios_mux_t* const m = calloc(1, sizeof(fios_mux_t));
+
+    if (m == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    m->serial = s;
+
+    for (unsigned int i = 0; i < MAX_MUX_CHANNELS; ++i)
+        m->channels[i].credit = FIOS_MUX_BUFFER_SIZE;
+
+   #ifdef _WIN32
+    InitializeSRWLock(&m->lock);
+    InitializeConditionVariable(&m->cond);
+
+    if (! fios_thread_create(&m->reader, _fios_mux_reader, m))
+    {
+        fprintf(stderr, "fios: failed to create multiplexing thread, error %d: %s\n",
+                GetLastError(), GetLastErrorString(GetLastError()));
+        free(m);
+        return NULL;
+    }
+   #else
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+
+    if (! fios_thread_create(&m->reader, _fios_mux_reader, m))
+    {
+        fprintf(stderr, "fios: failed to create multiplexing thread, error %d: %s\n", errno, strerror(errno));
+        pthread_cond_destroy(&m->cond);
+        pthread_mutex_destroy(&m->lock);
+        free(m);
+        return NULL;
+    }
+   #endif
+
+    return m;
+}
+
+fios_serial_t* fios_mux_open_channel(fios_mux_t* const m, const unsigned int channel)
+{
+    assert_return(m != NULL, NULL);
+    assert_return(channel < MAX_MUX_CHANNELS, NULL);
+
+    _fios_mux_channel_t* const ch = &m->channels[channel];
+    fios_serial_t* const s = calloc(1, sizeof(fios_serial_t));
+
+    if (s == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    s->transport = &fios_mux_transport;
+    s->mux = m;
+    s->channel = channel;
+    s->baudrate = m->serial->baudrate;
+   #ifdef _WIN32
+    s->h = INVALID_HANDLE_VALUE;
+   #else
+    s->fd = s->cancelfd[0] = s->cancelfd[1] = -1;
+   #endif
+
+    _fios_mux_lock(m);
+
+    if (ch->serial != NULL)
+    {
+        _fios_mux_unlock(m);
+        fprintf(stderr, "fios: multiplexed channel %u is already open\n", channel);
+        free(s);
+        return NULL;
+    }
+
+    ch->serial = s;
+    ch->cancelled = false;
+    _fios_mux_unlock(m);
+
+    return s;
+}
+
+void fios_mux_close(fios_mux_t* const m)
+{
+    assert_return(m != NULL,);
+
+    _fios_mux_lock(m);
+    m->closing = true;
+    _fios_mux_unlock(m);
+
+    // the reader thread only stops once the serial port does
+    fios_serial_cancel(m->serial);
+
+   #ifdef _WIN32
+    WaitForSingleObject(m->reader, INFINITE);
+    CloseHandle(m->reader);
+   #else
+    pthread_join(m->reader, NULL);
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->lock);
+   #endif
+
+    for (unsigned int i = 0; i < MAX_MUX_CHANNELS; ++i)
+        free(m->channels[i].rxbuf);
+
+    free(m);
+}
@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "libfios-serial.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! largest amount of channel data carried by a single multiplexed frame
+ * channels with data to send take turns, one frame each, so this bounds how long any of them waits for the others
+ */
+#define FIOS_MUX_FRAME_SIZE 0x400
+
+/*! size of the receive buffer of each channel, which is also the amount the peer can send before waiting for credit
+ */
+#define FIOS_MUX_BUFFER_SIZE 0x10000
+
+/*! I/O of multiplexed channels, which goes through the multiplexer set in the serial port
+ */
+extern const fios_transport_t fios_mux_transport;
+
+#ifdef __cplusplus
+}
+#endif
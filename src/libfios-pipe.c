@@ -0,0 +1,285 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "libfios-serial.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define DEBUG_PRINT(...)
+// #define DEBUG_PRINT(...) printf(__VA_ARGS__)
+
+// Each end of a pipe reads from its own buffer and writes into the one of the other end.
+// Writers wait while the buffer they write into is full, so a pipe behaves like a serial port with flow control.
+
+/*! size of the buffer of each direction of an in-memory pipe
+ */
+#define FIOS_PIPE_BUFFER_SIZE 0x10000
+
+typedef struct {
+    fios_serial_t* serial;
+    bool cancelled;
+    // data waiting to be read by this end
+    uint8_t rxbuf[FIOS_PIPE_BUFFER_SIZE];
+    uint32_t rxpos, rxlen;
+} _fios_pipe_end_t;
+
+struct _fios_pipe_t {
+    _fios_pipe_end_t ends[2];
+   #ifdef _WIN32
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+   #else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+   #endif
+};
+
+typedef struct _fios_pipe_t fios_pipe_t;
+
+static void _fios_pipe_lock(fios_pipe_t* const p)
+{
+   #ifdef _WIN32
+    AcquireSRWLockExclusive(&p->lock);
+   #else
+    pthread_mutex_lock(&p->lock);
+   #endif
+}
+
+static void _fios_pipe_unlock(fios_pipe_t* const p)
+{
+   #ifdef _WIN32
+    ReleaseSRWLockExclusive(&p->lock);
+   #else
+    pthread_mutex_unlock(&p->lock);
+   #endif
+}
+
+static void _fios_pipe_broadcast(fios_pipe_t* const p)
+{
+   #ifdef _WIN32
+    WakeAllConditionVariable(&p->cond);
+   #else
+    pthread_cond_broadcast(&p->cond);
+   #endif
+}
+
+// wait for a change of state, with the lock held, returns false once @a timeout_ms is over when not negative
+static bool _fios_pipe_wait(fios_pipe_t* const p, const int timeout_ms)
+{
+   #ifdef _WIN32
+    return SleepConditionVariableSRW(&p->cond, &p->lock, timeout_ms >= 0 ? (DWORD)timeout_ms : INFINITE, 0) != FALSE;
+   #else
+    if (timeout_ms < 0)
+        return pthread_cond_wait(&p->cond, &p->lock) == 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait(&p->cond, &p->lock, &ts) == 0;
+   #endif
+}
+
+static bool _fios_pipe_read(fios_serial_t* const s, uint8_t* const buffer, const uint32_t size, const int timeout_ms)
+{
+    fios_pipe_t* const p = s->pipe;
+    _fios_pipe_end_t* const end = &p->ends[s->end];
+    const _fios_pipe_end_t* const peer = &p->ends[! s->end];
+    bool ok = true;
+
+    _fios_pipe_lock(p);
+
+    for (uint32_t r = 0; r < size;)
+    {
+        if (end->cancelled)
+        {
+            ok = false;
+            break;
+        }
+
+        if (end->rxlen == 0)
+        {
+            // nothing else arrives once the other end is gone, like a hangup
+            if (peer->serial == NULL || ! _fios_pipe_wait(p, timeout_ms))
+            {
+                ok = false;
+                break;
+            }
+
+            continue;
+        }
+
+        const uint32_t contiguous = FIOS_PIPE_BUFFER_SIZE - end->rxpos;
+        uint32_t r2 = size - r < end->rxlen ? size - r : end->rxlen;
+
+        if (r2 > contiguous)
+            r2 = contiguous;
+
+        memcpy(buffer + r, end->rxbuf + end->rxpos, r2);
+        end->rxpos = (end->rxpos + r2) % FIOS_PIPE_BUFFER_SIZE;
+        end->rxlen -= r2;
+        r += r2;
+
+        // wake up the other end if it was waiting for room to write
+        _fios_pipe_broadcast(p);
+    }
+
+    _fios_pipe_unlock(p);
+
+    _fios_counter_add(&s->reads, 1);
+    DEBUG_PRINT("_fios_pipe_read end %u size %u ok %d\n", s->end, size, ok);
+    return ok;
+}
+
+static bool _fios_pipe_write(fios_serial_t* const s, const uint8_t* const buffers[], const uint32_t sizes[], const int count)
+{
+    fios_pipe_t* const p = s->pipe;
+    const _fios_pipe_end_t* const end = &p->ends[s->end];
+    _fios_pipe_end_t* const peer = &p->ends[! s->end];
+    bool ok = true;
+
+    _fios_pipe_lock(p);
+
+    for (int i = 0; i < count && ok; ++i)
+    {
+        for (uint32_t w = 0; w < sizes[i];)
+        {
+            if (end->cancelled || peer->serial == NULL)
+            {
+                ok = false;
+                break;
+            }
+
+            if (peer->rxlen == FIOS_PIPE_BUFFER_SIZE)
+            {
+                _fios_pipe_wait(p, -1);
+                continue;
+            }
+
+            const uint32_t tail = (peer->rxpos + peer->rxlen) % FIOS_PIPE_BUFFER_SIZE;
+            const uint32_t contiguous = tail >= peer->rxpos ? FIOS_PIPE_BUFFER_SIZE - tail : peer->rxpos - tail;
+            uint32_t w2 = sizes[i] - w;
+
+            if (w2 > contiguous)
+                w2 = contiguous;
+
+            memcpy(peer->rxbuf + tail, buffers[i] + w, w2);
+            peer->rxlen += w2;
+            w += w2;
+
+            _fios_pipe_broadcast(p);
+        }
+    }
+
+    _fios_pipe_unlock(p);
+
+    _fios_counter_add(&s->writes, 1);
+    DEBUG_PRINT("_fios_pipe_write end %u ok %d\n", s->end, ok);
+    return ok;
+}
+
+static void _fios_pipe_cancel(fios_serial_t* const s)
+{
+    fios_pipe_t* const p = s->pipe;
+
+    _fios_pipe_lock(p);
+    p->ends[s->end].cancelled = true;
+    _fios_pipe_broadcast(p);
+    _fios_pipe_unlock(p);
+}
+
+static void _fios_pipe_close(fios_serial_t* const s)
+{
+    fios_pipe_t* const p = s->pipe;
+
+    _fios_pipe_lock(p);
+    p->ends[s->end].cancelled = true;
+    p->ends[s->end].serial = NULL;
+    const bool last = p->ends[! s->end].serial == NULL;
+    _fios_pipe_broadcast(p);
+    _fios_pipe_unlock(p);
+
+    // whichever end is closed last frees the pipe
+    if (last)
+    {
+       #ifndef _WIN32
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+       #endif
+        free(p);
+    }
+}
+
+static const fios_transport_t _fios_pipe_transport = {
+    .read = _fios_pipe_read,
+    .write = _fios_pipe_write,
+    .cancel = _fios_pipe_cancel,
+    .close = _fios_pipe_close,
+};
+
+bool fios_serial_open_pipe(fios_serial_t** const a, fios_serial_t** const b)
+{
+    assert_return(a != NULL, false);
+    assert_return(b != NULL, false);
+
+    fios_pipe_t* const p = calloc(1, sizeof(fios_pipe_t));
+    fios_serial_t* const s1 = calloc(1, sizeof(fios_serial_t));
+    fios_serial_t* const s2 = calloc(1, sizeof(fios_serial_t));
+
+    if (p == NULL || s1 == NULL || s2 == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        free(p);
+        free(s1);
+        free(s2);
+        return false;
+    }
+
+   #ifdef _WIN32
+    InitializeSRWLock(&p->lock);
+    InitializeConditionVariable(&p->cond);
+   #else
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+   #endif
+
+    fios_serial_t* const serials[2] = { s1, s2 };
+
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        fios_serial_t* const s = serials[i];
+
+        s->transport = &_fios_pipe_transport;
+        s->pipe = p;
+        s->end = i;
+        s->baudrate = DEFAULT_BAUDRATE;
+       #ifdef _WIN32
+        s->h = INVALID_HANDLE_VALUE;
+       #else
+        s->fd = s->cancelfd[0] = s->cancelfd[1] = -1;
+       #endif
+
+        p->ends[i].serial = s;
+    }
+
+    *a = s1;
+    *b = s2;
+    return true;
+}
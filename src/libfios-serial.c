@@ -1,7 +1,13 @@
 // SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
 // SPDX-License-Identifier: ISC
 
+#ifdef __linux__
+#define _GNU_SOURCE // for pipe2
+#endif
+
+#include "libfios-crc32.h"
 #include "libfios-serial.h"
+#include "libfios-task.h"
 #include "utils.h"
 
 #include <stdlib.h>
@@ -13,9 +19,21 @@
 #else
 #include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef __APPLE__
+#include <IOKit/serial/ioss.h>
+#endif
 #endif
 
 typedef struct {
@@ -26,6 +44,8 @@ typedef struct {
 #define DEBUG_PRINT(...)
 // #define DEBUG_PRINT(...) printf(__VA_ARGS__)
 
+static bool _fios_serial_negotiate(fios_serial_t* s, const fios_serial_options_t* options);
+
 #ifdef _WIN32
 
 const char* GetLastErrorString(const short error)
@@ -169,11 +189,400 @@ static void _print_flags(const char* const name, const unsigned optflags, const
     if (test != 0)
         fprintf(stderr, "fios: unknown termios %s 0o%o\n", name, test);
 }
+
+#if defined(__linux__) && defined(TCGETS2)
+// glibc does not expose termios2, which is needed for arbitrary baud rates through BOTHER
+// NOTE this matches the asm-generic layout, used by all common architectures
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
+// returns B0 if the rate does not have a standard termios speed value
+static speed_t _fios_standard_speed(const unsigned int baudrate)
+{
+    switch (baudrate)
+    {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+   #ifdef B460800
+    case 460800: return B460800;
+   #endif
+   #ifdef B500000
+    case 500000: return B500000;
+   #endif
+   #ifdef B576000
+    case 576000: return B576000;
+   #endif
+   #ifdef B921600
+    case 921600: return B921600;
+   #endif
+   #ifdef B1000000
+    case 1000000: return B1000000;
+   #endif
+   #ifdef B1152000
+    case 1152000: return B1152000;
+   #endif
+   #ifdef B1500000
+    case 1500000: return B1500000;
+   #endif
+   #ifdef B2000000
+    case 2000000: return B2000000;
+   #endif
+   #ifdef B2500000
+    case 2500000: return B2500000;
+   #endif
+   #ifdef B3000000
+    case 3000000: return B3000000;
+   #endif
+   #ifdef B3500000
+    case 3500000: return B3500000;
+   #endif
+   #ifdef B4000000
+    case 4000000: return B4000000;
+   #endif
+    }
+
+    return B0;
+}
+
+// set a baud rate without a standard termios speed value, after the other attributes are set
+static bool _fios_set_custom_baudrate(const int fd, const unsigned int baudrate)
+{
+   #if defined(__linux__) && defined(TCGETS2)
+    struct termios2 options2;
+
+    if (ioctl(fd, TCGETS2, &options2) != 0)
+        return false;
+
+    options2.c_cflag &= ~CBAUD;
+    options2.c_cflag |= BOTHER;
+    options2.c_ispeed = baudrate;
+    options2.c_ospeed = baudrate;
+
+    return ioctl(fd, TCSETS2, &options2) == 0;
+   #elif defined(__APPLE__)
+    const speed_t speed = baudrate;
+    return ioctl(fd, IOSSIOSPEED, &speed) == 0;
+   #else
+    // unused
+    (void)fd;
+    (void)baudrate;
+
+    errno = EINVAL;
+    return false;
+   #endif
+}
+#endif
+
+// device paths like "tcp://host:port" and "unix:/path" are sockets instead of serial ports,
+// with "tcp-listen://[host]:port" and "unix-listen:/path" waiting for the other side to connect instead
+static bool _fios_is_socket_path(const char* const devpath)
+{
+    return strncmp(devpath, "tcp://", 6) == 0 || strncmp(devpath, "unix:", 5) == 0
+        || strncmp(devpath, "tcp-listen://", 13) == 0 || strncmp(devpath, "unix-listen:", 12) == 0;
+}
+
+#ifndef _WIN32
+// fill a Unix socket address for @a path, returning false if it does not fit
+static bool _fios_socket_unix_address(const char* const path, struct sockaddr_un* const addr)
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "fios: socket path '%s' is too long\n", path);
+        return false;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+// resolve the "host:port" @a address of @a devpath, with IPv6 addresses written in brackets
+// when @a passive the host can be left empty to listen on all addresses
+static struct addrinfo* _fios_socket_resolve(const char* const devpath, const char* const address, const bool passive)
+{
+    const char* const colon = strrchr(address, ':');
+    char host[256];
+
+    if (colon == NULL || (colon == address && ! passive) || colon[1] == '\0' || (size_t)(colon - address) >= sizeof(host))
+    {
+        fprintf(stderr, "fios: invalid address '%s', expected %s\n",
+                devpath, passive ? "tcp-listen://[host]:port" : "tcp://host:port");
+        return NULL;
+    }
+
+    size_t len = colon - address;
+    memcpy(host, address, len);
+    host[len] = '\0';
+
+    if (len > 2 && host[0] == '[' && host[len - 1] == ']')
+    {
+        len -= 2;
+        memmove(host, host + 1, len);
+        host[len] = '\0';
+    }
+
+    const struct addrinfo hints = {
+        .ai_flags = passive ? AI_PASSIVE : 0,
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo* info = NULL;
+    const int ret = getaddrinfo(len != 0 ? host : NULL, colon + 1, &hints, &info);
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "fios: failed to resolve '%s', error: %s\n", devpath, gai_strerror(ret));
+        return NULL;
+    }
+
+    return info;
+}
+
+// connect to a TCP or Unix socket, returning -1 on failure
+static int _fios_socket_connect(const char* const devpath)
+{
+    if (strncmp(devpath, "unix:", 5) == 0)
+    {
+        struct sockaddr_un addr;
+
+        if (! _fios_socket_unix_address(devpath + 5, &addr))
+            return -1;
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0 || connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            fprintf(stderr, "fios: failed to connect to '%s', error %d: %s\n", devpath, errno, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    struct addrinfo* const info = _fios_socket_resolve(devpath, devpath + 6, false);
+
+    if (info == NULL)
+        return -1;
+
+    int fd = -1;
+    int error = 0;
+
+    for (const struct addrinfo* ai = info; ai != NULL && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            error = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(info);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "fios: failed to connect to '%s', error %d: %s\n", devpath, error, strerror(error));
+        return -1;
+    }
+
+    // commands and acknowledgements are small, they must not wait for more data to be sent along
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+// listen on a TCP or Unix socket and wait for a single connection, returning -1 on failure
+// the listening socket is closed once the other side connected, so nothing else can connect afterwards
+static int _fios_socket_accept(const char* const devpath)
+{
+    const bool local = strncmp(devpath, "unix-listen:", 12) == 0;
+    int listenfd = -1;
+    int error = 0;
+    struct sockaddr_un addr;
+
+    if (local)
+    {
+        if (! _fios_socket_unix_address(devpath + 12, &addr))
+            return -1;
+
+        // a socket left behind by a previous listener would make binding fail, other kinds of files are kept
+        struct stat st;
+        if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(addr.sun_path);
+
+        listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (listenfd >= 0 && (bind(listenfd, (const struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenfd, 1) != 0))
+        {
+            error = errno;
+            close(listenfd);
+            listenfd = -1;
+        }
+        else if (listenfd < 0)
+        {
+            error = errno;
+        }
+    }
+    else
+    {
+        struct addrinfo* const info = _fios_socket_resolve(devpath, devpath + 13, true);
+
+        if (info == NULL)
+            return -1;
+
+        for (const struct addrinfo* ai = info; ai != NULL && listenfd < 0; ai = ai->ai_next)
+        {
+            listenfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+            if (listenfd < 0)
+            {
+                error = errno;
+                continue;
+            }
+
+            // allow listening again right away on the same port after a previous connection was closed
+            const int one = 1;
+            setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+            if (bind(listenfd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(listenfd, 1) != 0)
+            {
+                error = errno;
+                close(listenfd);
+                listenfd = -1;
+            }
+        }
+
+        freeaddrinfo(info);
+    }
+
+    if (listenfd < 0)
+    {
+        fprintf(stderr, "fios: failed to listen on '%s', error %d: %s\n", devpath, error, strerror(error));
+        return -1;
+    }
+
+    int fd;
+    do {
+        fd = accept(listenfd, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+
+    error = errno;
+    close(listenfd);
+
+    if (local)
+        unlink(addr.sun_path);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "fios: failed to accept a connection on '%s', error %d: %s\n", devpath, error, strerror(error));
+        return -1;
+    }
+
+    if (! local)
+    {
+        // commands and acknowledgements are small, they must not wait for more data to be sent along
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+}
+
+// open a socket, which is then used like a serial port without any of the termios setup
+static fios_serial_t* _fios_socket_open(const char* const devpath, const unsigned int baudrate)
+{
+    fios_serial_t* const s = calloc(1, sizeof(fios_serial_t));
+
+    if (s == NULL)
+        return NULL;
+
+    const int fd = strncmp(devpath, "tcp-listen://", 13) == 0 || strncmp(devpath, "unix-listen:", 12) == 0
+                 ? _fios_socket_accept(devpath)
+                 : _fios_socket_connect(devpath);
+
+    if (fd < 0)
+        goto error_free;
+
+   #ifdef SO_NOSIGPIPE
+    // a closed connection must fail writes instead of raising SIGPIPE, done per write where this is not available
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+   #endif
+
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        fprintf(stderr, "fios: failed to set socket flags, error %d: %s\n", errno, strerror(errno));
+        goto error_close;
+    }
+
+    if (! fios_serial_pipe(s->cancelfd, 0))
+    {
+        fprintf(stderr, "fios: failed to create serial port cancel pipe, error %d: %s\n", errno, strerror(errno));
+        goto error_close;
+    }
+
+    s->devpath = strdup(devpath);
+    s->baudrate = baudrate;
+    s->fd = fd;
+    s->socket = true;
+    return s;
+
+error_close:
+    close(fd);
+
+error_free:
+    free(s);
+    return NULL;
+}
 #endif
 
 fios_serial_t* fios_serial_open(const char* const devpath)
 {
-    fios_serial_t* const s = malloc(sizeof(fios_serial_t));
+    return fios_serial_open_ex(devpath, NULL);
+}
+
+fios_serial_t* fios_serial_open_ex(const char* const devpath, const fios_serial_options_t* const options)
+{
+    const unsigned int baudrate = options != NULL && options->baudrate != 0 ? options->baudrate : DEFAULT_BAUDRATE;
+
+    // sockets have no line speed to negotiate, the peer is reached at full speed right away
+    if (_fios_is_socket_path(devpath))
+    {
+       #ifdef _WIN32
+        fprintf(stderr, "fios: sockets are not supported on Windows, cannot open '%s'\n", devpath);
+        return NULL;
+       #else
+        return _fios_socket_open(devpath, baudrate);
+       #endif
+    }
+
+    fios_serial_t* const s = calloc(1, sizeof(fios_serial_t));
 
     if (s == NULL)
         return NULL;
@@ -198,7 +607,7 @@ fios_serial_t* fios_serial_open(const char* const devpath)
         goto error_close;
     }
 
-    params.BaudRate = CBR_115200;
+    params.BaudRate = baudrate;
     params.fBinary = TRUE;
     params.fParity = FALSE;
     params.fOutxCtsFlow = FALSE;
@@ -256,7 +665,7 @@ fios_serial_t* fios_serial_open(const char* const devpath)
     s->devpath = _strdup(devpath);
     s->h = h;
 #else
-    const int fd = open(devpath, O_RDWR | O_NONBLOCK | O_NOCTTY);
+    const int fd = open(devpath, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
 
     if (fd < 0)
     {
@@ -264,54 +673,62 @@ fios_serial_t* fios_serial_open(const char* const devpath)
         goto error_free;
     }
 
-    struct termios options = { 0 };
-    tcgetattr(fd, &options);
+    struct termios attrs = { 0 };
+    tcgetattr(fd, &attrs);
 
-    options.c_cflag &= ~CSIZE;
-    options.c_cflag |= CS8;
+    attrs.c_cflag &= ~CSIZE;
+    attrs.c_cflag |= CS8;
 
     fprintf(stderr,
             "fios: debug termios config: c_iflag 0o%lo, c_oflag 0o%lo, c_lflag 0o%lo, c_cflag 0o%lo\n",
-            (unsigned long)options.c_iflag,
-            (unsigned long)options.c_oflag,
-            (unsigned long)options.c_lflag,
-            (unsigned long)options.c_cflag);
+            (unsigned long)attrs.c_iflag,
+            (unsigned long)attrs.c_oflag,
+            (unsigned long)attrs.c_lflag,
+            (unsigned long)attrs.c_cflag);
 
     // do not modify input
-    options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | INPCK | ISTRIP | INLCR | IGNCR | ICRNL | IUCLC | IXON | IXANY | IXOFF | IMAXBEL | IUTF8);
-    options.c_iflag |= IGNPAR;
+    attrs.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | INPCK | ISTRIP | INLCR | IGNCR | ICRNL | IUCLC | IXON | IXANY | IXOFF | IMAXBEL | IUTF8);
+    attrs.c_iflag |= IGNPAR;
 
     // do not modify output
-    options.c_oflag &= ~(OPOST | OLCUC | ONLCR | OCRNL | ONLRET | OFILL);
-    options.c_oflag |= ONOCR;
+    attrs.c_oflag &= ~(OPOST | OLCUC | ONLCR | OCRNL | ONLRET | OFILL);
+    attrs.c_oflag |= ONOCR;
 
     // raw mode
-    options.c_lflag &= ~(ISIG | ICANON | ECHO | ECHOE | ECHOK | ECHONL | TOSTOP | ECHOCTL | ECHOPRT | ECHOKE | IEXTEN | EXTPROC);
-    options.c_cflag &= ~(CSTOPB | CRTSCTS | PARENB | PARODD | HUPCL);
+    attrs.c_lflag &= ~(ISIG | ICANON | ECHO | ECHOE | ECHOK | ECHONL | TOSTOP | ECHOCTL | ECHOPRT | ECHOKE | IEXTEN | EXTPROC);
+    attrs.c_cflag &= ~(CSTOPB | CRTSCTS | PARENB | PARODD | HUPCL);
 
-    print_flags("c_iflag", options.c_iflag, k_termios_iflags);
-    print_flags("c_oflag", options.c_oflag, k_termios_oflags);
-    print_flags("c_lflag", options.c_lflag, k_termios_lflags);
-    print_flags("c_cflag", options.c_cflag, k_termios_cflags);
+    print_flags("c_iflag", attrs.c_iflag, k_termios_iflags);
+    print_flags("c_oflag", attrs.c_oflag, k_termios_oflags);
+    print_flags("c_lflag", attrs.c_lflag, k_termios_lflags);
+    print_flags("c_cflag", attrs.c_cflag, k_termios_cflags);
     fflush(stdout);
 
     // no timeout
-    options.c_cc[VTIME] = 0;
-    options.c_cc[VMIN] = 1;
+    attrs.c_cc[VTIME] = 0;
+    attrs.c_cc[VMIN] = 1;
 
-    // set speed
-    if (cfsetspeed(&options, B115200) != 0)
+    // set speed, non-standard rates are set after the other attributes
+    const speed_t speed = _fios_standard_speed(baudrate);
+
+    if (cfsetspeed(&attrs, speed != B0 ? speed : B115200) != 0)
     {
         fprintf(stderr, "fios: failed to set serial port speed, error %d: %s\n", errno, strerror(errno));
         goto error_close;
     }
 
-    if (tcsetattr(fd, TCSANOW, &options) != 0)
+    if (tcsetattr(fd, TCSANOW, &attrs) != 0)
     {
         fprintf(stderr, "fios: failed to set serial port attributes, error %d: %s\n", errno, strerror(errno));
         goto error_close;
     }
 
+    if (speed == B0 && ! _fios_set_custom_baudrate(fd, baudrate))
+    {
+        fprintf(stderr, "fios: failed to set serial port speed %u, error %d: %s\n", baudrate, errno, strerror(errno));
+        goto error_close;
+    }
+
     if (tcflush(fd, TCIFLUSH) != 0)
     {
         fprintf(stderr, "fios: failed to flush serial port input, error %d: %s\n", errno, strerror(errno));
@@ -324,13 +741,22 @@ fios_serial_t* fios_serial_open(const char* const devpath)
         goto error_close;
     }
 
-    const int flags = fcntl(fd, F_GETFL);
-    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    // the port stays non-blocking, waits are done with poll so that they can be cancelled through the pipe
+    if (! fios_serial_pipe(s->cancelfd, 0))
+    {
+        fprintf(stderr, "fios: failed to create serial port cancel pipe, error %d: %s\n", errno, strerror(errno));
+        goto error_close;
+    }
 
     s->devpath = strdup(devpath);
     s->fd = fd;
 #endif
 
+    s->baudrate = baudrate;
+
+    if (options != NULL && options->negotiate != fios_serial_negotiate_none && ! _fios_serial_negotiate(s, options))
+        fprintf(stderr, "fios: serial port speed negotiation failed, staying at %u baud\n", s->baudrate);
+
     return s;
 
 error_close:
@@ -345,10 +771,146 @@ error_free:
     return NULL;
 }
 
+bool fios_serial_set_baudrate(fios_serial_t* const s, const unsigned int baudrate)
+{
+    assert_return(s != NULL, false);
+    assert_return(baudrate != 0, false);
+
+    if (s->mux != NULL)
+    {
+        fprintf(stderr, "fios: cannot change the speed of a multiplexed channel\n");
+        return false;
+    }
+
+    // there is no line speed for these, the rate is only kept around for the caller
+   #ifdef _WIN32
+    if (s->transport != NULL)
+   #else
+    if (s->transport != NULL || s->socket)
+   #endif
+    {
+        s->baudrate = baudrate;
+        return true;
+    }
+
+   #ifdef _WIN32
+    DCB params = { 0 };
+    params.DCBlength = sizeof(params);
+
+    if (FlushFileBuffers(s->h) == FALSE || GetCommState(s->h, &params) == FALSE)
+    {
+        fprintf(stderr, "fios: failed to get serial port state, error %d: %s\n", GetLastError(), GetLastErrorString(GetLastError()));
+        return false;
+    }
+
+    params.BaudRate = baudrate;
+
+    if (SetCommState(s->h, &params) == FALSE)
+    {
+        fprintf(stderr, "fios: failed to set serial port speed %u, error %d: %s\n", baudrate, GetLastError(), GetLastErrorString(GetLastError()));
+        return false;
+    }
+   #else
+    struct termios attrs;
+
+    if (tcdrain(s->fd) != 0 || tcgetattr(s->fd, &attrs) != 0)
+    {
+        fprintf(stderr, "fios: failed to get serial port attributes, error %d: %s\n", errno, strerror(errno));
+        return false;
+    }
+
+    const speed_t speed = _fios_standard_speed(baudrate);
+
+    if (speed != B0)
+    {
+        if (cfsetspeed(&attrs, speed) != 0 || tcsetattr(s->fd, TCSANOW, &attrs) != 0)
+        {
+            fprintf(stderr, "fios: failed to set serial port speed %u, error %d: %s\n", baudrate, errno, strerror(errno));
+            return false;
+        }
+    }
+    else if (! _fios_set_custom_baudrate(s->fd, baudrate))
+    {
+        fprintf(stderr, "fios: failed to set serial port speed %u, error %d: %s\n", baudrate, errno, strerror(errno));
+        return false;
+    }
+   #endif
+
+    s->baudrate = baudrate;
+    return true;
+}
+
+unsigned int fios_serial_get_baudrate(fios_serial_t* const s)
+{
+    assert_return(s != NULL, 0);
+
+    return s->baudrate;
+}
+
+uint64_t fios_serial_time_us(void)
+{
+   #ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+
+    QueryPerformanceCounter(&counter);
+    return (counter.QuadPart / frequency.QuadPart) * 1000000
+         + (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+   #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+   #endif
+}
+
+#ifndef _WIN32
+bool fios_serial_pipe(int fds[2], const int flags)
+{
+   #if defined(__linux__) || defined(__FreeBSD__)
+    return pipe2(fds, O_CLOEXEC | flags) == 0;
+   #else
+    if (pipe(fds) != 0)
+        return false;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        if (fcntl(fds[i], F_SETFD, FD_CLOEXEC) != 0
+            || (flags != 0 && fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | flags) != 0))
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+    }
+
+    return true;
+   #endif
+}
+#endif
+
+void fios_serial_get_syscalls(fios_serial_t* const s, uint64_t* const reads, uint64_t* const writes)
+{
+    assert_return(s != NULL,);
+
+    if (reads != NULL)
+        *reads = _fios_counter_get(&s->reads);
+    if (writes != NULL)
+        *writes = _fios_counter_get(&s->writes);
+}
+
 void fios_serial_cancel(fios_serial_t* const s)
 {
     assert_return(s != NULL,);
 
+    if (s->transport != NULL)
+    {
+        s->transport->cancel(s);
+        return;
+    }
+
    #ifdef _WIN32
     const HANDLE h = s->h;
     if (h != INVALID_HANDLE_VALUE)
@@ -361,7 +923,11 @@ void fios_serial_cancel(fios_serial_t* const s)
     if (fd >= 0)
     {
         s->fd = -1;
-        ioctl(fd, TIOCSTI, "q");
+
+        // wake up any thread waiting on the serial port, the pipe is left readable until the serial port is closed
+        if (write(s->cancelfd[1], "q", 1) != 1)
+            perror("fios_serial_cancel write");
+
         close(fd);
     }
    #endif
@@ -371,15 +937,107 @@ void fios_serial_close(fios_serial_t* const s)
 {
     assert_return(s != NULL,);
 
+    if (s->transport != NULL)
+    {
+        s->transport->close(s);
+        free(s);
+        return;
+    }
+
     fios_serial_cancel(s);
+   #ifndef _WIN32
+    close(s->cancelfd[0]);
+    close(s->cancelfd[1]);
+   #endif
     free(s->devpath);
     free(s);
 }
 
-static bool _fios_read(fios_serial_t* const s, uint8_t* const buffer, const uint32_t size)
+#ifndef _WIN32
+// wait until the serial port is ready for @a events, with a negative @a timeout_ms meaning no timeout
+// returns 1 when ready, 0 on timeout and -1 if cancelled or failed
+static int _fios_wait(fios_serial_t* const s, const short events, const int timeout_ms)
+{
+    struct pollfd fds[2] = {
+        { .fd = s->fd, .events = events },
+        { .fd = s->cancelfd[0], .events = POLLIN },
+    };
+
+    if (fds[0].fd < 0)
+        return -1;
+
+    for (;;)
+    {
+        // inside of a task this gives control back to whoever drives it instead of blocking
+        const int ret = fios_task_poll(fds, 2, timeout_ms);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            perror("_fios_wait poll < 0");
+            return -1;
+        }
+
+        if (ret == 0)
+            return 0;
+
+        if (fds[1].revents != 0)
+        {
+            DEBUG_PRINT("_fios_wait cancelled\n");
+            return -1;
+        }
+
+        // errors and hangups are reported by the read or write that follows
+        return 1;
+    }
+}
+
+// gathered write, sockets use sendmsg so that a closed connection fails the write instead of raising SIGPIPE
+static ssize_t _fios_writev_fd(fios_serial_t* const s, const struct iovec* const iov, const int count)
 {
+   #ifdef MSG_NOSIGNAL
+    if (s->socket)
+    {
+        const struct msghdr msg = { .msg_iov = (struct iovec*)iov, .msg_iovlen = count };
+        return sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+    }
+   #endif
+
+    return writev(s->fd, iov, count);
+}
+#endif
+
+// take up to @a size bytes already read ahead into the receive buffer
+static uint32_t _fios_read_buffered(fios_serial_t* const s, uint8_t* const buffer, const uint32_t size)
+{
+    const uint32_t r = size < s->rxlen ? size : s->rxlen;
+
+    memcpy(buffer, s->rxbuf + s->rxpos, r);
+    s->rxpos += r;
+    s->rxlen -= r;
+    return r;
+}
+
+// read exactly @a size bytes, giving up if no data arrives for @a timeout_ms when not negative
+// on POSIX, whatever else is available is read ahead into the receive buffer with the same call
+static bool _fios_read_timeout(fios_serial_t* const s, uint8_t* const buffer, const uint32_t size, const int timeout_ms)
+{
+    // transports do their own waiting, which is all the time they spend in here
+    if (s->transport != NULL)
+    {
+        const uint64_t start = fios_serial_time_us();
+        const bool ok = s->transport->read(s, buffer, size, timeout_ms);
+        _fios_counter_add(&s->read_us, fios_serial_time_us() - start);
+        return ok;
+    }
+
    #ifdef _WIN32
-    for (uint32_t r = 0; r < size;)
+    // unused
+    (void)timeout_ms;
+
+    for (uint32_t r = _fios_read_buffered(s, buffer, size); r < size;)
     {
         if (s->h == INVALID_HANDLE_VALUE)
         {
@@ -388,22 +1046,33 @@ static bool _fios_read(fios_serial_t* const s, uint8_t* const buffer, const uint
         }
 
         unsigned long r2 = 0;
-        if (ReadFile(s->h, buffer + r, size - r, &r2, NULL) == FALSE)
+        const uint64_t start = fios_serial_time_us();
+        _fios_counter_add(&s->reads, 1);
+        const BOOL ok = ReadFile(s->h, buffer + r, size - r, &r2, NULL);
+        _fios_counter_add(&s->read_us, fios_serial_time_us() - start);
+
+        if (ok == FALSE)
             return false;
 
         r += r2;
         assert_return(r <= size, false);
     }
    #else
-    for (uint32_t r = 0; r < size;)
+    for (uint32_t r = _fios_read_buffered(s, buffer, size); r < size;)
     {
         if (s->fd < 0)
         {
-            DEBUG_PRINT("_fios_write write cancelled");
+            DEBUG_PRINT("_fios_read read cancelled");
             return false;
         }
 
-        const int r2 = read(s->fd, buffer + r, size - r);
+        struct iovec iov[2] = {
+            { .iov_base = buffer + r, .iov_len = size - r },
+            { .iov_base = s->rxbuf, .iov_len = sizeof(s->rxbuf) },
+        };
+
+        const int r2 = readv(s->fd, iov, 2);
+        _fios_counter_add(&s->reads, 1);
         DEBUG_PRINT("_fios_read got %d | %x bytes, total %d | %x bytes, size %u\n", r2, r2, r + r2, r + r2, size);
 
         if (r2 == 0)
@@ -414,26 +1083,62 @@ static bool _fios_read(fios_serial_t* const s, uint8_t* const buffer, const uint
 
         if (r2 < 0)
         {
-            if (errno == EAGAIN)
+            if (errno == EINTR)
             {
-                usleep(10000);
+                _fios_counter_add(&s->read_retries, 1);
                 continue;
             }
 
+            if (errno == EAGAIN)
+            {
+                _fios_counter_add(&s->read_retries, 1);
+
+                const uint64_t start = fios_serial_time_us();
+                const int ready = _fios_wait(s, POLLIN, timeout_ms);
+                _fios_counter_add(&s->read_us, fios_serial_time_us() - start);
+
+                if (ready > 0)
+                    continue;
+
+                return false;
+            }
+
             perror("_fios_read read < 0");
             return false;
         }
 
-        r += r2;
-        assert_return(r <= size, false);
+        // anything past the requested size went into the receive buffer
+        if ((uint32_t)r2 > size - r)
+        {
+            s->rxpos = 0;
+            s->rxlen = r2 - (size - r);
+            r = size;
+        }
+        else
+        {
+            r += r2;
+        }
     }
    #endif
 
     return true;
 }
 
+static bool _fios_read(fios_serial_t* const s, uint8_t* const buffer, const uint32_t size)
+{
+    return _fios_read_timeout(s, buffer, size, -1);
+}
+
 static bool _fios_write(fios_serial_t* const s, const uint8_t* const buffer, const uint32_t size)
 {
+    if (s->transport != NULL)
+    {
+        const uint64_t start = fios_serial_time_us();
+        const bool ok = s->transport->write(s, &buffer, &size, 1);
+        _fios_counter_add(&s->write_us, fios_serial_time_us() - start);
+        return ok;
+    }
+
    #ifdef _WIN32
     for (unsigned long w = 0; w < size;)
     {
@@ -444,7 +1149,12 @@ static bool _fios_write(fios_serial_t* const s, const uint8_t* const buffer, con
         }
 
         unsigned long w2 = 0;
-        if (WriteFile(s->h, buffer + w, size - w, &w2, NULL) == FALSE)
+        const uint64_t start = fios_serial_time_us();
+        _fios_counter_add(&s->writes, 1);
+        const BOOL ok = WriteFile(s->h, buffer + w, size - w, &w2, NULL);
+        _fios_counter_add(&s->write_us, fios_serial_time_us() - start);
+
+        if (ok == FALSE)
             return false;
 
         w += w2;
@@ -459,17 +1169,33 @@ static bool _fios_write(fios_serial_t* const s, const uint8_t* const buffer, con
             return false;
         }
 
-        const int w2 = write(s->fd, buffer + w, size - w);
+        const struct iovec iov = { .iov_base = (void*)(buffer + w), .iov_len = size - w };
+        const int w2 = _fios_writev_fd(s, &iov, 1);
+        _fios_counter_add(&s->writes, 1);
         DEBUG_PRINT("_fios_write got %d | %x bytes, total %d | %x bytes, size %u\n", w2, w2, w + w2, w + w2, size);
 
         if (w2 < 0)
         {
-            if (errno == EAGAIN)
+            if (errno == EINTR)
             {
-                usleep(10000);
+                _fios_counter_add(&s->write_retries, 1);
                 continue;
             }
 
+            if (errno == EAGAIN)
+            {
+                _fios_counter_add(&s->write_retries, 1);
+
+                const uint64_t start = fios_serial_time_us();
+                const int ready = _fios_wait(s, POLLOUT, -1);
+                _fios_counter_add(&s->write_us, fios_serial_time_us() - start);
+
+                if (ready > 0)
+                    continue;
+
+                return false;
+            }
+
             perror("_fios_write write < 0");
             return false;
         }
@@ -482,6 +1208,116 @@ static bool _fios_write(fios_serial_t* const s, const uint8_t* const buffer, con
     return true;
 }
 
+// write several buffers as one, with a single gathered write where possible
+static bool _fios_writev(fios_serial_t* const s, const uint8_t* const buffers[], const uint32_t sizes[], const int count)
+{
+    if (s->transport != NULL)
+    {
+        const uint64_t start = fios_serial_time_us();
+        const bool ok = s->transport->write(s, buffers, sizes, count);
+        _fios_counter_add(&s->write_us, fios_serial_time_us() - start);
+        return ok;
+    }
+
+    uint32_t size = 0;
+    for (int i = 0; i < count; ++i)
+        size += sizes[i];
+
+   #ifdef _WIN32
+    // WriteFileGather only works for files, so copy into a single buffer instead
+    uint8_t buffer[FRAME_HEADER_SIZE + FRAME_CRC_SIZE + MAX_PAYLOAD_SIZE + FRAME_CRC_SIZE];
+
+    if (size > sizeof(buffer))
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            if (! _fios_write(s, buffers[i], sizes[i]))
+                return false;
+        }
+
+        return true;
+    }
+
+    for (uint32_t w = 0, i = 0; i < (uint32_t)count; w += sizes[i++])
+        memcpy(buffer + w, buffers[i], sizes[i]);
+
+    return _fios_write(s, buffer, size);
+   #else
+    struct iovec iov[4];
+    assert_return(count <= 4, false);
+
+    for (uint32_t w = 0; w < size;)
+    {
+        if (s->fd < 0)
+        {
+            DEBUG_PRINT("_fios_writev write cancelled");
+            return false;
+        }
+
+        // skip what was already written
+        int iovcount = 0;
+        for (uint32_t i = 0, offset = 0; i < (uint32_t)count; offset += sizes[i++])
+        {
+            if (offset + sizes[i] <= w)
+                continue;
+
+            const uint32_t skip = w > offset ? w - offset : 0;
+            iov[iovcount].iov_base = (void*)(buffers[i] + skip);
+            iov[iovcount].iov_len = sizes[i] - skip;
+            ++iovcount;
+        }
+
+        const int w2 = _fios_writev_fd(s, iov, iovcount);
+        _fios_counter_add(&s->writes, 1);
+        DEBUG_PRINT("_fios_writev got %d | %x bytes, total %d | %x bytes, size %u\n", w2, w2, w + w2, w + w2, size);
+
+        if (w2 < 0)
+        {
+            if (errno == EINTR)
+            {
+                _fios_counter_add(&s->write_retries, 1);
+                continue;
+            }
+
+            if (errno == EAGAIN)
+            {
+                _fios_counter_add(&s->write_retries, 1);
+
+                const uint64_t start = fios_serial_time_us();
+                const int ready = _fios_wait(s, POLLOUT, -1);
+                _fios_counter_add(&s->write_us, fios_serial_time_us() - start);
+
+                if (ready > 0)
+                    continue;
+
+                return false;
+            }
+
+            perror("_fios_writev write < 0");
+            return false;
+        }
+
+        w += w2;
+        assert_return(w <= size, false);
+    }
+
+    return true;
+   #endif
+}
+
+static void _fios_frame_put_u32(uint8_t* const data, const uint32_t value)
+{
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t _fios_frame_get_u32(const uint8_t* const data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
 bool fios_serial_read_cmd(fios_serial_t* const s, char cmd[CMD_SIZE])
 {
     memset(cmd, 0, CMD_SIZE);
@@ -497,7 +1333,8 @@ bool fios_serial_read_payload(fios_serial_t* s, void* payload, size_t size)
 bool fios_serial_write_cmd(fios_serial_t* const s, const char* const cmd)
 {
     char cmdbuf[CMD_SIZE] = { 0 };
-    strncpy(cmdbuf, cmd, CMD_SIZE - 1);
+    const size_t len = strlen(cmd);
+    memcpy(cmdbuf, cmd, len < CMD_SIZE - 1 ? len : CMD_SIZE - 1);
     DEBUG_PRINT("fios_serial_write_cmd '%s'\n", cmdbuf);
 
     return _fios_write(s, (const uint8_t*)cmdbuf, CMD_SIZE);
@@ -507,3 +1344,255 @@ bool fios_serial_write_payload(fios_serial_t* const s, const void* const payload
 {
     return _fios_write(s, payload, size);
 }
+
+static void _fios_frame_decode(const uint8_t header[FRAME_HEADER_SIZE], fios_frame_t* const frame)
+{
+    frame->type = header[1];
+    frame->flags = header[2];
+    frame->channel = header[3];
+    frame->seq = _fios_frame_get_u32(header + 4);
+    frame->length = _fios_frame_get_u32(header + 8);
+}
+
+// check the magic byte and checksum of a header, followed by its checksum
+static bool _fios_frame_check(const uint8_t header[FRAME_HEADER_SIZE + FRAME_CRC_SIZE])
+{
+    return header[0] == FRAME_MAGIC
+        && fios_crc32(0, header, FRAME_HEADER_SIZE) == _fios_frame_get_u32(header + FRAME_HEADER_SIZE);
+}
+
+bool fios_serial_read_frame(fios_serial_t* const s, fios_frame_t* const frame, const bool crc, bool* const valid)
+{
+    uint8_t header[FRAME_HEADER_SIZE + FRAME_CRC_SIZE];
+
+    if (! _fios_read(s, header, crc ? FRAME_HEADER_SIZE + FRAME_CRC_SIZE : FRAME_HEADER_SIZE))
+        return false;
+
+    if (crc)
+    {
+        *valid = _fios_frame_check(header);
+        DEBUG_PRINT("fios_serial_read_frame header valid %d\n", *valid);
+    }
+    else if (header[0] != FRAME_MAGIC)
+    {
+        fprintf(stderr, "fios: invalid frame magic %02x\n", header[0]);
+        return false;
+    }
+    else
+    {
+        *valid = true;
+    }
+
+    _fios_frame_decode(header, frame);
+    return true;
+}
+
+bool fios_serial_resync_frame(fios_serial_t* const s, fios_frame_t* const frame, const uint32_t maxlength)
+{
+    uint8_t header[FRAME_HEADER_SIZE + FRAME_CRC_SIZE];
+
+    if (! _fios_read(s, header, FRAME_HEADER_SIZE + FRAME_CRC_SIZE))
+        return false;
+
+    while (! _fios_frame_check(header) || _fios_frame_get_u32(header + 8) > maxlength)
+    {
+        DEBUG_PRINT("fios_serial_resync_frame skipping byte %02x\n", header[0]);
+        memmove(header, header + 1, FRAME_HEADER_SIZE + FRAME_CRC_SIZE - 1);
+
+        if (! _fios_read(s, header + FRAME_HEADER_SIZE + FRAME_CRC_SIZE - 1, 1))
+            return false;
+    }
+
+    _fios_frame_decode(header, frame);
+    return true;
+}
+
+bool fios_serial_read_frame_payload(fios_serial_t* const s,
+                                    const fios_frame_t* const frame,
+                                    void* const payload,
+                                    const bool crc,
+                                    bool* const valid)
+{
+    uint8_t trailer[FRAME_CRC_SIZE];
+
+    *valid = true;
+
+    if (frame->length == 0)
+        return true;
+
+    if (! _fios_read(s, payload, frame->length))
+        return false;
+
+    if (! crc)
+        return true;
+
+    if (! _fios_read(s, trailer, FRAME_CRC_SIZE))
+        return false;
+
+    *valid = fios_crc32(0, payload, frame->length) == _fios_frame_get_u32(trailer);
+    DEBUG_PRINT("fios_serial_read_frame_payload '%c' seq %u length %u valid %d\n",
+                frame->type, frame->seq, frame->length, *valid);
+    return true;
+}
+
+bool fios_serial_write_frame(fios_serial_t* const s,
+                             const fios_frame_t* const frame,
+                             const void* const payload,
+                             const bool crc)
+{
+    uint8_t header[FRAME_HEADER_SIZE + FRAME_CRC_SIZE];
+    uint8_t trailer[FRAME_CRC_SIZE];
+    header[0] = FRAME_MAGIC;
+    header[1] = frame->type;
+    header[2] = frame->flags;
+    header[3] = frame->channel;
+    _fios_frame_put_u32(header + 4, frame->seq);
+    _fios_frame_put_u32(header + 8, frame->length);
+    DEBUG_PRINT("fios_serial_write_frame '%c' seq %u length %u\n", frame->type, frame->seq, frame->length);
+
+    // header, payload and checksums go out together
+    const uint8_t* const buffers[3] = { header, payload, trailer };
+    const uint32_t sizes[3] = { crc ? FRAME_HEADER_SIZE + FRAME_CRC_SIZE : FRAME_HEADER_SIZE, frame->length, FRAME_CRC_SIZE };
+
+    if (crc)
+    {
+        _fios_frame_put_u32(header + FRAME_HEADER_SIZE, fios_crc32(0, header, FRAME_HEADER_SIZE));
+        _fios_frame_put_u32(trailer, fios_crc32(0, payload, frame->length));
+    }
+
+    return _fios_writev(s, buffers, sizes, crc && frame->length != 0 ? 3 : 2);
+}
+
+static void _fios_flush_input(fios_serial_t* const s)
+{
+   #ifdef _WIN32
+    PurgeComm(s->h, PURGE_RXCLEAR);
+   #else
+    if (! s->socket)
+        tcflush(s->fd, TCIFLUSH);
+   #endif
+
+    s->rxlen = 0;
+}
+
+// read a command, giving up if no data arrives for @a timeout_ms
+static bool _fios_read_cmd_timeout(fios_serial_t* const s, char cmd[CMD_SIZE], const unsigned int timeout_ms)
+{
+    memset(cmd, 0, CMD_SIZE);
+
+   #ifdef _WIN32
+    COMMTIMEOUTS timeouts = { 0 };
+    timeouts.ReadTotalTimeoutConstant = timeout_ms;
+    SetCommTimeouts(s->h, &timeouts);
+
+    unsigned long r = 0;
+    _fios_counter_add(&s->reads, 1);
+    const bool ok = ReadFile(s->h, cmd, CMD_SIZE, &r, NULL) != FALSE && r == CMD_SIZE;
+
+    timeouts.ReadTotalTimeoutConstant = 0;
+    SetCommTimeouts(s->h, &timeouts);
+
+    return ok;
+   #else
+    return _fios_read_timeout(s, (uint8_t*)cmd, CMD_SIZE, timeout_ms);
+   #endif
+}
+
+static void _fios_sleep_ms(const unsigned int ms)
+{
+   #ifdef _WIN32
+    Sleep(ms);
+   #else
+    usleep(ms * 1000);
+   #endif
+}
+
+static bool _fios_serial_negotiate(fios_serial_t* const s, const fios_serial_options_t* const options)
+{
+    const unsigned int startrate = s->baudrate;
+    const unsigned int maxrate = options->max_baudrate != 0 ? options->max_baudrate : startrate;
+    char cmd[CMD_SIZE];
+    unsigned int baudrate;
+
+    if (options->negotiate == fios_serial_negotiate_initiator)
+    {
+        // propose our highest rate, retrying in case the responder is not listening yet
+        char reply[CMD_SIZE];
+        bool replied = false;
+        snprintf(cmd, CMD_SIZE, "b 0x%08x", maxrate);
+
+        for (int i = 0; i < 5 && ! replied; ++i)
+        {
+            if (! fios_serial_write_cmd(s, cmd))
+                return false;
+
+            replied = _fios_read_cmd_timeout(s, reply, 1000) && reply[0] == 'b' && reply[1] == ' ';
+        }
+
+        if (! replied)
+            return false;
+
+        reply[CMD_SIZE - 1] = 0;
+        baudrate = strtoul(reply + 2, NULL, 16);
+
+        if (baudrate == 0 || baudrate > maxrate)
+            return false;
+
+        DEBUG_PRINT("negotiated baud rate %u\n", baudrate);
+
+        if (baudrate == startrate)
+            return true;
+
+        if (! fios_serial_set_baudrate(s, baudrate))
+            return false;
+
+        // give the responder time to switch as well, then confirm the new rate
+        _fios_sleep_ms(100);
+        _fios_flush_input(s);
+
+        if (fios_serial_write_cmd(s, "ok")
+            && _fios_read_cmd_timeout(s, reply, 2000)
+            && reply[0] == 'o' && reply[1] == 'k')
+            return true;
+    }
+    else
+    {
+        do {
+            if (! fios_serial_read_cmd(s, cmd))
+                return false;
+        } while (cmd[0] != 'b' || cmd[1] != ' ');
+
+        cmd[CMD_SIZE - 1] = 0;
+        baudrate = strtoul(cmd + 2, NULL, 16);
+
+        if (baudrate == 0)
+            return false;
+
+        if (baudrate > maxrate)
+            baudrate = maxrate;
+
+        DEBUG_PRINT("negotiated baud rate %u\n", baudrate);
+
+        snprintf(cmd, CMD_SIZE, "b 0x%08x", baudrate);
+
+        if (! fios_serial_write_cmd(s, cmd))
+            return false;
+
+        if (baudrate == startrate)
+            return true;
+
+        // switching drains pending output, so the reply goes out with the old rate
+        if (! fios_serial_set_baudrate(s, baudrate))
+            return false;
+
+        _fios_flush_input(s);
+
+        if (_fios_read_cmd_timeout(s, cmd, 3000)
+            && cmd[0] == 'o' && cmd[1] == 'k'
+            && fios_serial_write_cmd(s, "ok"))
+            return true;
+    }
+
+    fios_serial_set_baudrate(s, startrate);
+    return false;
+}
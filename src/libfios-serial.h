@@ -5,6 +5,16 @@
 
 #include "libfios.h"
 
+#ifdef __cplusplus
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+#ifndef _WIN32
+#include <stdatomic.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -14,15 +24,168 @@ typedef void* HANDLE;
 const char* GetLastErrorString(short error);
 #endif
 
+/*! size of the receive buffer of a serial port, data that arrives past what was asked for is read ahead into it
+ */
+#define FIOS_SERIAL_RX_BUFFER_SIZE 0x4000
+
+/*! counters changed by a single thread at a time and read from any other, like statistics
+ */
+#ifdef _WIN32
+// aligned 64-bit loads and stores are atomic there, and volatile ones are ordered
+typedef volatile uint64_t _fios_counter_t;
+#else
+typedef _Atomic uint64_t _fios_counter_t;
+#endif
+
+static inline
+uint64_t _fios_counter_get(const _fios_counter_t* const counter)
+{
+   #ifdef _WIN32
+    return *counter;
+   #else
+    return atomic_load_explicit(counter, memory_order_acquire);
+   #endif
+}
+
+static inline
+void _fios_counter_set(_fios_counter_t* const counter, const uint64_t value)
+{
+   #ifdef _WIN32
+    *counter = value;
+   #else
+    atomic_store_explicit(counter, value, memory_order_release);
+   #endif
+}
+
+// there is a single thread changing each counter at a time, so this does not need to be an atomic increment
+static inline
+void _fios_counter_add(_fios_counter_t* const counter, const uint64_t value)
+{
+   #ifdef _WIN32
+    *counter += value;
+   #else
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_release);
+   #endif
+}
+
+/*! I/O functions of serial ports that are not backed by a device or socket, such as multiplexed channels and pipes
+ * reads and writes block until all data is transferred, and fail once the serial port is cancelled
+ */
+typedef struct {
+    /*! read exactly @a size bytes, giving up after @a timeout_ms when not negative
+     */
+    bool (*read)(fios_serial_t* s, uint8_t* buffer, uint32_t size, int timeout_ms);
+    /*! write @a count buffers, one after the other
+     */
+    bool (*write)(fios_serial_t* s, const uint8_t* const buffers[], const uint32_t sizes[], int count);
+    /*! wake up any thread waiting on the serial port, making further reads and writes fail
+     */
+    void (*cancel)(fios_serial_t* s);
+    /*! release whatever the serial port holds, the serial port itself is freed by the caller
+     */
+    void (*close)(fios_serial_t* s);
+} fios_transport_t;
+
 typedef struct _fios_serial_t {
+    // null for multiplexed channels and pipes, which are not backed by a device
     char* devpath;
+    unsigned int baudrate;
+    // data read ahead, served before reading from the serial port again
+    uint8_t rxbuf[FIOS_SERIAL_RX_BUFFER_SIZE];
+    uint32_t rxpos, rxlen;
+    // read and write system calls done so far, and how many of them had to be tried again
+    // these are read from other threads for transfer statistics, and reads and writes can happen on different threads
+    _fios_counter_t reads, writes, read_retries, write_retries;
+    // time spent waiting for the serial port to be readable or writable, in microseconds
+    _fios_counter_t read_us, write_us;
+    // set when not backed by a device or socket, all I/O goes through it in that case
+    const fios_transport_t* transport;
+    // multiplexer owning the serial port when this is one of its channels
+    struct _fios_mux_t* mux;
+    uint8_t channel;
+    // in-memory pipe and which of its ends this is, when opened with fios_serial_open_pipe
+    struct _fios_pipe_t* pipe;
+    uint8_t end;
    #ifdef _WIN32
     HANDLE h;
    #else
     int fd;
+    // set for TCP and Unix sockets, which use the same I/O as serial ports but have no speed or termios settings
+    bool socket;
+    // written to by fios_serial_cancel, waking up any thread waiting on the serial port
+    int cancelfd[2];
    #endif
 } fios_serial_t;
 
+/*! monotonic time in microseconds, for measuring how long serial port operations and transfers take
+ */
+uint64_t fios_serial_time_us(void);
+
+#ifndef _WIN32
+/*! create a pipe whose ends are not inherited by child processes, @a flags can add O_NONBLOCK to both ends
+ */
+bool fios_serial_pipe(int fds[2], int flags);
+#endif
+
+/*! binary frames start with a magic byte, so that a peer using commands is detected early
+ */
+#define FRAME_MAGIC 0xF1
+
+/*! size of an encoded binary frame header: magic, type, flags, channel, sequence and length
+ * multi-byte values are encoded as little-endian
+ */
+#define FRAME_HEADER_SIZE 12
+
+/*! frame flag for payloads compressed with the built-in LZ codec
+ */
+#define FRAME_FLAG_COMPRESSED 0x01
+
+/*! frame flag for acknowledgements that reply to a probe,
+ * and for negative acknowledgements asking for a probe after a damaged frame that could not be identified
+ */
+#define FRAME_FLAG_PROBE 0x02
+
+/*! size of the CRC-32 values that follow the header and the payload of every frame when checksums are negotiated
+ * the header has its own checksum so that its length can be trusted before reading the payload,
+ * frames without payload only have the header checksum
+ */
+#define FRAME_CRC_SIZE 4
+
+/*! binary frame header, used instead of commands when binary framing is negotiated
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t channel;
+    uint32_t seq;
+    uint32_t length;
+} fios_frame_t;
+
+/*! read a binary frame header, the payload of @a frame->length bytes must be read separately
+ * if @a crc is set the header checksum is read too, an invalid magic byte or checksum sets @a valid to false
+ * instead of failing, in which case nothing about the frame can be trusted
+ * @note this is a blocking operation
+ */
+bool fios_serial_read_frame(fios_serial_t* s, fios_frame_t* frame, bool crc, bool* valid);
+
+/*! find the next frame header after damaged data, skipping one byte at a time
+ * until a valid magic byte and header checksum are found, with a length of up to @a maxlength
+ * @note this is a blocking operation, which only returns once the peer sends another frame
+ */
+bool fios_serial_resync_frame(fios_serial_t* s, fios_frame_t* frame, uint32_t maxlength);
+
+/*! read the payload of a binary frame, plus its checksum if @a crc is set and the frame has a payload
+ * @a valid is set to false if the checksum does not match, the header is still valid in that case
+ * @note this is a blocking operation
+ */
+bool fios_serial_read_frame_payload(fios_serial_t* s, const fios_frame_t* frame, void* payload, bool crc, bool* valid);
+
+/*! write a binary frame header followed by @a frame->length bytes of @a payload, in a single write
+ * the header and payload checksums are included if @a crc is set
+ * @note this is a blocking operation
+ */
+bool fios_serial_write_frame(fios_serial_t* s, const fios_frame_t* frame, const void* payload, bool crc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,13 +7,17 @@
 
 #ifdef __cplusplus
 #include <cstddef>
+#include <cstdint>
 extern "C" {
+#else
 #include <stddef.h>
+#include <stdint.h>
 #endif
 
 typedef size_t libfios_stream_read(void* buffer, size_t size, size_t n, void* cookie);
 typedef size_t libfios_stream_write(const void* buffer, size_t size, size_t n, void* cookie);
 typedef int libfios_stream_close(void* cookie);
+typedef int libfios_stream_seek(void* cookie, int64_t offset, int whence);
 
 typedef struct _libfios_stream_functions {
     libfios_stream_read* read;
@@ -23,6 +27,30 @@ typedef struct _libfios_stream_functions {
 
 fios_file_t* fios_file_send_stream(fios_serial_t* s, long size, libfios_stream_functions funcs, void* cookie);
 
+/*! variant of @fios_file_send_stream with custom @a options and a 64-bit @a size
+ * sizes past MAX_FILE_SIZE require the receiver to support large sizes
+ * @a seek can be null, it is only needed for resuming transfers and delta updates, which start over without it
+ */
+fios_file_t* fios_file_send_stream_ex(fios_serial_t* s,
+                                      int64_t size,
+                                      libfios_stream_functions funcs,
+                                      libfios_stream_seek* seek,
+                                      void* cookie,
+                                      const fios_file_options_t* options);
+
+/*! receive into a stream through custom functions, counterpart of @fios_file_send_stream
+ * only @a funcs.write and @a funcs.close are used, with the stream closed by @fios_file_close
+ */
+fios_file_t* fios_file_receive_stream(fios_serial_t* s, libfios_stream_functions funcs, void* cookie);
+
+/*! variant of @fios_file_receive_stream with custom @a options
+ * resuming and delta updates need an output file, and are ignored
+ */
+fios_file_t* fios_file_receive_stream_ex(fios_serial_t* s,
+                                         libfios_stream_functions funcs,
+                                         void* cookie,
+                                         const fios_file_options_t* options);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,647 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#ifdef __APPLE__
+#define _XOPEN_SOURCE 700 // for the ucontext functions, deprecated there but still working
+#define _DARWIN_C_SOURCE  // for MAP_ANON, which _XOPEN_SOURCE hides
+#endif
+
+#include "libfios-task.h"
+#include "libfios-serial.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#endif
+
+// tasks switch stacks with the ucontext functions, which are not available everywhere, musl and Windows lacking them
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__)
+#define FIOS_HAVE_TASKS
+#endif
+
+#ifdef FIOS_HAVE_TASKS
+#include <pthread.h>
+#include <fcntl.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __APPLE__
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define DEBUG_PRINT(...)
+// #define DEBUG_PRINT(...) printf(__VA_ARGS__)
+
+struct _fios_task_t {
+    // where the task continues when resumed, and where it goes back to when it waits or returns
+    ucontext_t context, caller;
+    void (*func)(void* arg);
+    void* arg;
+    // mapping of the stack, starting with a guard page that stops overflows from silently corrupting memory
+    uint8_t* stack;
+    size_t stacksize;
+    // task that resumed this one, when resumed from inside of another task
+    fios_task_t* previous;
+    bool running, done;
+    // what the task waits for while suspended in fios_task_poll, fds being null when not waiting
+    struct pollfd* fds;
+    nfds_t count;
+    uint64_t deadline;
+};
+
+// task running on the calling thread, if any
+static _Thread_local fios_task_t* _fios_task_current;
+
+// first function run on the stack of a task, which goes back to whoever last resumed it through uc_link once done
+static void _fios_task_entry(void)
+{
+    fios_task_t* const t = _fios_task_current;
+
+    t->func(t->arg);
+    t->done = true;
+
+    DEBUG_PRINT("_fios_task_entry %p done\n", (void*)t);
+}
+
+fios_task_t* fios_task_create(void (* const func)(void* arg), void* const arg)
+{
+    assert_return(func != NULL, NULL);
+
+    fios_task_t* const t = calloc(1, sizeof(fios_task_t));
+
+    if (t == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    // at least the size threads get by default, so that code running in tasks and its callbacks are not more limited
+    pthread_attr_t attr;
+    size_t size = 0;
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr, &size);
+    pthread_attr_destroy(&attr);
+
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (size < 0x100000)
+        size = 0x100000;
+
+    size = (size + page - 1) / page * page;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+   #ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+   #endif
+   #ifdef MAP_STACK
+    flags |= MAP_STACK;
+   #endif
+
+    void* const stack = mmap(NULL, page + size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    if (stack == MAP_FAILED)
+    {
+        fprintf(stderr, "fios: failed to allocate task stack, error %d: %s\n", errno, strerror(errno));
+        free(t);
+        return NULL;
+    }
+
+    if (mprotect(stack, page, PROT_NONE) != 0 || getcontext(&t->context) != 0)
+    {
+        fprintf(stderr, "fios: failed to set up task, error %d: %s\n", errno, strerror(errno));
+        munmap(stack, page + size);
+        free(t);
+        return NULL;
+    }
+
+    t->func = func;
+    t->arg = arg;
+    t->stack = stack;
+    t->stacksize = page + size;
+    t->context.uc_stack.ss_sp = t->stack + page;
+    t->context.uc_stack.ss_size = size;
+    t->context.uc_link = &t->caller;
+    makecontext(&t->context, _fios_task_entry, 0);
+    return t;
+}
+
+bool fios_task_resume(fios_task_t* const t)
+{
+    assert_return(t != NULL, true);
+
+    if (t->done)
+        return true;
+
+    // resumed from its own callbacks, it can only go on once they return
+    if (t->running)
+        return false;
+
+    t->previous = _fios_task_current;
+    t->running = true;
+    _fios_task_current = t;
+
+    if (swapcontext(&t->caller, &t->context) != 0)
+    {
+        fprintf(stderr, "fios: failed to resume task, error %d: %s\n", errno, strerror(errno));
+        _fios_task_current = t->previous;
+        t->running = false;
+        return false;
+    }
+
+    _fios_task_current = t->previous;
+    t->running = false;
+    return t->done;
+}
+
+void fios_task_destroy(fios_task_t* const t)
+{
+    if (t == NULL)
+        return;
+
+    assert_return(! t->running,);
+
+    munmap(t->stack, t->stacksize);
+    free(t);
+}
+
+bool fios_task_get_wait(const fios_task_t* const t, int* const fd, short* const events, int* const timeout_ms)
+{
+    assert_return(t != NULL, false);
+
+    if (t->fds == NULL || t->done)
+        return false;
+
+    if (fd != NULL)
+        *fd = t->fds[0].fd;
+    if (events != NULL)
+        *events = t->fds[0].events;
+
+    if (timeout_ms != NULL)
+    {
+        if (t->deadline == UINT64_MAX)
+        {
+            *timeout_ms = -1;
+        }
+        else
+        {
+            const uint64_t now = fios_serial_time_us();
+
+            // rounded up, so that the task is not resumed right before its deadline just to wait again
+            *timeout_ms = t->deadline > now ? (int)((t->deadline - now + 999) / 1000) : 0;
+        }
+    }
+
+    return true;
+}
+
+int fios_task_poll(struct pollfd* const fds, const nfds_t count, const int timeout_ms)
+{
+    fios_task_t* const t = _fios_task_current;
+
+    if (t == NULL)
+        return poll(fds, count, timeout_ms);
+
+    const uint64_t deadline = timeout_ms >= 0 ? fios_serial_time_us() + (uint64_t)timeout_ms * 1000 : UINT64_MAX;
+
+    for (;;)
+    {
+        const int ret = poll(fds, count, 0);
+
+        if (ret != 0 || (deadline != UINT64_MAX && fios_serial_time_us() >= deadline))
+            return ret;
+
+        t->fds = fds;
+        t->count = count;
+        t->deadline = deadline;
+
+        swapcontext(&t->context, &t->caller);
+
+        t->fds = NULL;
+        t->count = 0;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+typedef struct {
+    fios_engine_t* engine;
+    pthread_t thread;
+    bool running;
+    // written to when a task is added or the engine is closed, waking up the thread
+    int wakefd[2];
+    // tasks run by the thread, protected by the lock of the engine
+    fios_task_t** tasks;
+    unsigned int count, capacity;
+} _fios_engine_thread_t;
+
+struct _fios_engine_t {
+    pthread_mutex_t lock;
+    // broadcast whenever a task returned and was removed, for fios_engine_join
+    pthread_cond_t cond;
+    bool quit;
+    unsigned int count;
+    _fios_engine_thread_t threads[];
+};
+
+static void _fios_engine_wake(_fios_engine_thread_t* const et)
+{
+    // a byte already waiting in the pipe wakes the thread up just as well
+    if (write(et->wakefd[1], "w", 1) != 1 && errno != EAGAIN)
+        perror("_fios_engine_wake write");
+}
+
+// remove a task that returned from the thread running it, its owner frees it after fios_engine_join
+static void _fios_engine_remove(_fios_engine_thread_t* const et, fios_task_t* const t)
+{
+    fios_engine_t* const e = et->engine;
+
+    pthread_mutex_lock(&e->lock);
+
+    for (unsigned int i = 0; i < et->count; ++i)
+    {
+        if (et->tasks[i] == t)
+        {
+            et->tasks[i] = et->tasks[--et->count];
+            break;
+        }
+    }
+
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+}
+
+// poll everything the tasks of a thread wait for at once, resuming the ones that are ready
+static void* _fios_engine_thread(void* const arg)
+{
+    _fios_engine_thread_t* const et = arg;
+    fios_engine_t* const e = et->engine;
+    // copy of the task list, so that tasks can be added while polling, and all of the file descriptors they wait on
+    fios_task_t** tasks = NULL;
+    unsigned int taskcapacity = 0;
+    struct pollfd* fds = NULL;
+    nfds_t fdcapacity = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&e->lock);
+
+        if (e->quit)
+        {
+            pthread_mutex_unlock(&e->lock);
+            break;
+        }
+
+        const unsigned int count = et->count;
+
+        if (count > taskcapacity)
+        {
+            fios_task_t** const newtasks = realloc(tasks, count * sizeof(fios_task_t*));
+
+            if (newtasks == NULL)
+            {
+                pthread_mutex_unlock(&e->lock);
+                fprintf(stderr, "fios: out of memory\n");
+                break;
+            }
+
+            tasks = newtasks;
+            taskcapacity = count;
+        }
+
+        if (count != 0)
+            memcpy(tasks, et->tasks, count * sizeof(fios_task_t*));
+
+        pthread_mutex_unlock(&e->lock);
+
+        // tasks only change while being resumed, which happens on this thread, so they can be looked at without a lock
+        const uint64_t now = fios_serial_time_us();
+        nfds_t nfds = 1;
+        int timeout_ms = -1;
+
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            const fios_task_t* const t = tasks[i];
+
+            // not started yet
+            if (t->fds == NULL)
+            {
+                timeout_ms = 0;
+                continue;
+            }
+
+            nfds += t->count;
+
+            if (t->deadline != UINT64_MAX)
+            {
+                const int ms = t->deadline > now ? (int)((t->deadline - now + 999) / 1000) : 0;
+
+                if (timeout_ms < 0 || ms < timeout_ms)
+                    timeout_ms = ms;
+            }
+        }
+
+        if (nfds > fdcapacity)
+        {
+            struct pollfd* const newfds = realloc(fds, nfds * sizeof(struct pollfd));
+
+            if (newfds == NULL)
+            {
+                fprintf(stderr, "fios: out of memory\n");
+                break;
+            }
+
+            fds = newfds;
+            fdcapacity = nfds;
+        }
+
+        fds[0].fd = et->wakefd[0];
+        fds[0].events = POLLIN;
+
+        for (unsigned int i = 0, n = 1; i < count; ++i)
+        {
+            const fios_task_t* const t = tasks[i];
+
+            if (t->fds != NULL)
+            {
+                memcpy(fds + n, t->fds, t->count * sizeof(struct pollfd));
+                n += t->count;
+            }
+        }
+
+        // tasks poll again themselves once resumed, so all of them are resumed when polling fails
+        const bool failed = poll(fds, nfds, timeout_ms) < 0;
+
+        if (failed && errno != EINTR)
+            perror("_fios_engine_thread poll < 0");
+
+        if (! failed && fds[0].revents != 0)
+        {
+            char buf[16];
+            while (read(et->wakefd[0], buf, sizeof(buf)) > 0) {}
+        }
+
+        const uint64_t later = fios_serial_time_us();
+
+        for (unsigned int i = 0, n = 1; i < count; ++i)
+        {
+            fios_task_t* const t = tasks[i];
+            bool ready = failed || t->fds == NULL || (t->deadline != UINT64_MAX && later >= t->deadline);
+
+            if (t->fds != NULL && ! failed)
+            {
+                for (nfds_t k = 0; k < t->count; ++k)
+                    ready |= fds[n + k].revents != 0;
+
+                n += t->count;
+            }
+
+            if (ready && fios_task_resume(t))
+                _fios_engine_remove(et, t);
+        }
+    }
+
+    free(tasks);
+    free(fds);
+    return NULL;
+}
+
+fios_engine_t* fios_engine_open(unsigned int threads)
+{
+    if (threads == 0)
+        threads = 1;
+
+    fios_engine_t* const e = calloc(1, sizeof(fios_engine_t) + threads * sizeof(_fios_engine_thread_t));
+
+    if (e == NULL)
+    {
+        fprintf(stderr, "fios: out of memory\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->cond, NULL);
+
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        _fios_engine_thread_t* const et = &e->threads[i];
+
+        et->engine = e;
+        et->wakefd[0] = et->wakefd[1] = -1;
+        e->count = i + 1;
+
+        if (! fios_serial_pipe(et->wakefd, O_NONBLOCK))
+        {
+            fprintf(stderr, "fios: failed to create engine pipe, error %d: %s\n", errno, strerror(errno));
+            et->wakefd[0] = et->wakefd[1] = -1;
+            fios_engine_close(e);
+            return NULL;
+        }
+
+        et->running = fios_thread_create(&et->thread, _fios_engine_thread, et);
+
+        if (! et->running)
+        {
+            fprintf(stderr, "fios: failed to create engine thread, error %d: %s\n", errno, strerror(errno));
+            fios_engine_close(e);
+            return NULL;
+        }
+    }
+
+    return e;
+}
+
+void fios_engine_close(fios_engine_t* const e)
+{
+    assert_return(e != NULL,);
+
+    pthread_mutex_lock(&e->lock);
+    e->quit = true;
+
+    for (unsigned int i = 0; i < e->count; ++i)
+    {
+        if (e->threads[i].count != 0)
+            fprintf(stderr, "fios: engine closed with transfers still running\n");
+    }
+
+    pthread_mutex_unlock(&e->lock);
+
+    for (unsigned int i = 0; i < e->count; ++i)
+    {
+        _fios_engine_thread_t* const et = &e->threads[i];
+
+        if (et->running)
+        {
+            _fios_engine_wake(et);
+            pthread_join(et->thread, NULL);
+        }
+
+        if (et->wakefd[0] >= 0)
+        {
+            close(et->wakefd[0]);
+            close(et->wakefd[1]);
+        }
+
+        free(et->tasks);
+    }
+
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+}
+
+bool fios_engine_add(fios_engine_t* const e, fios_task_t* const t)
+{
+    assert_return(e != NULL, false);
+    assert_return(t != NULL, false);
+
+    pthread_mutex_lock(&e->lock);
+
+    // a task stays on the thread it starts on, see fios_task_resume
+    _fios_engine_thread_t* et = &e->threads[0];
+
+    for (unsigned int i = 1; i < e->count; ++i)
+    {
+        if (e->threads[i].count < et->count)
+            et = &e->threads[i];
+    }
+
+    if (et->count == et->capacity)
+    {
+        const unsigned int capacity = et->capacity != 0 ? et->capacity * 2 : 16;
+        fios_task_t** const tasks = realloc(et->tasks, capacity * sizeof(fios_task_t*));
+
+        if (tasks == NULL)
+        {
+            pthread_mutex_unlock(&e->lock);
+            fprintf(stderr, "fios: out of memory\n");
+            return false;
+        }
+
+        et->tasks = tasks;
+        et->capacity = capacity;
+    }
+
+    et->tasks[et->count++] = t;
+    pthread_mutex_unlock(&e->lock);
+
+    _fios_engine_wake(et);
+    return true;
+}
+
+void fios_engine_join(fios_engine_t* const e, fios_task_t* const t)
+{
+    assert_return(e != NULL,);
+
+    pthread_mutex_lock(&e->lock);
+
+    for (bool found = true; found;)
+    {
+        found = false;
+
+        for (unsigned int i = 0; i < e->count && ! found; ++i)
+        {
+            for (unsigned int j = 0; j < e->threads[i].count && ! found; ++j)
+                found = e->threads[i].tasks[j] == t;
+        }
+
+        if (found)
+            pthread_cond_wait(&e->cond, &e->lock);
+    }
+
+    pthread_mutex_unlock(&e->lock);
+}
+#else
+fios_task_t* fios_task_create(void (* const func)(void* arg), void* const arg)
+{
+    (void)func;
+    (void)arg;
+
+    fprintf(stderr, "fios: transfers without a thread of their own are not supported on this platform\n");
+    return NULL;
+}
+
+bool fios_task_resume(fios_task_t* const t)
+{
+    (void)t;
+    return true;
+}
+
+void fios_task_destroy(fios_task_t* const t)
+{
+    (void)t;
+}
+
+bool fios_task_get_wait(const fios_task_t* const t, int* const fd, short* const events, int* const timeout_ms)
+{
+    (void)t;
+    (void)fd;
+    (void)events;
+    (void)timeout_ms;
+    return false;
+}
+
+#ifndef _WIN32
+int fios_task_poll(struct pollfd* const fds, const nfds_t count, const int timeout_ms)
+{
+    return poll(fds, count, timeout_ms);
+}
+#endif
+
+fios_engine_t* fios_engine_open(const unsigned int threads)
+{
+    (void)threads;
+
+    fprintf(stderr, "fios: engines are not supported on this platform\n");
+    return NULL;
+}
+
+void fios_engine_close(fios_engine_t* const e)
+{
+    (void)e;
+}
+
+bool fios_engine_add(fios_engine_t* const e, fios_task_t* const t)
+{
+    (void)e;
+    (void)t;
+    return false;
+}
+
+void fios_engine_join(fios_engine_t* const e, fios_task_t* const t)
+{
+    (void)e;
+    (void)t;
+}
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#ifdef _WIN32
+bool fios_thread_create(HANDLE* const thread, unsigned (__stdcall* const func)(void*), void* const arg)
+{
+    *thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+    return *thread != NULL;
+}
+#else
+bool fios_thread_create(pthread_t* const thread, void* (* const func)(void*), void* const arg)
+{
+    // the default stack size, as callbacks from the application run on these threads too
+    const int ret = pthread_create(thread, NULL, func, arg);
+
+    if (ret == 0)
+        return true;
+
+    errno = ret;
+    return false;
+}
+#endif
@@ -0,0 +1,75 @@
+// SPDX-FileCopyrightText: 2024-2026 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "libfios-serial.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+#ifndef _WIN32
+#include <poll.h>
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! a function running on a stack of its own, which gives control back whenever it would block on a serial port
+ * this lets the blocking code of transfers run from an event loop without a thread for each of them
+ */
+typedef struct _fios_task_t fios_task_t;
+
+/*! create a task that calls @a func with @a arg once first resumed
+ * its stack is as large as the one of a new thread, but only the part that is used takes up memory
+ * returns null on failure and on platforms without support for tasks, Windows being one of them
+ */
+fios_task_t* fios_task_create(void (*func)(void* arg), void* arg);
+
+/*! run a task on the calling thread until it waits for a serial port or returns, returning true once it returned
+ * a task must always be resumed from the same thread, as code running in it can keep thread-local addresses around
+ */
+bool fios_task_resume(fios_task_t* t);
+
+/*! free a task that returned, or that was never resumed
+ */
+void fios_task_destroy(fios_task_t* t);
+
+/*! file descriptor, poll events and timeout a task is waiting for, with @a timeout_ms set to -1 for none
+ * returns false if the task is not waiting, in which case it is ready to be resumed right away
+ */
+bool fios_task_get_wait(const fios_task_t* t, int* fd, short* events, int* timeout_ms);
+
+#ifndef _WIN32
+/*! the same as poll, except that inside of a task it gives control back instead of blocking
+ * the task is then resumed once any of @a fds is ready or @a timeout_ms is over, and polls again
+ */
+int fios_task_poll(struct pollfd* fds, nfds_t count, int timeout_ms);
+#endif
+
+/*! hand a task over to one of the threads of @a e, which resumes it whenever what it waits for is ready
+ * the task stays on that thread until it returned, see fios_engine_join
+ */
+bool fios_engine_add(fios_engine_t* e, fios_task_t* t);
+
+/*! wait until a task handed over to @a e returned, after which it can be freed
+ */
+void fios_engine_join(fios_engine_t* e, fios_task_t* t);
+
+/*! start a thread running @a func with @a arg, used for every thread the library starts
+ * returns false on failure, with errno set on systems other than Windows
+ */
+#ifdef _WIN32
+bool fios_thread_create(HANDLE* thread, unsigned (__stdcall* func)(void*), void* arg);
+#else
+bool fios_thread_create(pthread_t* thread, void* (*func)(void*), void* arg);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
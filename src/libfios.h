@@ -5,10 +5,12 @@
 
 #ifdef __cplusplus
 #include <cstddef>
+#include <cstdint>
 extern "C" {
 #else
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #endif
 
 /*! define FIOS_API depending on the build type
@@ -27,10 +29,14 @@ extern "C" {
  */
 #define CMD_SIZE 2 /* 'w ' */ + 10 /* 0xffffffff */ + 1 /* null */
 
-/*! maximum size allowed in file APIs
+/*! maximum size allowed in file APIs when the receiver does not support large sizes
  */
 #define MAX_FILE_SIZE 0x7fffffff
 
+/*! maximum size allowed in file APIs, when both sides support large sizes
+ */
+#define MAX_FILE_SIZE_64 0x7fffffffffffffffLL
+
 /*! maximum payload size, used to receive or send data after a command
  */
 #define MAX_PAYLOAD_SIZE 0x2000
@@ -43,19 +49,98 @@ extern "C" {
 #define MAX_PAYLOAD_SIZE_SEND MAX_PAYLOAD_SIZE
 #endif
 
+/*! smallest payload size used by adaptive chunk sizing
+ */
+#define MIN_PAYLOAD_SIZE 0x200
+
+/*! largest payload size that can be negotiated at runtime for adaptive chunk sizing
+ */
+#define MAX_ADAPTIVE_PAYLOAD_SIZE 0x10000
+
+/*! maximum number of chunks that can be in flight (sent but not yet acknowledged) in windowed mode
+ */
+#define MAX_WINDOW_SIZE 32
+
 /*! opaque API structures
  */
 typedef struct _fios_serial_t fios_serial_t;
 typedef struct _fios_file_t fios_file_t;
+typedef struct _fios_batch_t fios_batch_t;
+typedef struct _fios_mux_t fios_mux_t;
+typedef struct _fios_bond_t fios_bond_t;
+typedef struct _fios_engine_t fios_engine_t;
 
 // --------------------------------------------------------------------------------------------------------------------
 // serial IO
 
+/*! default baud rate for serial ports, also the rate at which speed negotiation starts
+ */
+#define DEFAULT_BAUDRATE 115200
+
+typedef enum {
+    fios_serial_negotiate_none,
+    fios_serial_negotiate_initiator,
+    fios_serial_negotiate_responder,
+} fios_serial_negotiate_t;
+
+/*! options for opening a serial port
+ * a zero-initialized struct gives the default behaviour, same as @fios_serial_open
+ */
+typedef struct {
+    /*! baud rate to open the serial port with, 0 meaning DEFAULT_BAUDRATE
+     * non-standard rates are supported on Linux (through termios2), macOS and Windows, if the driver allows it
+     */
+    unsigned int baudrate;
+    /*! highest baud rate supported by this side, used for negotiation, 0 meaning the same as @a baudrate
+     */
+    unsigned int max_baudrate;
+    /*! speed negotiation role, both sides must use a matching role
+     * the initiator proposes its highest rate, the responder replies with the highest rate both support,
+     * after which both switch and confirm the new rate, going back to @a baudrate if the confirmation fails
+     * @note the responder blocks until the initiator starts the negotiation
+     */
+    fios_serial_negotiate_t negotiate;
+} fios_serial_options_t;
+
 /*! Open the serial port at @a devpath
+ * "tcp://host:port" and "unix:/path" connect to a TCP or Unix socket instead, which is then used the same way
+ * "tcp-listen://[host]:port" and "unix-listen:/path" listen instead, and block until the other side connects,
+ * after which the listening socket is closed, so every such call accepts a single connection
+ * the host can be left empty to listen on all addresses, as in "tcp-listen://:5000"
+ * sockets are not supported on Windows
  */
 FIOS_API
 fios_serial_t* fios_serial_open(const char* devpath);
 
+/*! Open the serial port at @a devpath with custom @a options, which can be null for defaults
+ * for sockets only the baud rate is used, which is just reported back by @fios_serial_get_baudrate
+ */
+FIOS_API
+fios_serial_t* fios_serial_open_ex(const char* devpath, const fios_serial_options_t* options);
+
+/*! Open both ends of an in-memory pipe, which behave like two serial ports connected to each other
+ * meant for testing, with each end used from a different thread, and closed with @fios_serial_close
+ */
+FIOS_API
+bool fios_serial_open_pipe(fios_serial_t** a, fios_serial_t** b);
+
+/*! Change the baud rate of an open serial port
+ * pending output is sent with the old rate before switching
+ */
+FIOS_API
+bool fios_serial_set_baudrate(fios_serial_t* s, unsigned int baudrate);
+
+/*! Get the current baud rate of a serial port
+ */
+FIOS_API
+unsigned int fios_serial_get_baudrate(fios_serial_t* s);
+
+/*! Get the number of read and write system calls done on a serial port so far, either pointer can be null
+ * received data is read in batches, so that small commands and frame headers rarely need a call of their own
+ */
+FIOS_API
+void fios_serial_get_syscalls(fios_serial_t* s, uint64_t* reads, uint64_t* writes);
+
 /*! Cancel pending read or writes of a serial port, effectively closing it
  * This allows to close the serial port connection without destroying the underlying fios_serial_t object
  */
@@ -105,6 +190,183 @@ typedef enum {
     fios_file_status_completed,
 } fios_file_status_t;
 
+/*! callback for transfer progress, with the bytes transferred so far and the total size
+ */
+typedef void fios_file_progress_callback(void* cookie, int64_t current, int64_t size);
+
+/*! callback for the end of a transfer, with @a status being either fios_file_status_completed or fios_file_status_error
+ * @fios_file_get_last_error can be used on @a f for the error message
+ */
+typedef void fios_file_status_callback(void* cookie, fios_file_t* f, fios_file_status_t status);
+
+/*! how received data is stored in the output file
+ */
+typedef enum {
+    /*! buffered writes through a stdio stream, appending as chunks arrive */
+    fios_file_storage_stream,
+    /*! preallocate the output once its size is known, then write chunks in place with positioned writes */
+    fios_file_storage_pwrite,
+    /*! preallocate and map the output, reading chunks straight into it when they need no decoding */
+    fios_file_storage_mmap,
+} fios_file_storage_t;
+
+/*! when received data is flushed to storage, so that it survives a power loss
+ */
+typedef enum {
+    /*! leave it to the operating system */
+    fios_file_sync_never,
+    /*! once the transfer completed, before it is reported as such */
+    fios_file_sync_end,
+    /*! after every chunk, which is slow but loses the least on embedded devices that can lose power at any time */
+    fios_file_sync_chunk,
+} fios_file_sync_t;
+
+/*! options for file operations
+ * a zero-initialized struct gives the default behaviour, compatible with older peers
+ */
+typedef struct {
+    /*! number of chunks the sender can have in flight before waiting for an acknowledgement
+     * 0 or 1 means the legacy lock-step protocol where each chunk waits for an "ok" from the receiver
+     * when receiving this is the maximum accepted from the sender, 0 meaning MAX_WINDOW_SIZE
+     * @note windowed mode requires the receiver to be running a libfios version that supports it
+     */
+    unsigned int window;
+    /*! use compact binary frame headers instead of ASCII commands for chunks and acknowledgements
+     * each frame header is sent together with its payload in a single write
+     * ignored for receiving, where binary framing is always accepted
+     */
+    bool binary_framing;
+    /*! adapt the chunk size at runtime between MIN_PAYLOAD_SIZE and the limit advertised by the receiver,
+     * based on the measured acknowledgement latency and throughput
+     * ignored for receiving, where adaptive chunk sizing is always accepted
+     */
+    bool adaptive_payload;
+    /*! largest chunk size to use or accept with adaptive chunk sizing, 0 meaning MAX_ADAPTIVE_PAYLOAD_SIZE
+     * without adaptive chunk sizing, chunks are MAX_PAYLOAD_SIZE_SEND when sending and up to MAX_PAYLOAD_SIZE_RECV when receiving
+     */
+    unsigned int max_payload_size;
+    /*! compress each chunk independently with the built-in LZ codec, sending chunks that do not shrink as-is
+     * this implies binary framing, progress is still reported in uncompressed bytes
+     * ignored for receiving, where compression is always accepted
+     */
+    bool compression;
+    /*! protect each frame with a CRC-32, so that damaged or missing chunks are retransmitted instead of failing the transfer
+     * the receiver keeps out-of-order chunks within the window and asks only for the ones it is missing
+     * this implies binary framing
+     * ignored for receiving, where checksums are always accepted
+     */
+    bool crc;
+    /*! resume a transfer that was interrupted, even across process restarts
+     * when receiving, a small journal is kept next to the output file with the size and checksum of the data already written,
+     * so that a new session starts from there instead of truncating the output file
+     * when sending, the bytes the receiver already has are checked against the input and skipped if they match
+     * @note requires a seekable input when sending, a file or a stream given a seek function, otherwise the transfer starts from the beginning
+     */
+    bool resume;
+    /*! number of chunks that can wait in a ring buffer for a separate thread to write them to the output when receiving,
+     * so that slow or bursty storage only holds back the serial port once the ring is full
+     * 0 means chunks are written by the receiving thread as they arrive
+     * ignored for sending
+     */
+    unsigned int write_queue;
+    /*! only used with batch sessions, skip files the receiver already has with the same size and CRC-32
+     * the receiver checks the files it holds against the manifest and the sender only transfers the ones that differ
+     * ignored for receiving, where the sender decides
+     */
+    bool skip_unchanged;
+    /*! update an existing copy of the file on the receiver with rsync-style delta encoding
+     * the receiver sends block signatures of its copy, and the sender replies with instructions to copy blocks from it
+     * or insert new data, so that only what changed goes over the serial port
+     * when receiving, the new file is written next to the output and replaces it once complete, when the transfer is closed
+     * when sending, the input is read twice, once to size the instructions and once to send them, and progress then refers to them instead of the file size
+     * @note not used when receiving with @a resume, which also needs the existing output
+     */
+    bool delta;
+    /*! how received data goes into the output file, preallocating it avoids fragmentation on flash filesystems
+     * if the output cannot be preallocated or mapped, chunks are still written in place with positioned writes
+     * ignored for sending, and when receiving into a stream or with @a resume or @a delta
+     * @note not available on Windows, where the stream is always used
+     */
+    fios_file_storage_t storage;
+    /*! when received data is flushed to storage, ignored for sending and when receiving into a stream
+     */
+    fios_file_sync_t sync;
+    /*! called from the transfer thread as data is transferred, at most once every @a progress_interval bytes
+     * must not block, as the transfer waits for it
+     * @note not used for batch sessions
+     */
+    fios_file_progress_callback* progress_callback;
+    /*! amount of data transferred between calls to @a progress_callback, 0 meaning after every chunk
+     */
+    int64_t progress_interval;
+    /*! called from the transfer thread once the transfer completes or fails, before @fios_file_wait returns
+     * this can happen before the function that started the transfer returns
+     * transfers stopped by @fios_file_close are not reported, except when they end on their own while being closed,
+     * in which case the callback has returned by the time @fios_file_close does
+     * @note not used for batch sessions
+     */
+    fios_file_status_callback* status_callback;
+    /*! passed as-is to @a progress_callback and @a status_callback
+     */
+    void* callback_cookie;
+    /*! run the transfer on the caller's thread from @fios_file_process, instead of on a thread of its own
+     * the caller waits for the events of @fios_file_get_events on the file descriptor of @fios_file_get_fd,
+     * which is the serial port itself, and calls @fios_file_process whenever they happen or the timeout is over
+     * the transfer only goes on from @fios_file_process, @fios_file_wait and @fios_file_close,
+     * which must always be called from the same thread, and callbacks are called from there too
+     * @a write_queue is ignored, as it needs a thread of its own
+     * @note only available for serial ports and sockets, not on Windows nor with musl, and not used for batch sessions
+     */
+    bool event_loop;
+    /*! run the transfer on one of the threads of an engine from @fios_engine_open, instead of on a thread of its own
+     * everything else works as with a thread, except that callbacks are called from the thread of the engine,
+     * where blocking holds up every other transfer it runs
+     * @a write_queue is ignored, and this is ignored itself with @a event_loop
+     * @note the same limits as with @a event_loop apply
+     */
+    fios_engine_t* engine;
+} fios_file_options_t;
+
+/*! number of buckets in the acknowledgement latency histogram of @fios_file_stats_t
+ */
+#define STATS_LATENCY_BUCKETS 16
+
+/*! statistics of a serial file transfer, see @fios_file_get_stats
+ * times are in microseconds, and stop counting once the transfer is done
+ */
+typedef struct {
+    /*! bytes transferred so far and total size, as in @fios_file_get_bytes
+     */
+    int64_t current, size;
+    /*! time since the transfer started
+     */
+    uint64_t elapsed_us;
+    /*! throughput in bytes per second, since the start and over about the last second
+     */
+    double average_rate, instant_rate;
+    /*! chunks sent or received, not counting the ones sent again
+     */
+    uint64_t chunks;
+    /*! only when sending, number of chunks acknowledged within each range of latency since they were sent
+     * bucket 0 is below 1 ms, bucket n from 2^(n-1) up to 2^n ms, and the last bucket everything above
+     */
+    uint64_t ack_latency[STATS_LATENCY_BUCKETS];
+    /*! time spent waiting for the serial port to be readable or writable
+     */
+    uint64_t serial_read_us, serial_write_us;
+    /*! time spent in reading the input or writing the output, including the writer thread when receiving
+     */
+    uint64_t stream_us;
+    /*! read and write system calls on the serial port, and how many of them had to be tried again
+     * because they were interrupted or would have blocked
+     * @note always 0 for multiplexed channels, which do not do system calls of their own
+     */
+    uint64_t reads, writes, retries;
+    /*! chunks sent again after being damaged or lost, and damaged frames seen
+     */
+    uint64_t retransmits, damaged;
+} fios_file_stats_t;
+
 /*! prepare to receive data from a serial port into the file @a outpath
  * a background thread is used for receiving data from the serial port and writing to the file
  * use @fios_file_idle to query current progress and @fios_file_close when done
@@ -119,6 +381,34 @@ fios_file_t* fios_file_receive(fios_serial_t* s, const char* outpath);
 FIOS_API
 fios_file_t* fios_file_send(fios_serial_t* s, const char* inpath);
 
+/*! variant of @fios_file_receive with custom @a options, which can be null for defaults
+ */
+FIOS_API
+fios_file_t* fios_file_receive_ex(fios_serial_t* s, const char* outpath, const fios_file_options_t* options);
+
+/*! variant of @fios_file_send with custom @a options, which can be null for defaults
+ * @note except on Windows the input file is memory-mapped while it is sent,
+ *       a file truncated in the meantime fails the transfer when noticed before the next chunk,
+ *       but truncating it while a chunk is being read from it crashes the process with SIGBUS,
+ *       so files that might be truncated should be copied first, or sent through @fios_file_send_stream from libfios-stream.h
+ */
+FIOS_API
+fios_file_t* fios_file_send_ex(fios_serial_t* s, const char* inpath, const fios_file_options_t* options);
+
+/*! prepare to receive data from a serial port into memory, with custom @a options which can be null for defaults
+ * data goes into @a buffer of @a capacity bytes, failing the transfer if it does not fit,
+ * or into memory allocated to the size announced by the sender if @a buffer is null
+ * resuming and delta updates need an output file, and are ignored
+ */
+FIOS_API
+fios_file_t* fios_file_receive_memory(fios_serial_t* s, void* buffer, size_t capacity, const fios_file_options_t* options);
+
+/*! get the data received into memory so far, and its @a size if not null
+ * the data belongs to the caller when the buffer was given, otherwise it is freed by @fios_file_close
+ */
+FIOS_API
+const void* fios_file_get_memory(fios_file_t* f, size_t* size);
+
 /*! check status of an active serial file transfer
  * when passing a valid @a progress pointer it will indicate current progress between 0.0 and 1.0
  * returns true if the file is still being received/sent, false if operation completed or failed
@@ -126,14 +416,62 @@ fios_file_t* fios_file_send(fios_serial_t* s, const char* inpath);
 FIOS_API
 fios_file_status_t fios_file_idle(fios_file_t* f, float* progress);
 
+/*! get a file descriptor that becomes readable whenever progress or status of a serial file transfer changes
+ * this allows event loops to poll it alongside their own file descriptors instead of calling @fios_file_idle on a timer,
+ * calling @fios_file_process once it is readable
+ * the file descriptor belongs to the transfer and is closed by @fios_file_close
+ * for transfers started with the @a event_loop option this is the serial port instead, to be polled for @fios_file_get_events
+ * @note not available on Windows, where this returns -1
+ */
+FIOS_API
+int fios_file_get_fd(fios_file_t* f);
+
+/*! get the poll events to wait for on the file descriptor of @fios_file_get_fd before calling @fios_file_process,
+ * along with a timeout in @a timeout_ms after which it must be called anyway, -1 meaning no timeout
+ * this is always POLLIN without a timeout, except for transfers started with the @a event_loop option,
+ * which wait for their serial port to become readable or writable, and for timeouts of the protocol
+ * @note not available on Windows, where this returns 0
+ */
+FIOS_API
+short fios_file_get_events(fios_file_t* f, int* timeout_ms);
+
+/*! acknowledge a notification from the file descriptor of @fios_file_get_fd, then check status like @fios_file_idle
+ * the file descriptor stays readable until this is called
+ * for transfers started with the @a event_loop option, this runs the transfer until it waits for the serial port again,
+ * and reports it as in progress until it is done with the serial port, even once @fios_file_idle says otherwise
+ */
+FIOS_API
+fios_file_status_t fios_file_process(fios_file_t* f, float* progress);
+
+/*! wait for a serial file transfer to complete or fail, for up to @a timeout_ms when not negative
+ * returns fios_file_status_in_progress if still running once @a timeout_ms is over
+ * transfers started with the @a event_loop option are run by this in the meantime
+ * @note this is a blocking operation
+ */
+FIOS_API
+fios_file_status_t fios_file_wait(fios_file_t* f, int timeout_ms);
+
 /*! get the current progress of an active serial file transfer
  * returns a value between 0.0 and 1.0
  */
 FIOS_API
 float fios_file_get_progress(fios_file_t* f);
 
+/*! get the number of bytes transferred so far and the total size of an active serial file transfer
+ * either pointer can be null, when resuming @a current includes the bytes that were skipped
+ */
+FIOS_API
+void fios_file_get_bytes(fios_file_t* f, int64_t* current, int64_t* size);
+
+/*! get statistics of a serial file transfer, to see where time goes in a slow one
+ * counters are updated by the transfer as it goes without any locking, so this can be called at any time and as often as needed
+ */
+FIOS_API
+void fios_file_get_stats(fios_file_t* f, fios_file_stats_t* stats);
+
 /*! close the file operation
  * must still be called even if @fios_file_idle returns false
+ * transfers started with the @a event_loop option are stopped by running what is left of them until they fail
  */
 FIOS_API
 void fios_file_close(fios_file_t* f);
@@ -144,6 +482,190 @@ void fios_file_close(fios_file_t* f);
 FIOS_API
 const char* fios_file_get_last_error(fios_file_t* f);
 
+// --------------------------------------------------------------------------------------------------------------------
+// batch sessions, many files over a single connection (using a background thread)
+
+/*! maximum number of files in a batch session
+ */
+#define MAX_BATCH_FILES 0xffff
+
+/*! maximum size of a file name in a batch session, in bytes and including subdirectories
+ */
+#define MAX_BATCH_NAME_SIZE 0x400
+
+/*! prepare to send the @a count files in @a paths into a serial port, one after the other
+ * the receiver first gets a manifest with the name and size of every file, names being the last component of each path
+ * fails if two paths end with the same name
+ * @a options apply to every file and can be null for defaults
+ * use @fios_batch_idle to query current progress and @fios_batch_close when done
+ */
+FIOS_API
+fios_batch_t* fios_batch_send(fios_serial_t* s, const char* const* paths, unsigned int count, const fios_file_options_t* options);
+
+/*! variant of @fios_batch_send for files in the directory @a basedir, keeping their subdirectories on the receiver
+ * @a names are relative to @a basedir, with '/' as separator, and are used as they are in the manifest
+ * the same rules as on the receiving side apply to them, they cannot be absolute or point outside @a basedir
+ */
+FIOS_API
+fios_batch_t* fios_batch_send_dir(fios_serial_t* s,
+                                  const char* basedir,
+                                  const char* const* names,
+                                  unsigned int count,
+                                  const fios_file_options_t* options);
+
+/*! prepare to receive a batch of files from a serial port into the existing directory @a destdir
+ * files are created with the names from the manifest, which can include subdirectories but never point outside @a destdir
+ * the whole batch is rejected, before anything is created, if a name is invalid or used twice
+ * @a options apply to every file and can be null for defaults
+ * use @fios_batch_idle to query current progress and @fios_batch_close when done
+ */
+FIOS_API
+fios_batch_t* fios_batch_receive(fios_serial_t* s, const char* destdir, const fios_file_options_t* options);
+
+/*! check status of an active batch session
+ * when passing a valid @a progress pointer it will indicate the progress over all files between 0.0 and 1.0
+ */
+FIOS_API
+fios_file_status_t fios_batch_idle(fios_batch_t* b, float* progress);
+
+/*! get the file currently being transferred in a batch session, along with its progress between 0.0 and 1.0
+ * @a index is the position of the file in the manifest and @a count the number of files, either pointer can be null
+ * @note @a count is 0 while the receiver is still waiting for the manifest
+ */
+FIOS_API
+float fios_batch_get_file_progress(fios_batch_t* b, unsigned int* index, unsigned int* count);
+
+/*! get the name of the file at @a index in the manifest of a batch session, or null if there is no such file
+ */
+FIOS_API
+const char* fios_batch_get_file_name(fios_batch_t* b, unsigned int index);
+
+/*! get the number of files in a batch session that were skipped because the receiver already had them
+ * only known once the receiver has replied to the manifest, and always 0 without @a skip_unchanged
+ */
+FIOS_API
+unsigned int fios_batch_get_skipped(fios_batch_t* b);
+
+/*! get the number of bytes transferred so far and the total size of all files in a batch session
+ * either pointer can be null
+ */
+FIOS_API
+void fios_batch_get_bytes(fios_batch_t* b, int64_t* current, int64_t* size);
+
+/*! close the batch session, cancelling it if still in progress
+ * must still be called even if @fios_batch_idle returns false
+ */
+FIOS_API
+void fios_batch_close(fios_batch_t* b);
+
+/*! get the error message for the case where @fios_batch_idle returns @fios_file_status_error
+ * must not be called after @fios_batch_close
+ */
+FIOS_API
+const char* fios_batch_get_last_error(fios_batch_t* b);
+
+// --------------------------------------------------------------------------------------------------------------------
+// multiplexing, concurrent transfers in both directions over a single serial port (using a background thread)
+
+/*! maximum number of channels of a multiplexed serial port
+ */
+#define MAX_MUX_CHANNELS 16
+
+/*! start multiplexing a serial port, which must be done by both sides before opening any channel
+ * everything sent over the serial port is then checksummed, with any damage stopping all channels
+ * the serial port must not be used directly until @fios_mux_close
+ */
+FIOS_API
+fios_mux_t* fios_mux_open(fios_serial_t* s);
+
+/*! open a channel of a multiplexed serial port, returning a serial port usable for file transfers and batch sessions
+ * each side picks which transfer goes into which channel, with a channel on one side talking to the same one on the other
+ * channels take turns with the serial port one frame at a time, and data sent into a channel waits for the peer to read it
+ * close it with @fios_serial_close, after which it can be opened again
+ * data received but not read by then is dropped, data arriving afterwards is kept for the next time the channel is opened
+ */
+FIOS_API
+fios_serial_t* fios_mux_open_channel(fios_mux_t* m, unsigned int channel);
+
+/*! stop multiplexing, cancelling the serial port
+ * all channels must be closed first, the serial port itself still needs @fios_serial_close afterwards
+ */
+FIOS_API
+void fios_mux_close(fios_mux_t* m);
+
+// --------------------------------------------------------------------------------------------------------------------
+// bonded transfers, a single file striped over several serial ports (using a background thread per serial port)
+
+/*! maximum number of serial ports of a bonded transfer
+ */
+#define MAX_BOND_LINKS 8
+
+/*! prepare to send a file over the @a count serial ports in @a serials at once
+ * the file is split into stripes, each serial port taking the next one as soon as it is done with the previous
+ * so that faster serial ports carry more of the file
+ * @a options apply to every stripe and can be null for defaults, resume and delta updates are not available
+ * a failure on any serial port fails the whole transfer
+ * use @fios_bond_idle to query current progress and @fios_bond_close when done
+ */
+FIOS_API
+fios_bond_t* fios_bond_send(fios_serial_t* const* serials, unsigned int count, const char* inpath, const fios_file_options_t* options);
+
+/*! prepare to receive a file over the @a count serial ports in @a serials at once, into @a outpath
+ * the serial ports must be connected to the same ones given to @fios_bond_send on the other side, in any order
+ * @a options apply to every stripe and can be null for defaults
+ * use @fios_bond_idle to query current progress and @fios_bond_close when done
+ */
+FIOS_API
+fios_bond_t* fios_bond_receive(fios_serial_t* const* serials, unsigned int count, const char* outpath, const fios_file_options_t* options);
+
+/*! check status of an active bonded transfer
+ * when passing a valid @a progress pointer it will indicate the progress over all serial ports between 0.0 and 1.0
+ */
+FIOS_API
+fios_file_status_t fios_bond_idle(fios_bond_t* b, float* progress);
+
+/*! get the number of bytes transferred so far and the total size of a bonded transfer
+ * either pointer can be null, @a size is 0 while the receiver is still waiting for it
+ */
+FIOS_API
+void fios_bond_get_bytes(fios_bond_t* b, int64_t* current, int64_t* size);
+
+/*! get the number of bytes transferred so far over the serial port at @a index of a bonded transfer
+ */
+FIOS_API
+int64_t fios_bond_get_link_bytes(fios_bond_t* b, unsigned int index);
+
+/*! close the bonded transfer, cancelling it if still in progress
+ * must still be called even if @fios_bond_idle returns false
+ * the serial ports still need @fios_serial_close afterwards
+ */
+FIOS_API
+void fios_bond_close(fios_bond_t* b);
+
+/*! get the error message for the case where @fios_bond_idle returns @fios_file_status_error
+ * must not be called after @fios_bond_close
+ */
+FIOS_API
+const char* fios_bond_get_last_error(fios_bond_t* b);
+
+// --------------------------------------------------------------------------------------------------------------------
+// engines, transfers on many serial ports at once (using a few background threads for all of them)
+
+/*! start an engine with @a threads threads, 0 meaning 1, for transfers started with it in their options
+ * each thread waits on the serial ports of all of its transfers at once, and runs them as they become ready,
+ * so that transfers on dozens of serial ports do not need a thread each
+ * transfers go to the thread with the fewest of them, and stay there until done
+ * @note not available on Windows nor with musl, where this returns null
+ */
+FIOS_API
+fios_engine_t* fios_engine_open(unsigned int threads);
+
+/*! stop the threads of an engine
+ * every transfer started with it must be closed before
+ */
+FIOS_API
+void fios_engine_close(fios_engine_t* e);
+
 // --------------------------------------------------------------------------------------------------------------------
 
 #ifdef __cplusplus
@@ -5,17 +5,78 @@
 from .libfios import (
     CMD_SIZE,
     MAX_FILE_SIZE,
+    MAX_FILE_SIZE_64,
     MAX_PAYLOAD_SIZE,
+    MIN_PAYLOAD_SIZE,
+    MAX_ADAPTIVE_PAYLOAD_SIZE,
+    MAX_WINDOW_SIZE,
+    STATS_LATENCY_BUCKETS,
+    MAX_BATCH_FILES,
+    MAX_BATCH_NAME_SIZE,
+    MAX_MUX_CHANNELS,
+    MAX_BOND_LINKS,
+    DEFAULT_BAUDRATE,
     fios_serial_open,
+    fios_serial_open_ex,
+    fios_serial_open_pipe,
+    fios_serial_options_t,
+    fios_serial_negotiate_none,
+    fios_serial_negotiate_initiator,
+    fios_serial_negotiate_responder,
+    fios_serial_set_baudrate,
+    fios_serial_get_baudrate,
+    fios_serial_get_syscalls,
     fios_serial_cancel,
     fios_serial_close,
     fios_file_send,
     fios_file_receive,
+    fios_file_send_ex,
+    fios_file_receive_ex,
+    fios_file_receive_memory,
+    fios_file_get_memory,
+    fios_file_options_t,
     fios_file_idle,
+    fios_file_get_fd,
+    fios_file_get_events,
+    fios_file_process,
+    fios_file_wait,
     fios_file_get_last_error,
     fios_file_get_progress,
+    fios_file_get_bytes,
+    fios_file_get_stats,
+    fios_file_stats_t,
     fios_file_close,
     fios_file_status_error,
     fios_file_status_in_progress,
     fios_file_status_completed,
+    fios_file_storage_stream,
+    fios_file_storage_pwrite,
+    fios_file_storage_mmap,
+    fios_file_sync_never,
+    fios_file_sync_end,
+    fios_file_sync_chunk,
+    fios_file_progress_callback,
+    fios_file_status_callback,
+    fios_batch_send,
+    fios_batch_send_dir,
+    fios_batch_receive,
+    fios_batch_idle,
+    fios_batch_get_file_progress,
+    fios_batch_get_file_name,
+    fios_batch_get_skipped,
+    fios_batch_get_bytes,
+    fios_batch_close,
+    fios_batch_get_last_error,
+    fios_mux_open,
+    fios_mux_open_channel,
+    fios_mux_close,
+    fios_bond_send,
+    fios_bond_receive,
+    fios_bond_idle,
+    fios_bond_get_bytes,
+    fios_bond_get_link_bytes,
+    fios_bond_close,
+    fios_bond_get_last_error,
+    fios_engine_open,
+    fios_engine_close,
 )
@@ -6,14 +6,24 @@ import os
 import sys
 
 from ctypes import (
+    CFUNCTYPE,
     Structure,
     POINTER,
     cdll,
     c_bool,
     c_char_p,
+    c_double,
     c_float,
     c_int,
+    c_int64,
+    c_short,
+    c_size_t,
+    c_uint64,
+    c_uint,
+    c_void_p,
     pointer,
+    sizeof,
+    string_at,
 )
 
 if sys.platform == 'darwin':
@@ -36,12 +46,24 @@ else:
 # use a well known size for commands, giving enough space for a small single argument
 CMD_SIZE = 2 + 10 + 1
 
-# maximum size allowed in file APIs
+# maximum size allowed in file APIs when the receiver does not support large sizes
 MAX_FILE_SIZE = 0x7fffffff
 
+# maximum size allowed in file APIs, when both sides support large sizes
+MAX_FILE_SIZE_64 = 0x7fffffffffffffff
+
 # maximum payload size, used to receive data after a command
 MAX_PAYLOAD_SIZE = 0x2000
 
+# smallest payload size used by adaptive chunk sizing
+MIN_PAYLOAD_SIZE = 0x200
+
+# largest payload size that can be negotiated at runtime for adaptive chunk sizing
+MAX_ADAPTIVE_PAYLOAD_SIZE = 0x10000
+
+# maximum number of chunks that can be in flight (sent but not yet acknowledged) in windowed mode
+MAX_WINDOW_SIZE = 32
+
 # opaque API structures
 class fios_serial_t(Structure):
     pass
@@ -49,16 +71,97 @@ class fios_serial_t(Structure):
 class fios_file_t(Structure):
     pass
 
+class fios_batch_t(Structure):
+    pass
+
+class fios_mux_t(Structure):
+    pass
+
+class fios_bond_t(Structure):
+    pass
+
+class fios_engine_t(Structure):
+    pass
+
 # ---------------------------------------------------------------------------------------------------------------------
 # serial IO
 
+# default baud rate for serial ports, also the rate at which speed negotiation starts
+DEFAULT_BAUDRATE = 115200
+
+# fios_serial_negotiate_t
+fios_serial_negotiate_none = 0
+fios_serial_negotiate_initiator = 1
+fios_serial_negotiate_responder = 2
+
+# options for opening a serial port
+# a zero-initialized struct gives the default behaviour, same as `fios_serial_open`
+class fios_serial_options_t(Structure):
+    _fields_ = [
+        # baud rate to open the serial port with, 0 meaning DEFAULT_BAUDRATE
+        ("baudrate", c_uint),
+        # highest baud rate supported by this side, used for negotiation, 0 meaning the same as `baudrate`
+        ("max_baudrate", c_uint),
+        # speed negotiation role, both sides must use a matching role
+        ("negotiate", c_int),
+    ]
+
 # Open the serial port at @a devpath
+# "tcp://host:port" and "unix:/path" connect to a TCP or Unix socket instead, which is then used the same way
+# "tcp-listen://[host]:port" and "unix-listen:/path" listen instead, and block until the other side connects,
+# after which the listening socket is closed, so every such call accepts a single connection
+# sockets are not supported on Windows
 libfios.fios_serial_open.argtypes = (c_char_p,)
 libfios.fios_serial_open.restype  = POINTER(fios_serial_t)
 
 def fios_serial_open(devpath):
     return libfios.fios_serial_open(devpath.encode("utf-8"))
 
+# Open the serial port at @a devpath with custom options, which can be None for defaults
+libfios.fios_serial_open_ex.argtypes = (c_char_p, POINTER(fios_serial_options_t),)
+libfios.fios_serial_open_ex.restype  = POINTER(fios_serial_t)
+
+def fios_serial_open_ex(devpath, options):
+    return libfios.fios_serial_open_ex(devpath.encode("utf-8"), pointer(options) if options is not None else None)
+
+# Open both ends of an in-memory pipe, which behave like two serial ports connected to each other
+# NOTE in python this returns (a, b), or None on failure
+libfios.fios_serial_open_pipe.argtypes = (POINTER(POINTER(fios_serial_t)), POINTER(POINTER(fios_serial_t)),)
+libfios.fios_serial_open_pipe.restype  = c_bool
+
+def fios_serial_open_pipe():
+    a = POINTER(fios_serial_t)()
+    b = POINTER(fios_serial_t)()
+    if not libfios.fios_serial_open_pipe(pointer(a), pointer(b)):
+        return None
+    return (a, b)
+
+# Change the baud rate of an open serial port
+# pending output is sent with the old rate before switching
+libfios.fios_serial_set_baudrate.argtypes = (POINTER(fios_serial_t), c_uint,)
+libfios.fios_serial_set_baudrate.restype  = c_bool
+
+def fios_serial_set_baudrate(s, baudrate):
+    return libfios.fios_serial_set_baudrate(s, baudrate)
+
+# Get the current baud rate of a serial port
+libfios.fios_serial_get_baudrate.argtypes = (POINTER(fios_serial_t),)
+libfios.fios_serial_get_baudrate.restype  = c_uint
+
+def fios_serial_get_baudrate(s):
+    return libfios.fios_serial_get_baudrate(s)
+
+# Get the number of read and write system calls done on a serial port so far
+# NOTE in python this returns (reads, writes)
+libfios.fios_serial_get_syscalls.argtypes = (POINTER(fios_serial_t), POINTER(c_uint64), POINTER(c_uint64),)
+libfios.fios_serial_get_syscalls.restype  = None
+
+def fios_serial_get_syscalls(s):
+    reads = c_uint64(0)
+    writes = c_uint64(0)
+    libfios.fios_serial_get_syscalls(s, pointer(reads), pointer(writes))
+    return (reads.value, writes.value)
+
 # Cancel pending read or writes of a serial port, effectively closing it
 # This allows to close the serial port connection without destroying the underlying fios_serial_t object
 libfios.fios_serial_cancel.argtypes = (POINTER(fios_serial_t),)
@@ -85,6 +188,132 @@ fios_file_status_error = 0
 fios_file_status_in_progress = 1
 fios_file_status_completed = 2
 
+# fios_file_storage_t
+fios_file_storage_stream = 0
+fios_file_storage_pwrite = 1
+fios_file_storage_mmap = 2
+
+# fios_file_sync_t
+fios_file_sync_never = 0
+fios_file_sync_end = 1
+fios_file_sync_chunk = 2
+
+# callback for transfer progress, with the bytes transferred so far and the total size
+# fios_file_progress_callback(cookie, current, size)
+fios_file_progress_callback = CFUNCTYPE(None, c_void_p, c_int64, c_int64)
+
+# callback for the end of a transfer, with status being either fios_file_status_completed or fios_file_status_error
+# fios_file_status_callback(cookie, f, status)
+fios_file_status_callback = CFUNCTYPE(None, c_void_p, POINTER(fios_file_t), c_int)
+
+# options for file operations
+# a zero-initialized struct gives the default behaviour, compatible with older peers
+class fios_file_options_t(Structure):
+    _fields_ = [
+        # number of chunks the sender can have in flight before waiting for an acknowledgement
+        # 0 or 1 means the legacy lock-step protocol where each chunk waits for an "ok" from the receiver
+        # when receiving this is the maximum accepted from the sender, 0 meaning MAX_WINDOW_SIZE
+        ("window", c_uint),
+        # use compact binary frame headers instead of ASCII commands for chunks and acknowledgements
+        # ignored for receiving, where binary framing is always accepted
+        ("binary_framing", c_bool),
+        # adapt the chunk size at runtime between MIN_PAYLOAD_SIZE and the limit advertised by the receiver
+        # ignored for receiving, where adaptive chunk sizing is always accepted
+        ("adaptive_payload", c_bool),
+        # largest chunk size to use or accept with adaptive chunk sizing, 0 meaning MAX_ADAPTIVE_PAYLOAD_SIZE
+        ("max_payload_size", c_uint),
+        # compress each chunk independently with the built-in LZ codec, sending chunks that do not shrink as-is
+        # this implies binary framing, progress is still reported in uncompressed bytes
+        ("compression", c_bool),
+        # protect each frame with a CRC-32, so that damaged or missing chunks are retransmitted instead of failing the transfer
+        # this implies binary framing
+        ("crc", c_bool),
+        # resume a transfer that was interrupted, even across process restarts
+        # when receiving, a small journal is kept next to the output file with the size and checksum of the data already written
+        # when sending, the bytes the receiver already has are checked against the input and skipped if they match
+        ("resume", c_bool),
+        # number of chunks that can wait in a ring buffer for a separate thread to write them to the output when receiving
+        # 0 means chunks are written by the receiving thread as they arrive
+        ("write_queue", c_uint),
+        # only used with batch sessions, skip files the receiver already has with the same size and CRC-32
+        # ignored for receiving, where the sender decides
+        ("skip_unchanged", c_bool),
+        # update an existing copy of the file on the receiver with rsync-style delta encoding
+        # when receiving, the new file is written next to the output and replaces it once complete, when the transfer is closed
+        # when sending, the input is read twice, once to size the instructions and once to send them, and progress then refers to them instead of the file size
+        ("delta", c_bool),
+        # how received data goes into the output file, preallocating it avoids fragmentation on flash filesystems
+        # if the output cannot be preallocated or mapped, chunks are still written in place with positioned writes
+        # ignored for sending, and when receiving with `resume` or `delta`
+        # NOTE not available on Windows, where the stream is always used
+        ("storage", c_int),
+        # when received data is flushed to storage, ignored for sending
+        ("sync", c_int),
+        # called from the transfer thread as data is transferred, at most once every `progress_interval` bytes
+        # must not block, as the transfer waits for it
+        # NOTE not used for batch sessions
+        ("progress_callback", fios_file_progress_callback),
+        # amount of data transferred between calls to `progress_callback`, 0 meaning after every chunk
+        ("progress_interval", c_int64),
+        # called from the transfer thread once the transfer completes or fails, before `fios_file_wait` returns
+        # transfers stopped by `fios_file_close` are not reported, except when they end on their own while being closed,
+        # in which case the callback has returned by the time `fios_file_close` does
+        # NOTE not used for batch sessions
+        ("status_callback", fios_file_status_callback),
+        # passed as-is to `progress_callback` and `status_callback`
+        ("callback_cookie", c_void_p),
+        # run the transfer on the caller's thread from `fios_file_process`, instead of on a thread of its own
+        # the caller waits for the events of `fios_file_get_events` on the file descriptor of `fios_file_get_fd`,
+        # which is the serial port itself, and calls `fios_file_process` whenever they happen or the timeout is over
+        # the transfer only goes on from `fios_file_process`, `fios_file_wait` and `fios_file_close`,
+        # which must always be called from the same thread, and callbacks are called from there too
+        # `write_queue` is ignored, as it needs a thread of its own
+        # NOTE only available for serial ports and sockets, not on Windows nor with musl, and not used for batch sessions
+        ("event_loop", c_bool),
+        # run the transfer on one of the threads of an engine from `fios_engine_open`, instead of on a thread of its own
+        # everything else works as with a thread, except that callbacks are called from the thread of the engine,
+        # where blocking holds up every other transfer it runs
+        # `write_queue` is ignored, and this is ignored itself with `event_loop`
+        # NOTE the same limits as with `event_loop` apply
+        ("engine", POINTER(fios_engine_t)),
+    ]
+
+# number of buckets in the acknowledgement latency histogram of `fios_file_stats_t`
+STATS_LATENCY_BUCKETS = 16
+
+# statistics of a serial file transfer, see `fios_file_get_stats`
+# times are in microseconds, and stop counting once the transfer is done
+class fios_file_stats_t(Structure):
+    _fields_ = [
+        # bytes transferred so far and total size, as in `fios_file_get_bytes`
+        ("current", c_int64),
+        ("size", c_int64),
+        # time since the transfer started
+        ("elapsed_us", c_uint64),
+        # throughput in bytes per second, since the start and over about the last second
+        ("average_rate", c_double),
+        ("instant_rate", c_double),
+        # chunks sent or received, not counting the ones sent again
+        ("chunks", c_uint64),
+        # only when sending, number of chunks acknowledged within each range of latency since they were sent
+        # bucket 0 is below 1 ms, bucket n from 2^(n-1) up to 2^n ms, and the last bucket everything above
+        ("ack_latency", c_uint64 * STATS_LATENCY_BUCKETS),
+        # time spent waiting for the serial port to be readable or writable
+        ("serial_read_us", c_uint64),
+        ("serial_write_us", c_uint64),
+        # time spent in reading the input or writing the output, including the writer thread when receiving
+        ("stream_us", c_uint64),
+        # read and write system calls on the serial port, and how many of them had to be tried again
+        # because they were interrupted or would have blocked
+        # NOTE always 0 for multiplexed channels, which do not do system calls of their own
+        ("reads", c_uint64),
+        ("writes", c_uint64),
+        ("retries", c_uint64),
+        # chunks sent again after being damaged or lost, and damaged frames seen
+        ("retransmits", c_uint64),
+        ("damaged", c_uint64),
+    ]
+
 # prepare to receive data from a serial port into the file @a outpath
 # a background thread is used for receiving data from the serial port and writing to the file
 # use @fios_file_idle to query current progress and @fios_file_close when done
@@ -103,6 +332,42 @@ libfios.fios_file_send.restype  = POINTER(fios_file_t)
 def fios_file_send(s, inpath):
     return libfios.fios_file_send(s, inpath.encode("utf-8"))
 
+# variant of `fios_file_receive` with custom options, which can be None for defaults
+libfios.fios_file_receive_ex.argtypes = (POINTER(fios_serial_t), c_char_p, POINTER(fios_file_options_t),)
+libfios.fios_file_receive_ex.restype  = POINTER(fios_file_t)
+
+def fios_file_receive_ex(s, outpath, options):
+    return libfios.fios_file_receive_ex(s, outpath.encode("utf-8"), pointer(options) if options is not None else None)
+
+# variant of `fios_file_send` with custom options, which can be None for defaults
+libfios.fios_file_send_ex.argtypes = (POINTER(fios_serial_t), c_char_p, POINTER(fios_file_options_t),)
+libfios.fios_file_send_ex.restype  = POINTER(fios_file_t)
+
+def fios_file_send_ex(s, inpath, options):
+    return libfios.fios_file_send_ex(s, inpath.encode("utf-8"), pointer(options) if options is not None else None)
+
+# prepare to receive data from a serial port into memory, with custom options which can be None for defaults
+# data goes into `buffer` (e.g. from `create_string_buffer`), failing the transfer if it does not fit,
+# or into memory allocated to the size announced by the sender if `buffer` is None
+libfios.fios_file_receive_memory.argtypes = (POINTER(fios_serial_t), c_void_p, c_size_t, POINTER(fios_file_options_t),)
+libfios.fios_file_receive_memory.restype  = POINTER(fios_file_t)
+
+def fios_file_receive_memory(s, buffer, options):
+    return libfios.fios_file_receive_memory(s,
+                                            buffer,
+                                            sizeof(buffer) if buffer is not None else 0,
+                                            pointer(options) if options is not None else None)
+
+# get the data received into memory so far
+# NOTE in python this returns a copy of the data as bytes
+libfios.fios_file_get_memory.argtypes = (POINTER(fios_file_t), POINTER(c_size_t),)
+libfios.fios_file_get_memory.restype  = c_void_p
+
+def fios_file_get_memory(f):
+    size = c_size_t(0)
+    data = libfios.fios_file_get_memory(f, pointer(size))
+    return string_at(data, size.value) if data is not None else b""
+
 # check status of an active serial file transfer
 # NOTE in python this returns (status, progress) where:
 # - `status` is normal return value
@@ -114,6 +379,52 @@ def fios_file_idle(f):
     progress = c_float(0.0)
     return (libfios.fios_file_idle(f, pointer(progress)), progress.value)
 
+# get a file descriptor that becomes readable whenever progress or status of a serial file transfer changes
+# this allows event loops to poll it alongside their own file descriptors instead of calling `fios_file_idle` on a timer,
+# calling `fios_file_process` once it is readable
+# the file descriptor belongs to the transfer and is closed by `fios_file_close`
+# for transfers started with the `event_loop` option this is the serial port instead, to be polled for `fios_file_get_events`
+# NOTE not available on Windows, where this returns -1
+libfios.fios_file_get_fd.argtypes = (POINTER(fios_file_t),)
+libfios.fios_file_get_fd.restype  = c_int
+
+def fios_file_get_fd(f):
+    return libfios.fios_file_get_fd(f)
+
+# get the poll events to wait for on the file descriptor of `fios_file_get_fd` before calling `fios_file_process`,
+# along with a timeout in milliseconds after which it must be called anyway, -1 meaning no timeout
+# this is always POLLIN without a timeout, except for transfers started with the `event_loop` option,
+# which wait for their serial port to become readable or writable, and for timeouts of the protocol
+# NOTE in python this returns (events, timeout_ms), for use with `select.poll`
+# NOTE not available on Windows, where this returns 0 for the events
+libfios.fios_file_get_events.argtypes = (POINTER(fios_file_t), POINTER(c_int),)
+libfios.fios_file_get_events.restype  = c_short
+
+def fios_file_get_events(f):
+    timeout_ms = c_int(-1)
+    return (libfios.fios_file_get_events(f, pointer(timeout_ms)), timeout_ms.value)
+
+# acknowledge a notification from the file descriptor of `fios_file_get_fd`, then check status like `fios_file_idle`
+# the file descriptor stays readable until this is called
+# for transfers started with the `event_loop` option, this runs the transfer until it waits for the serial port again,
+# and reports it as in progress until it is done with the serial port, even once `fios_file_idle` says otherwise
+# NOTE in python this returns (status, progress), same as `fios_file_idle`
+libfios.fios_file_process.argtypes = (POINTER(fios_file_t), POINTER(c_float),)
+libfios.fios_file_process.restype  = c_int
+
+def fios_file_process(f):
+    progress = c_float(0.0)
+    return (libfios.fios_file_process(f, pointer(progress)), progress.value)
+
+# wait for a serial file transfer to complete or fail, for up to @a timeout_ms when not negative
+# returns fios_file_status_in_progress if still running once @a timeout_ms is over
+# transfers started with the `event_loop` option are run by this in the meantime
+libfios.fios_file_wait.argtypes = (POINTER(fios_file_t), c_int,)
+libfios.fios_file_wait.restype  = c_int
+
+def fios_file_wait(f, timeout_ms):
+    return libfios.fios_file_wait(f, timeout_ms)
+
 # get the current progress of an active serial file transfer
 # returns a value between 0.0 and 1.0
 libfios.fios_file_get_progress.argtypes = (POINTER(fios_file_t),)
@@ -122,8 +433,31 @@ libfios.fios_file_get_progress.restype  = c_float
 def fios_file_get_progress(f):
     return libfios.fios_file_get_progress(f)
 
+# get the number of bytes transferred so far and the total size of an active serial file transfer
+# NOTE in python this returns (current, size)
+libfios.fios_file_get_bytes.argtypes = (POINTER(fios_file_t), POINTER(c_int64), POINTER(c_int64),)
+libfios.fios_file_get_bytes.restype  = None
+
+def fios_file_get_bytes(f):
+    current = c_int64(0)
+    size = c_int64(0)
+    libfios.fios_file_get_bytes(f, pointer(current), pointer(size))
+    return (current.value, size.value)
+
+# get statistics of a serial file transfer, to see where time goes in a slow one
+# counters are updated by the transfer as it goes without any locking, so this can be called at any time and as often as needed
+# NOTE in python this returns a new `fios_file_stats_t`
+libfios.fios_file_get_stats.argtypes = (POINTER(fios_file_t), POINTER(fios_file_stats_t),)
+libfios.fios_file_get_stats.restype  = None
+
+def fios_file_get_stats(f):
+    stats = fios_file_stats_t()
+    libfios.fios_file_get_stats(f, pointer(stats))
+    return stats
+
 # close the file operation
 # must still be called even if `fios_file_idle` returns false
+# transfers started with the `event_loop` option are stopped by running what is left of them until they fail
 libfios.fios_file_close.argtypes = (POINTER(fios_file_t),)
 libfios.fios_file_close.restype  = None
 
@@ -139,3 +473,242 @@ def fios_file_get_last_error(f):
     return libfios.fios_file_get_last_error(f).decode("utf-8")
 
 # ---------------------------------------------------------------------------------------------------------------------
+# batch sessions, many files over a single connection (using a background thread)
+
+# maximum number of files in a batch session
+MAX_BATCH_FILES = 0xffff
+
+# maximum size of a file name in a batch session, in bytes and including subdirectories
+MAX_BATCH_NAME_SIZE = 0x400
+
+# prepare to send the files in @a paths into a serial port, one after the other
+# the receiver first gets a manifest with the name and size of every file, names being the last component of each path
+# fails if two paths end with the same name
+# @a options apply to every file and can be None for defaults
+# use `fios_batch_idle` to query current progress and `fios_batch_close` when done
+libfios.fios_batch_send.argtypes = (POINTER(fios_serial_t), POINTER(c_char_p), c_uint, POINTER(fios_file_options_t),)
+libfios.fios_batch_send.restype  = POINTER(fios_batch_t)
+
+def fios_batch_send(s, paths, options):
+    cpaths = (c_char_p * len(paths))(*[path.encode("utf-8") for path in paths])
+    return libfios.fios_batch_send(s, cpaths, len(paths), pointer(options) if options is not None else None)
+
+# variant of `fios_batch_send` for files in the directory @a basedir, keeping their subdirectories on the receiver
+# @a names are relative to @a basedir, with '/' as separator, and are used as they are in the manifest
+# the same rules as on the receiving side apply to them, they cannot be absolute or point outside @a basedir
+libfios.fios_batch_send_dir.argtypes = (POINTER(fios_serial_t), c_char_p, POINTER(c_char_p), c_uint, POINTER(fios_file_options_t),)
+libfios.fios_batch_send_dir.restype  = POINTER(fios_batch_t)
+
+def fios_batch_send_dir(s, basedir, names, options):
+    cnames = (c_char_p * len(names))(*[name.encode("utf-8") for name in names])
+    return libfios.fios_batch_send_dir(s, basedir.encode("utf-8"), cnames, len(names), pointer(options) if options is not None else None)
+
+# prepare to receive a batch of files from a serial port into the existing directory @a destdir
+# files are created with the names from the manifest, which can include subdirectories but never point outside @a destdir
+# the whole batch is rejected, before anything is created, if a name is invalid or used twice
+# @a options apply to every file and can be None for defaults
+# use `fios_batch_idle` to query current progress and `fios_batch_close` when done
+libfios.fios_batch_receive.argtypes = (POINTER(fios_serial_t), c_char_p, POINTER(fios_file_options_t),)
+libfios.fios_batch_receive.restype  = POINTER(fios_batch_t)
+
+def fios_batch_receive(s, destdir, options):
+    return libfios.fios_batch_receive(s, destdir.encode("utf-8"), pointer(options) if options is not None else None)
+
+# check status of an active batch session
+# NOTE in python this returns (status, progress) where:
+# - `status` is normal return value
+# - `progress` is current progress over all files between 0.0 and 1.0
+libfios.fios_batch_idle.argtypes = (POINTER(fios_batch_t), POINTER(c_float),)
+libfios.fios_batch_idle.restype  = c_int
+
+def fios_batch_idle(b):
+    progress = c_float(0.0)
+    return (libfios.fios_batch_idle(b, pointer(progress)), progress.value)
+
+# get the file currently being transferred in a batch session, along with its progress between 0.0 and 1.0
+# NOTE in python this returns (progress, index, count), with `count` being 0 while the receiver waits for the manifest
+libfios.fios_batch_get_file_progress.argtypes = (POINTER(fios_batch_t), POINTER(c_uint), POINTER(c_uint),)
+libfios.fios_batch_get_file_progress.restype  = c_float
+
+def fios_batch_get_file_progress(b):
+    index = c_uint(0)
+    count = c_uint(0)
+    progress = libfios.fios_batch_get_file_progress(b, pointer(index), pointer(count))
+    return (progress, index.value, count.value)
+
+# get the name of the file at @a index in the manifest of a batch session, or None if there is no such file
+libfios.fios_batch_get_file_name.argtypes = (POINTER(fios_batch_t), c_uint,)
+libfios.fios_batch_get_file_name.restype  = c_char_p
+
+def fios_batch_get_file_name(b, index):
+    name = libfios.fios_batch_get_file_name(b, index)
+    return name.decode("utf-8") if name is not None else None
+
+# get the number of files in a batch session that were skipped because the receiver already had them
+libfios.fios_batch_get_skipped.argtypes = (POINTER(fios_batch_t),)
+libfios.fios_batch_get_skipped.restype  = c_uint
+
+def fios_batch_get_skipped(b):
+    return libfios.fios_batch_get_skipped(b)
+
+# get the number of bytes transferred so far and the total size of all files in a batch session
+# NOTE in python this returns (current, size)
+libfios.fios_batch_get_bytes.argtypes = (POINTER(fios_batch_t), POINTER(c_int64), POINTER(c_int64),)
+libfios.fios_batch_get_bytes.restype  = None
+
+def fios_batch_get_bytes(b):
+    current = c_int64(0)
+    size = c_int64(0)
+    libfios.fios_batch_get_bytes(b, pointer(current), pointer(size))
+    return (current.value, size.value)
+
+# close the batch session, cancelling it if still in progress
+# must still be called even if `fios_batch_idle` returns false
+libfios.fios_batch_close.argtypes = (POINTER(fios_batch_t),)
+libfios.fios_batch_close.restype  = None
+
+def fios_batch_close(b):
+    libfios.fios_batch_close(b)
+
+# get the error message for the case where `fios_batch_idle` returns `fios_file_status_error`
+# must not be called after `fios_batch_close`
+libfios.fios_batch_get_last_error.argtypes = (POINTER(fios_batch_t),)
+libfios.fios_batch_get_last_error.restype  = c_char_p
+
+def fios_batch_get_last_error(b):
+    return libfios.fios_batch_get_last_error(b).decode("utf-8")
+
+# ---------------------------------------------------------------------------------------------------------------------
+# multiplexing, concurrent transfers in both directions over a single serial port (using a background thread)
+
+# maximum number of channels of a multiplexed serial port
+MAX_MUX_CHANNELS = 16
+
+# start multiplexing a serial port, which must be done by both sides before opening any channel
+# everything sent over the serial port is then checksummed, with any damage stopping all channels
+# the serial port must not be used directly until `fios_mux_close`
+libfios.fios_mux_open.argtypes = (POINTER(fios_serial_t),)
+libfios.fios_mux_open.restype  = POINTER(fios_mux_t)
+
+def fios_mux_open(s):
+    return libfios.fios_mux_open(s)
+
+# open a channel of a multiplexed serial port, returning a serial port usable for file transfers and batch sessions
+# each side picks which transfer goes into which channel, with a channel on one side talking to the same one on the other
+# channels take turns with the serial port one frame at a time, and data sent into a channel waits for the peer to read it
+# close it with `fios_serial_close`, after which it can be opened again
+# data received but not read by then is dropped, data arriving afterwards is kept for the next time the channel is opened
+libfios.fios_mux_open_channel.argtypes = (POINTER(fios_mux_t), c_uint,)
+libfios.fios_mux_open_channel.restype  = POINTER(fios_serial_t)
+
+def fios_mux_open_channel(m, channel):
+    return libfios.fios_mux_open_channel(m, channel)
+
+# stop multiplexing, cancelling the serial port
+# all channels must be closed first, the serial port itself still needs `fios_serial_close` afterwards
+libfios.fios_mux_close.argtypes = (POINTER(fios_mux_t),)
+libfios.fios_mux_close.restype  = None
+
+def fios_mux_close(m):
+    libfios.fios_mux_close(m)
+
+# ---------------------------------------------------------------------------------------------------------------------
+# bonded transfers, a single file striped over several serial ports (using a background thread per serial port)
+
+# maximum number of serial ports of a bonded transfer
+MAX_BOND_LINKS = 8
+
+# prepare to send a file over the serial ports in @a serials at once
+# the file is split into stripes, each serial port taking the next one as soon as it is done with the previous
+# so that faster serial ports carry more of the file
+# @a options apply to every stripe and can be None for defaults, resume and delta updates are not available
+# a failure on any serial port fails the whole transfer
+# use `fios_bond_idle` to query current progress and `fios_bond_close` when done
+libfios.fios_bond_send.argtypes = (POINTER(POINTER(fios_serial_t)), c_uint, c_char_p, POINTER(fios_file_options_t),)
+libfios.fios_bond_send.restype  = POINTER(fios_bond_t)
+
+def fios_bond_send(serials, inpath, options):
+    cserials = (POINTER(fios_serial_t) * len(serials))(*serials)
+    return libfios.fios_bond_send(cserials, len(serials), inpath.encode("utf-8"), pointer(options) if options is not None else None)
+
+# prepare to receive a file over the serial ports in @a serials at once, into @a outpath
+# the serial ports must be connected to the same ones given to `fios_bond_send` on the other side, in any order
+# @a options apply to every stripe and can be None for defaults
+# use `fios_bond_idle` to query current progress and `fios_bond_close` when done
+libfios.fios_bond_receive.argtypes = (POINTER(POINTER(fios_serial_t)), c_uint, c_char_p, POINTER(fios_file_options_t),)
+libfios.fios_bond_receive.restype  = POINTER(fios_bond_t)
+
+def fios_bond_receive(serials, outpath, options):
+    cserials = (POINTER(fios_serial_t) * len(serials))(*serials)
+    return libfios.fios_bond_receive(cserials, len(serials), outpath.encode("utf-8"), pointer(options) if options is not None else None)
+
+# check status of an active bonded transfer
+# NOTE in python this returns (status, progress) where:
+# - `status` is normal return value
+# - `progress` is current progress over all serial ports between 0.0 and 1.0
+libfios.fios_bond_idle.argtypes = (POINTER(fios_bond_t), POINTER(c_float),)
+libfios.fios_bond_idle.restype  = c_int
+
+def fios_bond_idle(b):
+    progress = c_float(0)
+    return (libfios.fios_bond_idle(b, pointer(progress)), progress.value)
+
+# get the number of bytes transferred so far and the total size of a bonded transfer
+# size is 0 while the receiver is still waiting for it
+# NOTE in python this returns (current, size)
+libfios.fios_bond_get_bytes.argtypes = (POINTER(fios_bond_t), POINTER(c_int64), POINTER(c_int64),)
+libfios.fios_bond_get_bytes.restype  = None
+
+def fios_bond_get_bytes(b):
+    current = c_int64(0)
+    size = c_int64(0)
+    libfios.fios_bond_get_bytes(b, pointer(current), pointer(size))
+    return (current.value, size.value)
+
+# get the number of bytes transferred so far over the serial port at @a index of a bonded transfer
+libfios.fios_bond_get_link_bytes.argtypes = (POINTER(fios_bond_t), c_uint,)
+libfios.fios_bond_get_link_bytes.restype  = c_int64
+
+def fios_bond_get_link_bytes(b, index):
+    return libfios.fios_bond_get_link_bytes(b, index)
+
+# close the bonded transfer, cancelling it if still in progress
+# must still be called even if `fios_bond_idle` returns false
+# the serial ports still need `fios_serial_close` afterwards
+libfios.fios_bond_close.argtypes = (POINTER(fios_bond_t),)
+libfios.fios_bond_close.restype  = None
+
+def fios_bond_close(b):
+    libfios.fios_bond_close(b)
+
+# get the error message for the case where `fios_bond_idle` returns `fios_file_status_error`
+# must not be called after `fios_bond_close`
+libfios.fios_bond_get_last_error.argtypes = (POINTER(fios_bond_t),)
+libfios.fios_bond_get_last_error.restype  = c_char_p
+
+def fios_bond_get_last_error(b):
+    return libfios.fios_bond_get_last_error(b).decode("utf-8")
+
+# ---------------------------------------------------------------------------------------------------------------------
+# engines, transfers on many serial ports at once (using a few background threads for all of them)
+
+# start an engine with @a threads threads, 0 meaning 1, for transfers started with it in their options
+# each thread waits on the serial ports of all of its transfers at once, and runs them as they become ready,
+# so that transfers on dozens of serial ports do not need a thread each
+# transfers go to the thread with the fewest of them, and stay there until done
+# NOTE not available on Windows nor with musl, where this returns a null pointer
+libfios.fios_engine_open.argtypes = (c_uint,)
+libfios.fios_engine_open.restype  = POINTER(fios_engine_t)
+
+def fios_engine_open(threads):
+    return libfios.fios_engine_open(threads)
+
+# stop the threads of an engine
+# every transfer started with it must be closed before
+libfios.fios_engine_close.argtypes = (POINTER(fios_engine_t),)
+libfios.fios_engine_close.restype  = None
+
+def fios_engine_close(e):
+    libfios.fios_engine_close(e)
+
+# ---------------------------------------------------------------------------------------------------------------------